@@ -47,12 +47,14 @@ static int cmd_uname(int argc, char *argv[]) {
 }
 
 extern int js_main(int argc, char **argv);
+extern int cmd_profile(int argc, char **argv);
 
 static const ngshell_cmd_t cmdlist[] = {
 		{ "uname", cmd_uname }, /**/
 		{ "mem", cmd_mem }, /**/
 		{ "threads", cmd_threads }, /**/
 		{ "js", js_main }, /**/
+		{ "profile", cmd_profile }, /**/
 		{ "test", cmd_test }, /**/
 		{ "mount", cmd_mount }, /**/
 		{ "umount", cmd_unmount }, /**/
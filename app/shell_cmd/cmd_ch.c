@@ -8,19 +8,18 @@ extern SerialUSBDriver SDU1;
 
 #define TEST_WA_SIZE    THD_WA_SIZE(256)
 
+extern int js_mem(int argc, char *argv[]);
+
 int cmd_mem(int argc, char *argv[]) {
 	size_t n, size;
 
-	(void) argv;
-	if (argc > 1) {
-		printf("Usage: mem\r\n");
-		return 0;
-	}
+	if (argc > 1)
+		return js_mem(argc, argv);
 	n = chHeapStatus(NULL, &size);
 	printf("core free memory : %u bytes\r\n", chCoreStatus());
 	printf("heap fragments   : %u\r\n", n);
 	printf("heap free total  : %u bytes\r\n", size);
-	return 0;
+	return js_mem(argc, argv);
 }
 
 int cmd_threads(int argc, char *argv[]) {
@@ -32,15 +32,26 @@
 
 #include "TinyJS.h"
 #include "TinyJS_Functions.h"
+#include "TinyJS_Modules.h"
+#include "TinyJS_Profiler.h"
+#include "TinyJS_RegExp.h"
+#include "TinyJS_Memory.h"
+#include "TinyJS_FS.h"
+#include "TinyJS_Collections.h"
+#include "TinyJS_Time.h"
+#include "TinyJS_Binary.h"
+#include "TinyJS_Checksum.h"
+#include "TinyJS_AllocTrace.h"
+#include "TinyJS_HAL.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <ctype.h>
 
 #include <iostream>     // std::cout
-#include <fstream>      // std::ifstream
 #include <string>       // std::string
 
 #include <rdline.h>
@@ -61,18 +72,22 @@ static char history_arena[RDLINE_HISTORY_ARENA_SIZE(LINE_LEN, HISTORY_LEN)];
 static char buffer[LINE_LEN];
 static const RDLINE_CONFIG(rd, buffer, sizeof(buffer), &rdline_stdout, history_arena);
 
-std::string readall(const char *filename) {
-	std::ifstream is(filename, std::ifstream::in);
-	if (is) {
-		std::string text;
-		is.seekg(0, std::ifstream::end);
-		text.resize(is.tellg());
-		is.seekg(0, std::ifstream::beg);
-		is.read(&text[0], text.size());
-		is.close();
-		return text;
+/* Statements are run as they are read, so a script doesn't need to fit in
+   memory as a whole */
+static void runfile(CTinyJS *js, const char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("ERROR: Unable to open '%s'\n", filename);
+		return;
 	}
-	return std::string();
+	CScriptFdReader reader(fd);
+	try {
+		js->execute(&reader);
+	} catch (CScriptException *e) {
+		printf("ERROR: %s\n", e->text.c_str());
+		delete e;
+	}
+	close(fd);
 }
 
 #ifdef __linux__
@@ -89,6 +104,16 @@ extern "C" int js_main(int argc, char **argv)
 	CTinyJS *js = new CTinyJS();
 	/* add the functions from TinyJS_Functions.cpp */
 	registerFunctions(js);
+	registerModuleFunctions(js);
+	registerProfilerFunctions(js);
+	registerRegExpFunctions(js);
+	registerMemoryFunctions(js);
+	registerFSFunctions(js);
+	registerCollectionFunctions(js);
+	registerTimeFunctions(js);
+	registerBinaryFunctions(js);
+	registerChecksumFunctions(js);
+	registerHALFunctions(js);
 	/* Add a native function */
 	js->addNative("function print(text)", &js_print, 0);
 	js->addNative("function dump()", &js_dump, js);
@@ -96,7 +121,7 @@ extern "C" int js_main(int argc, char **argv)
 	 we wanted something returned */
 	if (argc > 1) {
 		for (int i = 1; i < argc; i++)
-			js->execute(readall(argv[1]));
+			runfile(js, argv[i]);
 	} else {
 		try {
 			js->execute("var lets_quit = 0;"
@@ -128,6 +153,11 @@ extern "C" int js_main(int argc, char **argv)
 			}
 		}
 	}
+#ifdef TINYJS_TRACE_ALLOC
+	jsAllocTrace.dumpSites();
+	jsAllocTrace.dumpLifetimes();
+	jsAllocTrace.dumpHeap(js->root);
+#endif
 	delete js;
 	return 0;
 }
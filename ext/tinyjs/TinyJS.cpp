@@ -120,6 +120,8 @@
  */
 
 #include "TinyJS.h"
+#include "TinyJS_Profiler.h"
+#include "TinyJS_AllocTrace.h"
 #include <assert.h>
 
 #define ASSERT(X) assert(X)
@@ -128,12 +130,30 @@
 /* Create a LINK to point to VAR and free the old link.
  * BUT this is more clever - it tries to keep the old link if it's not owned to save allocations */
 #define CREATE_LINK(LINK, VAR) { if (!LINK || LINK->owned) LINK = new CScriptVarLink(VAR); else LINK->replaceWith(VAR); }
+/* Every nested JS call goes through statement, the expression parsers and
+ * factor, so their frames stay on the C stack while it runs. Branches with
+ * a lot of locals are kept in functions of their own, which mustn't be
+ * inlined back in */
+#ifdef __GNUC__
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
 
 #include <string>
 #include <string.h>
 #include <sstream>
+#include <algorithm>
+#include <new>
 #include <cstdlib>
 #include <stdio.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -292,6 +312,33 @@ CScriptException::CScriptException(const string &exceptionText) {
     text = exceptionText;
 }
 
+// ----------------------------------------------------------------------------------- CSCRIPTERROR
+
+void CScriptError::set(const char *fmt, ...) {
+    if (pending) return; // the first error is the interesting one
+    pending = true;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+}
+
+// ----------------------------------------------------------------------------------- CSCRIPTREADER
+
+int CScriptFdReader::read(char *buf, int len) {
+    int n = ::read(fd, buf, len);
+    return n>0 ? n : 0;
+}
+
+CScriptFileReader::CScriptFileReader(const string &filename) : CScriptFdReader(open(filename.c_str(), O_RDONLY)) {
+    if (fd<0)
+        throw new CScriptException("Unable to read script '" + filename + "'");
+}
+
+CScriptFileReader::~CScriptFileReader() {
+    close(fd);
+}
+
 // ----------------------------------------------------------------------------------- CSCRIPTLEX
 
 CScriptLex::CScriptLex(const string &input) {
@@ -299,19 +346,71 @@ CScriptLex::CScriptLex(const string &input) {
     dataOwned = true;
     dataStart = 0;
     dataEnd = strlen(data);
+    dataBase = 0;
+    dataSize = dataEnd+1;
+    baseLine = baseCol = 1;
+    reader = 0;
+    streaming = false;
+    errors = 0;
+    source = input.data();
+    reset();
+}
+
+CScriptLex::CScriptLex(CScriptReader *reader) {
+    data = (char*)malloc(TINYJS_LEX_WINDOW);
+    dataOwned = true;
+    dataStart = 0;
+    dataEnd = 0;
+    dataBase = 0;
+    dataSize = TINYJS_LEX_WINDOW;
+    baseLine = baseCol = 1;
+    this->reader = reader;
+    streaming = true;
+    errors = 0;
+    source = reader;
     reset();
 }
 
 CScriptLex::CScriptLex(CScriptLex *owner, int startChar, int endChar) {
-    data = owner->data;
-    dataOwned = false;
+    // a span the owner doesn't have (say after a syntax error) gives an empty lexer
+    if (startChar<owner->dataBase || endChar<startChar || endChar>owner->dataEnd) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Can't re-read the script from %d to %d", startChar, endChar);
+        if (!owner->errors)
+            throw new CScriptException(string(msg) + " at " + owner->getPosition());
+        owner->errors->set("%s at %s", msg, owner->getPosition().c_str());
+        startChar = endChar = owner->dataEnd;
+    }
+    if (owner->streaming) {
+        // the owner's window will move on, so take a copy of our part of it
+        dataSize = endChar-startChar;
+        data = (char*)malloc(dataSize+1);
+        memcpy(data, &owner->data[startChar-owner->dataBase], dataSize);
+        dataOwned = true;
+        dataBase = startChar;
+        owner->getLineCol(startChar, baseLine, baseCol);
+    } else {
+        data = owner->data;
+        dataOwned = false;
+        dataBase = owner->dataBase;
+        dataSize = owner->dataSize;
+        baseLine = owner->baseLine;
+        baseCol = owner->baseCol;
+    }
     dataStart = startChar;
     dataEnd = endChar;
+    reader = 0;
+    streaming = false;
+    errors = owner->errors;
+    source = owner->source;
     reset();
 }
 
 CScriptLex::~CScriptLex(void)
 {
+#ifdef TINYJS_TRACE_ALLOC
+    jsAllocTrace.forget(this);
+#endif
     if (dataOwned)
         free((void*)data);
 }
@@ -328,8 +427,134 @@ void CScriptLex::reset() {
     getNextToken();
 }
 
+void CScriptLex::skipToEnd() {
+    // tokenLastEnd is left alone, so getPosition() still says where we stopped
+    reader = 0;
+    dataPos = dataEnd;
+    currCh = nextCh = 0;
+    tk = LEX_EOF;
+    tkStr.clear();
+    tokenStart = tokenEnd = dataEnd;
+}
+
+/// Keywords that an expression follows, so that a '/' after them starts a regular expression
+/* Whether the significant character at pos, which skipBlock() passed last,
+   ends an operand: a name or a number, a literal ('"'), ')' or ']'. Only a
+   '/', '++' or '--' after it asks, so a name isn't looked at until then -
+   it's read back from the window, which skipBlock() doesn't release. It
+   doesn't end an operand if it's a keyword that takes one, like 'return' */
+bool CScriptLex::endsOperand(char last, int pos) {
+    if (last==')' || last==']' || last=='"') return true;
+    if (!isAlpha(last) && !isNumeric(last)) return false;
+    int start = pos;
+    while (start>dataStart && start>dataBase &&
+           (isAlpha(data[start-1-dataBase]) || isNumeric(data[start-1-dataBase]) || data[start-1-dataBase]=='.'))
+        start--;
+    static const char *keywords[] = { "return", "typeof", "case", "do", "else", "in", "instanceof",
+                                      "new", "delete", "throw", "void", 0 };
+    size_t len = pos+1-start;
+    for (int i=0;keywords[i];i++)
+        if (strlen(keywords[i])==len && strncmp(&data[start-dataBase], keywords[i], len)==0) return false;
+    return true;
+}
+
+/* A character at a time, this is much cheaper than tokenising a block just
+   to throw the tokens away - which is all a function body needs until the
+   function is called. Strings, comments and regular expression literals are
+   skipped whole, so braces in them don't count. Like most JS tools, a '/'
+   is taken to be a division when it follows the end of an operand - a name,
+   a literal, ')', ']' or a postfix ++ or -- - and to start a regular
+   expression anywhere else. */
+void CScriptLex::skipBlock() {
+    ASSERT(tk=='{');
+    int depth = 1;
+    char last = '{'; // last significant character
+    int lastPos = 0; // and where it was
+    while (currCh) {
+        if (currCh=='/' && nextCh=='/') {
+            while (currCh && currCh!='\n') getNextCh();
+            continue;
+        }
+        if (currCh=='/' && nextCh=='*') {
+            getNextCh();
+            getNextCh();
+            while (currCh && (currCh!='*' || nextCh!='/')) getNextCh();
+            getNextCh();
+            getNextCh();
+            continue;
+        }
+        if (currCh=='"' || currCh=='\'' || (currCh=='/' && !endsOperand(last, lastPos))) {
+            char quote = currCh;
+            bool inClass = false; // a '/' in a regular expression's [class] doesn't end it
+            getNextCh();
+            while (currCh && (currCh!=quote || inClass)) {
+                if (quote=='/' && currCh=='\n') break; // wasn't a regular expression after all
+                if (currCh=='\\') getNextCh();
+                else if (quote=='/' && currCh=='[') inClass = true;
+                else if (quote=='/' && currCh==']') inClass = false;
+                getNextCh();
+            }
+            if (currCh==quote) getNextCh();
+            last = '"'; // a literal
+            continue;
+        }
+        if ((currCh=='+' || currCh=='-') && nextCh==currCh) {
+            // after an operand it's postfix, and ends it - otherwise an operand follows
+            if (!endsOperand(last, lastPos)) last = '+';
+            getNextCh();
+            getNextCh();
+            continue;
+        }
+        if (currCh=='{') depth++;
+        if (currCh=='}' && --depth==0) break;
+        if (!isWhitespace(currCh)) {
+            last = currCh;
+            lastPos = dataPos-2;
+        }
+        getNextCh();
+    }
+    if (!currCh) { // no matching '}'
+        getNextToken();
+        return;
+    }
+    // leave the '}' as the current token, as getNextToken() would have
+    tkStr.clear();
+    tokenStart = dataPos-2;
+    tk = currCh;
+    getNextCh();
+    tokenLastEnd = tokenEnd;
+    tokenEnd = dataPos-3;
+}
+
+/* Only release() moves a streaming lex's window on, so the text read to
+   look ahead is still there to go back to. */
+int CScriptLex::peek(int n) {
+    char oldCurrCh = currCh, oldNextCh = nextCh;
+    int oldDataPos = dataPos, oldTk = tk;
+    int oldTokenStart = tokenStart, oldTokenEnd = tokenEnd, oldTokenLastEnd = tokenLastEnd;
+    string oldTkStr = tkStr;
+    while (n-->0 && tk!=LEX_EOF) getNextToken();
+    int result = tk;
+    currCh = oldCurrCh;
+    nextCh = oldNextCh;
+    dataPos = oldDataPos;
+    tk = oldTk;
+    tokenStart = oldTokenStart;
+    tokenEnd = oldTokenEnd;
+    tokenLastEnd = oldTokenLastEnd;
+    tkStr = oldTkStr;
+    return result;
+}
+
 void CScriptLex::match(int expected_tk) {
     if (tk!=expected_tk) {
+        if (errors) {
+            if (!errors->pending)
+                errors->set("Got %s expected %s at %s", getTokenStr(tk).c_str(),
+                            getTokenStr(expected_tk).c_str(), getPosition(tokenStart).c_str());
+            skipToEnd();
+            return;
+        }
         ostringstream errorString;
         errorString << "Got " << getTokenStr(tk) << " expected " << getTokenStr(expected_tk)
          << " at " << getPosition(tokenStart);
@@ -386,6 +611,10 @@ string CScriptLex::getTokenStr(int token) {
         case LEX_R_NULL : return "null";
         case LEX_R_UNDEFINED : return "undefined";
         case LEX_R_NEW : return "new";
+        case LEX_R_IN : return "in";
+        case LEX_R_SWITCH : return "switch";
+        case LEX_R_CASE : return "case";
+        case LEX_R_DEFAULT : return "default";
     }
 
     ostringstream msg;
@@ -395,13 +624,45 @@ string CScriptLex::getTokenStr(int token) {
 
 void CScriptLex::getNextCh() {
     currCh = nextCh;
+    if (dataPos >= dataEnd && reader)
+        readMore();
     if (dataPos < dataEnd)
-        nextCh = data[dataPos];
+        nextCh = data[dataPos-dataBase];
     else
         nextCh = 0;
     dataPos++;
 }
 
+void CScriptLex::readMore() {
+    int used = dataEnd-dataBase;
+    if (used == dataSize) {
+        // a single statement that doesn't fit - make the window bigger
+        dataSize *= 2;
+        data = (char*)realloc(data, dataSize);
+    }
+    int n = reader->read(&data[used], dataSize-used);
+    if (n>0)
+        dataEnd += n;
+    else
+        reader = 0;
+}
+
+void CScriptLex::release(int pos) {
+    if (!streaming || pos<=dataBase) return;
+    if (pos>dataEnd) pos = dataEnd;
+    int line, col;
+    getLineCol(pos, line, col);
+    baseLine = line;
+    baseCol = col;
+    memmove(data, &data[pos-dataBase], dataEnd-pos);
+    dataBase = pos;
+    // give back what a long statement made us allocate
+    if (dataSize>TINYJS_LEX_WINDOW && dataEnd-dataBase<TINYJS_LEX_WINDOW) {
+        dataSize = TINYJS_LEX_WINDOW;
+        data = (char*)realloc(data, dataSize);
+    }
+}
+
 void CScriptLex::getNextToken() {
     tk = LEX_EOF;
     tkStr.clear();
@@ -445,6 +706,10 @@ void CScriptLex::getNextToken() {
         else if (tkStr=="null") tk = LEX_R_NULL;
         else if (tkStr=="undefined") tk = LEX_R_UNDEFINED;
         else if (tkStr=="new") tk = LEX_R_NEW;
+        else if (tkStr=="in") tk = LEX_R_IN;
+        else if (tkStr=="switch") tk = LEX_R_SWITCH;
+        else if (tkStr=="case") tk = LEX_R_CASE;
+        else if (tkStr=="default") tk = LEX_R_DEFAULT;
     } else if (isNumeric(currCh)) { // Numbers
         bool isHex = false;
         if (currCh=='0') { tkStr += currCh; getNextCh(); }
@@ -608,17 +873,15 @@ void CScriptLex::getNextToken() {
 
 string CScriptLex::getSubString(int lastPosition) {
     int lastCharIdx = tokenLastEnd+1;
-    if (lastCharIdx < dataEnd) {
-        /* save a memory alloc by using our data array to create the
-           substring */
-        char old = data[lastCharIdx];
-        data[lastCharIdx] = 0;
-        std::string value = &data[lastPosition];
-        data[lastCharIdx] = old;
-        return value;
-    } else {
-        return std::string(&data[lastPosition]);
-    }
+    if (lastCharIdx > dataEnd) lastCharIdx = dataEnd;
+    return std::string(&data[lastPosition-dataBase], lastCharIdx-lastPosition);
+}
+
+bool CScriptLex::isSubString(int lastPosition, const std::string &text) {
+    int lastCharIdx = tokenLastEnd+1;
+    if (lastCharIdx > dataEnd) lastCharIdx = dataEnd;
+    return text.size()==(size_t)(lastCharIdx-lastPosition) &&
+           memcmp(&data[lastPosition-dataBase], text.data(), text.size())==0;
 }
 
 
@@ -630,13 +893,14 @@ CScriptLex *CScriptLex::getSubLex(int lastPosition) {
         return new CScriptLex(this, lastPosition, dataEnd );
 }
 
-string CScriptLex::getPosition(int pos) {
+void CScriptLex::getLineCol(int pos, int &line, int &col) {
     if (pos<0) pos=tokenLastEnd;
-    int line = 1,col = 1;
-    for (int i=0;i<pos;i++) {
+    line = baseLine;
+    col = baseCol;
+    for (int i=dataBase;i<pos;i++) {
         char ch;
         if (i < dataEnd)
-            ch = data[i];
+            ch = data[i-dataBase];
         else
             ch = 0;
         col++;
@@ -645,34 +909,77 @@ string CScriptLex::getPosition(int pos) {
             col = 0;
         }
     }
+}
+
+string CScriptLex::getPosition(int pos) {
+    int line, col;
+    getLineCol(pos, line, col);
     char buf[256];
     sprintf_s(buf, 256, "(line: %d, col: %d)", line, col);
     return buf;
 }
 
+int CScriptLex::getLine(int pos) {
+    int line, col;
+    getLineCol(pos, line, col);
+    return line;
+}
+
 // ----------------------------------------------------------------------------------- CSCRIPTVARLINK
 
-CScriptVarLink::CScriptVarLink(CScriptVar *var, const std::string &name) {
+/// The name of every temporary link
+static const string linkTempName(TINYJS_TEMP_NAME);
+
+CScriptVarLink::CScriptVarLink(CScriptVar *var)
+  : name(linkTempName) {
+#if DEBUG_MEMORY
+    mark_allocated(this);
+#endif
+    this->nextSibling = 0;
+    this->prevSibling = 0;
+    this->var = var->ref();
+    this->owned = false;
+    this->ownsName = false;
+}
+
+CScriptVarLink::CScriptVarLink(CScriptVar *var, const std::string *sharedName)
+  : name(*sharedName) {
 #if DEBUG_MEMORY
     mark_allocated(this);
 #endif
-    this->name = name;
     this->nextSibling = 0;
     this->prevSibling = 0;
     this->var = var->ref();
     this->owned = false;
+    this->ownsName = false;
 }
 
-CScriptVarLink::CScriptVarLink(const CScriptVarLink &link) {
+CScriptVarLink::CScriptVarLink(const CScriptVarLink &link)
+  : name(linkTempName) {
     // Copy constructor
 #if DEBUG_MEMORY
     mark_allocated(this);
 #endif
-    this->name = link.name;
     this->nextSibling = 0;
     this->prevSibling = 0;
     this->var = link.var->ref();
     this->owned = false;
+    this->ownsName = false;
+}
+
+CScriptVarLink *CScriptVarLink::create(CScriptVar *var, const std::string &name) {
+    // the name goes just after the link (the size of which is a multiple of a pointer's, as a string's alignment is)
+    void *mem = operator new(sizeof(CScriptVarLink) + sizeof(std::string));
+    std::string *ownName;
+    try {
+      ownName = new ((char*)mem + sizeof(CScriptVarLink)) std::string(name);
+    } catch (...) {
+      operator delete(mem);
+      throw;
+    }
+    CScriptVarLink *link = new (mem) CScriptVarLink(var, ownName);
+    link->ownsName = true;
+    return link;
 }
 
 CScriptVarLink::~CScriptVarLink() {
@@ -680,6 +987,10 @@ CScriptVarLink::~CScriptVarLink() {
     mark_deallocated(this);
 #endif
     var->unref();
+    if (ownsName) {
+      using std::string;
+      const_cast<string&>(name).~string();
+    }
 }
 
 void CScriptVarLink::replaceWith(CScriptVar *newVar) {
@@ -701,11 +1012,336 @@ int CScriptVarLink::getIntName() {
 void CScriptVarLink::setIntName(int n) {
     char sIdx[64];
     sprintf_s(sIdx, sizeof(sIdx), "%d", n);
-    name = sIdx;
+    ASSERT(ownsName);
+    const_cast<std::string&>(name) = sIdx;
+}
+
+// ----------------------------------------------------------------------------------- CSCRIPTSHAPE
+
+int CScriptShape::count = 0;
+
+CScriptShape::CScriptShape(CScriptShape *parent, const std::string &name) {
+    this->parent = parent ? parent->ref() : 0;
+    this->name = name;
+    slot = parent ? parent->slot+1 : -1;
+    refs = 0;
+    index = 0;
+    count++;
+}
+
+CScriptShape::~CScriptShape() {
+    /* the shapes made from this one referenced it, so they've gone already -
+       unless this is the root, going at exit, and objects were leaked */
+    ASSERT(transitions.empty() || !parent);
+    delete index;
+    count--;
+}
+
+void CScriptShape::unref() {
+    refs--;
+    ASSERT(refs>=0);
+    // the root is never deleted
+    if (refs || !parent) return;
+    vector<CScriptShape*> &siblings = parent->transitions;
+    siblings.erase(find(siblings.begin(), siblings.end(), this));
+    CScriptShape *p = parent;
+    delete this;
+    p->unref();
+}
+
+CScriptShape *CScriptShape::getRoot() {
+    static CScriptShape root(0, TINYJS_BLANK_DATA);
+    return &root;
+}
+
+static bool shapeIndexLess(const pair<string, int> &a, const pair<string, int> &b) {
+    return a.first < b.first;
+}
+
+static bool shapeIndexBefore(const pair<string, int> &a, const string &name) {
+    return a.first < name;
+}
+
+int CScriptShape::getSlot(const std::string &name) {
+    if (slot+1 < TINYJS_SHAPE_INDEX_MIN) {
+      // few enough to just look through
+      for (CScriptShape *s = this; s->slot>=0; s = s->parent)
+        if (s->name == name) return s->slot;
+      return -1;
+    }
+    if (!index) {
+      index = new vector<pair<string, int> >();
+      index->reserve(slot+1);
+      for (CScriptShape *s = this; s->slot>=0; s = s->parent)
+        index->push_back(pair<string, int>(s->name, s->slot));
+      sort(index->begin(), index->end(), shapeIndexLess);
+    }
+    vector<pair<string, int> >::iterator it =
+        lower_bound(index->begin(), index->end(), name, shapeIndexBefore);
+    return (it!=index->end() && it->first==name) ? it->second : -1;
+}
+
+CScriptShape *CScriptShape::addProperty(const std::string &name) {
+    for (size_t i=0;i<transitions.size();i++)
+      if (transitions[i]->name == name) return transitions[i];
+    if (slot+1 >= TINYJS_SHAPE_MAX_SLOTS || count >= TINYJS_SHAPE_MAX_SHAPES || getSlot(name)>=0)
+      return 0;
+    CScriptShape *shape = new CScriptShape(this, name);
+    transitions.push_back(shape);
+    return shape;
+}
+
+// ----------------------------------------------------------------------------------- CSCRIPTHASH
+
+/// FNV-1a - for string keys, and interned strings
+static unsigned int getStringHash(const string &str) {
+    unsigned int h = 2166136261u;
+    for (size_t i=0;i<str.size();i++) h = (h ^ (unsigned char)str[i]) * 16777619u;
+    return h;
+}
+
+CScriptHash::CScriptHash(bool keysOnly) {
+    this->keysOnly = keysOnly;
+    count = 0;
+    iterating = 0;
+    used = 0;
+}
+
+CScriptHash::~CScriptHash() {
+    iterating = 0;
+    clear();
+}
+
+unsigned int CScriptHash::getHash(CScriptVar *key) {
+    if (key->isNull()) return 1;
+    if (key->isUndefined()) return 2;
+    if (key->isNumeric()) {
+        // whole doubles hash as the int they equal, so 1.0 finds 1
+        double d = key->getDouble();
+        if (d!=d) return 3; // NaN
+        unsigned int h;
+        if (d>=-2147483648.0 && d<=2147483647.0 && (double)(int)d==d) h = (unsigned int)(int)d;
+        else {
+            unsigned int words[sizeof(double)/sizeof(unsigned int)];
+            memcpy(words, &d, sizeof(d));
+            h = 0;
+            for (size_t w=0;w<sizeof(words)/sizeof(words[0]);w++) h = h*31 + words[w];
+        }
+        return h*2654435761u;
+    }
+    if (key->isString()) {
+#ifdef TINYJS_INTERN_STRINGS
+        if (key->interned) return key->interned->hash;
+#endif
+        return getStringHash(key->getString());
+    }
+    return (unsigned int)(size_t)key * 2654435761u;
+}
+
+bool CScriptHash::sameKey(CScriptVar *a, CScriptVar *b) {
+    if (a==b) return true;
+    if (a->isNull() || b->isNull()) return a->isNull() && b->isNull();
+    if (a->isUndefined() || b->isUndefined()) return a->isUndefined() && b->isUndefined();
+    if (a->isNumeric() && b->isNumeric()) {
+        if (a->isInt() && b->isInt()) return a->getInt()==b->getInt();
+        double da = a->getDouble(), db = b->getDouble();
+        return da==db || (da!=da && db!=db);
+    }
+    if (a->isString() && b->isString()) {
+#ifdef TINYJS_INTERN_STRINGS
+        if (a->interned && b->interned) return a->interned==b->interned;
+#endif
+        return a->getString()==b->getString();
+    }
+    return false;
+}
+
+int CScriptHash::findBucket(CScriptVar *key, unsigned int hash) {
+    if (buckets.empty()) return -1;
+    size_t mask = buckets.size()-1;
+    for (size_t i = hash & mask;; i = (i+1) & mask) {
+        int b = buckets[i];
+        if (b==0) return -1;
+        if (b>0) {
+            Entry &e = entries[b-1];
+            if (e.hash==hash && sameKey(e.key, key)) return (int)i;
+        }
+    }
+}
+
+CScriptHash::Entry *CScriptHash::find(CScriptVar *key) {
+    int b = findBucket(key, getHash(key));
+    return b<0 ? 0 : &entries[buckets[b]-1];
+}
+
+void CScriptHash::set(CScriptVar *key, CScriptVar *value) {
+    key->ref(); // so a new key that isn't kept is freed
+    unsigned int hash = getHash(key);
+    int b = findBucket(key, hash);
+    if (b>=0) {
+        Entry &e = entries[buckets[b]-1];
+        if (value) value->ref();
+        if (e.value) e.value->unref();
+        e.value = value;
+        key->unref();
+        return;
+    }
+    // keep at least a quarter of the buckets empty, so probes stay short
+    if ((size_t)(used+1)*4 > buckets.size()*3) resize();
+    Entry e;
+    e.key = key;
+    e.value = value ? value->ref() : 0;
+    e.hash = hash;
+    entries.push_back(e);
+    size_t mask = buckets.size()-1;
+    size_t i = hash & mask;
+    while (buckets[i]>0) i = (i+1) & mask;
+    if (buckets[i]==0) used++;
+    buckets[i] = (int)entries.size();
+    count++;
+}
+
+bool CScriptHash::remove(CScriptVar *key) {
+    int b = findBucket(key, getHash(key));
+    if (b<0) return false;
+    Entry &e = entries[buckets[b]-1];
+    CScriptVar *oldKey = e.key, *oldValue = e.value;
+    e.key = 0;
+    e.value = 0;
+    buckets[b] = -1;
+    count--;
+    oldKey->unref();
+    if (oldValue) oldValue->unref();
+    return true;
+}
+
+void CScriptHash::clear() {
+    // unref'ing may free things that use this table, so empty it first
+    std::vector<Entry> old;
+    if (iterating) {
+        old = entries;
+        for (size_t i=0;i<entries.size();i++) entries[i].key = entries[i].value = 0;
+    } else
+        old.swap(entries);
+    buckets.assign(buckets.size(), 0);
+    used = 0;
+    count = 0;
+    for (size_t i=0;i<old.size();i++) {
+        if (old[i].key) old[i].key->unref();
+        if (old[i].value) old[i].value->unref();
+    }
+}
+
+void CScriptHash::resize() {
+    if (!iterating && count<(int)entries.size()) {
+        size_t n = 0;
+        for (size_t i=0;i<entries.size();i++)
+            if (entries[i].key) entries[n++] = entries[i];
+        entries.resize(n);
+    }
+    size_t size = TINYJS_HASH_BUCKETS_MIN;
+    while (size < (size_t)(count+1)*2) size *= 2; // half full at most, once rebuilt
+    buckets.assign(size, 0);
+    used = 0;
+    size_t mask = size-1;
+    for (size_t n=0;n<entries.size();n++) {
+        if (!entries[n].key) continue;
+        size_t i = entries[n].hash & mask;
+        while (buckets[i]) i = (i+1) & mask;
+        buckets[i] = (int)n+1;
+        used++;
+    }
+}
+
+CScriptHash *CScriptHash::copy(bool deep) {
+    CScriptHash *h = new CScriptHash(keysOnly);
+    for (size_t i=0;i<entries.size();i++) {
+        Entry &e = entries[i];
+        if (e.key) h->set(e.key, e.value && deep ? e.value->deepCopy() : e.value);
+    }
+    return h;
+}
+
+size_t CScriptHash::getMemoryUsage() {
+    return sizeof(*this) + entries.capacity()*sizeof(Entry) + buckets.capacity()*sizeof(int);
+}
+
+// ----------------------------------------------------------------------------------- CSCRIPTSTRINGS
+#ifdef TINYJS_INTERN_STRINGS
+
+int CScriptStrings::count = 0;
+int CScriptStrings::refs = 0;
+vector<CScriptStrings::Entry*> CScriptStrings::buckets;
+
+CScriptStrings::Entry *CScriptStrings::intern(const string &str) {
+    if (str.size() > TINYJS_INTERN_MAX_STRING) return 0;
+    unsigned int hash = getStringHash(str);
+    if (!buckets.empty()) {
+      for (Entry *e = buckets[hash & (buckets.size()-1)]; e; e = e->next)
+        if (e->hash==hash && e->str==str) return ref(e);
+    }
+    if (count >= (int)buckets.size()) resize();
+    Entry *e = new Entry();
+    e->str = str;
+    e->hash = hash;
+    e->refs = 0;
+    Entry *&bucket = buckets[hash & (buckets.size()-1)];
+    e->next = bucket;
+    bucket = e;
+    count++;
+    return ref(e);
+}
+
+void CScriptStrings::unref(Entry *e) {
+    refs--;
+    if (--e->refs > 0) return;
+    Entry **p = &buckets[e->hash & (buckets.size()-1)];
+    while (*p!=e) p = &(*p)->next;
+    *p = e->next;
+    delete e;
+    count--;
+    // the table only grows - a script that made this many strings will likely do so again
+}
+
+void CScriptStrings::resize() {
+    size_t size = TINYJS_INTERN_BUCKETS_MIN;
+    while (size < (size_t)(count+1)*2) size *= 2;
+    vector<Entry*> old;
+    old.swap(buckets);
+    buckets.resize(size, 0);
+    for (size_t i=0;i<old.size();i++) {
+      Entry *e = old[i];
+      while (e) {
+        Entry *next = e->next;
+        Entry *&bucket = buckets[e->hash & (size-1)];
+        e->next = bucket;
+        bucket = e;
+        e = next;
+      }
+    }
+}
+
+size_t CScriptStrings::getMemoryUsage() {
+    size_t size = buckets.capacity()*sizeof(Entry*);
+    for (size_t i=0;i<buckets.size();i++)
+      for (Entry *e = buckets[i]; e; e = e->next)
+        size += sizeof(Entry) + e->str.capacity();
+    return size;
+}
+
+size_t CScriptStrings::getDuplicateBytes() {
+    size_t size = 0;
+    for (size_t i=0;i<buckets.size();i++)
+      for (Entry *e = buckets[i]; e; e = e->next)
+        size += (e->refs-1) * e->str.size();
+    return size;
 }
 
+#endif
 // ----------------------------------------------------------------------------------- CSCRIPTVAR
 
+unsigned long CScriptVar::linksRemoved = 0;
+
 CScriptVar::CScriptVar() {
     refs = 0;
 #if DEBUG_MEMORY
@@ -722,7 +1358,7 @@ CScriptVar::CScriptVar(const string &str) {
 #endif
     init();
     flags = SCRIPTVAR_STRING;
-    data = str;
+    setStringData(str);
 }
 
 
@@ -737,6 +1373,8 @@ CScriptVar::CScriptVar(const string &varData, int varFlags) {
       intData = strtol(varData.c_str(),0,0);
     } else if (varFlags & SCRIPTVAR_DOUBLE) {
       doubleData = strtod(varData.c_str(),0);
+    } else if (varFlags & SCRIPTVAR_STRING) {
+      setStringData(varData);
     } else
       data = varData;
 }
@@ -762,19 +1400,32 @@ CScriptVar::CScriptVar(int val) {
 CScriptVar::~CScriptVar(void) {
 #if DEBUG_MEMORY
     mark_deallocated(this);
+#endif
+#ifdef TINYJS_TRACE_ALLOC
+    jsAllocTrace.died(this);
 #endif
     removeAllChildren();
+    dropStringData();
 }
 
 void CScriptVar::init() {
+#ifdef TINYJS_TRACE_ALLOC
+    birth = jsAllocTrace.now();
+#endif
     firstChild = 0;
     lastChild = 0;
+    shape = 0;
+    slots = 0;
+    hash = 0;
     flags = 0;
     jsCallback = 0;
     jsCallbackUserData = 0;
     data = TINYJS_BLANK_DATA;
     intData = 0;
     doubleData = 0;
+#ifdef TINYJS_INTERN_STRINGS
+    interned = 0;
+#endif
 }
 
 CScriptVar *CScriptVar::getReturnVar() {
@@ -791,6 +1442,10 @@ CScriptVar *CScriptVar::getParameter(const std::string &name) {
 }
 
 CScriptVarLink *CScriptVar::findChild(const string &childName) {
+    if (slots) {
+        int slot = shape->getSlot(childName);
+        return slot>=0 ? slots[slot] : 0;
+    }
     CScriptVarLink *v = firstChild;
     while (v) {
         if (v->name.compare(childName)==0)
@@ -824,7 +1479,31 @@ CScriptVarLink *CScriptVar::addChild(const std::string &childName, CScriptVar *c
     if (!child)
       child = new CScriptVar();
 
-    CScriptVarLink *link = new CScriptVarLink(child, childName);
+    CScriptVarLink *link = 0;
+    // objects start with the empty shape, and keep one while they're built the usual way
+    if (slots || (!firstChild && isObject())) {
+        CScriptShape *next = (slots ? shape : CScriptShape::getRoot())->addProperty(childName);
+        if (next) {
+            int slot = next->slot;
+            if (slot==0 || (slot>=TINYJS_SHAPE_SLOTS_MIN && (slot & (slot-1))==0)) {
+                // slots is full (its size is a power of two, and at least the minimum)
+                CScriptVarLink **grown = new CScriptVarLink*[slot ? slot*2 : TINYJS_SHAPE_SLOTS_MIN];
+                for (int i=0;i<slot;i++) grown[i] = slots[i];
+                delete[] slots;
+                slots = grown;
+            }
+            // the shape has the name, so the link needn't keep a copy
+            link = new CScriptVarLink(child, &next->name);
+            slots[slot] = link;
+            // the new shape references the old one, which names the other links
+            next->ref();
+            if (shape) shape->unref();
+            shape = next;
+        } else
+            dropShape();
+    }
+    if (!link)
+        link = CScriptVarLink::create(child, childName);
     link->owned = true;
     if (lastChild) {
         lastChild->nextSibling = link;
@@ -834,6 +1513,11 @@ CScriptVarLink *CScriptVar::addChild(const std::string &childName, CScriptVar *c
         firstChild = link;
         lastChild = link;
     }
+    // keep the cached length of arrays up to date
+    if (isArray() && intData>=0 && isNumber(childName)) {
+        long idx = atol(childName.c_str());
+        if (idx>=intData) intData = idx+1;
+    }
     return link;
 }
 
@@ -865,6 +1549,17 @@ void CScriptVar::removeChild(CScriptVar *child) {
 
 void CScriptVar::removeLink(CScriptVarLink *link) {
     if (!link) return;
+    dropShape();
+    if (isArray() && intData>0 && isNumber(link->name) && atol(link->name.c_str())+1==intData) {
+        /* the highest index has gone. If the link before it holds the index
+           below (as it will after a pop()) we know the new length, otherwise
+           it has to be worked out again */
+        CScriptVarLink *prev = link->prevSibling;
+        if (prev && isNumber(prev->name) && atol(prev->name.c_str())+2==intData)
+            intData--;
+        else
+            intData = -1;
+    }
     if (link->nextSibling)
       link->nextSibling->prevSibling = link->prevSibling;
     if (link->prevSibling)
@@ -874,10 +1569,12 @@ void CScriptVar::removeLink(CScriptVarLink *link) {
     if (firstChild == link)
         firstChild = link->nextSibling;
     delete link;
+    linksRemoved++;
 }
 
 void CScriptVar::removeAllChildren() {
     CScriptVarLink *c = firstChild;
+    if (c) linksRemoved++;
     while (c) {
         CScriptVarLink *t = c->nextSibling;
         delete c;
@@ -885,6 +1582,23 @@ void CScriptVar::removeAllChildren() {
     }
     firstChild = 0;
     lastChild = 0;
+    dropShape();
+    // nothing is named by the shape now
+    if (shape) {
+      shape->unref();
+      shape = 0;
+    }
+    if (isArray()) intData = 0;
+    if (hash) {
+      CScriptHash *h = hash;
+      hash = 0;
+      delete h;
+    }
+}
+
+void CScriptVar::dropShape() {
+    delete[] slots;
+    slots = 0;
 }
 
 CScriptVar *CScriptVar::getArrayIndex(int idx) {
@@ -898,6 +1612,12 @@ CScriptVar *CScriptVar::getArrayIndex(int idx) {
 void CScriptVar::setArrayIndex(int idx, CScriptVar *value) {
     char sIdx[64];
     sprintf_s(sIdx, sizeof(sIdx), "%d", idx);
+    if (isArray() && idx>=getArrayLength()) {
+        // past the end, so there's nothing to look for (this makes appending O(1))
+        if (!value->isUndefined())
+            addChild(sIdx, value);
+        return;
+    }
     CScriptVarLink *link = findChild(sIdx);
 
     if (link) {
@@ -914,6 +1634,8 @@ void CScriptVar::setArrayIndex(int idx, CScriptVar *value) {
 int CScriptVar::getArrayLength() {
     int highest = -1;
     if (!isArray()) return 0;
+    // for arrays, intData caches the length (or is -1 if it needs working out)
+    if (intData>=0) return intData;
 
     CScriptVarLink *link = firstChild;
     while (link) {
@@ -923,7 +1645,8 @@ int CScriptVar::getArrayLength() {
       }
       link = link->nextSibling;
     }
-    return highest+1;
+    intData = highest+1;
+    return intData;
 }
 
 int CScriptVar::getChildren() {
@@ -973,35 +1696,43 @@ const string &CScriptVar::getString() {
     if (isNull()) return s_null;
     if (isUndefined()) return s_undefined;
     // are we just a string here?
+#ifdef TINYJS_INTERN_STRINGS
+    if (isString() && interned) return interned->str;
+#endif
     return data;
 }
 
 void CScriptVar::setInt(int val) {
+    dropStringData();
     flags = (flags&~SCRIPTVAR_VARTYPEMASK) | SCRIPTVAR_INTEGER;
     intData = val;
     doubleData = 0;
-    data = TINYJS_BLANK_DATA;
 }
 
 void CScriptVar::setDouble(double val) {
+    dropStringData();
     flags = (flags&~SCRIPTVAR_VARTYPEMASK) | SCRIPTVAR_DOUBLE;
     doubleData = val;
     intData = 0;
-    data = TINYJS_BLANK_DATA;
 }
 
 void CScriptVar::setString(const string &str) {
     // name sure it's not still a number or integer
-    flags = (flags&~SCRIPTVAR_VARTYPEMASK) | SCRIPTVAR_STRING;
-    data = str;
-    intData = 0;
-    doubleData = 0;
+    if (!isString()) {
+      flags = (flags&~SCRIPTVAR_VARTYPEMASK) | SCRIPTVAR_STRING;
+      intData = 0;
+      doubleData = 0;
+#ifdef TINYJS_INTERN_STRINGS
+      interned = 0;
+#endif
+    }
+    setStringData(str);
 }
 
 void CScriptVar::setUndefined() {
     // name sure it's not still a number or integer
+    dropStringData();
     flags = (flags&~SCRIPTVAR_VARTYPEMASK) | SCRIPTVAR_UNDEFINED;
-    data = TINYJS_BLANK_DATA;
     intData = 0;
     doubleData = 0;
     removeAllChildren();
@@ -1009,13 +1740,72 @@ void CScriptVar::setUndefined() {
 
 void CScriptVar::setArray() {
     // name sure it's not still a number or integer
+    dropStringData();
     flags = (flags&~SCRIPTVAR_VARTYPEMASK) | SCRIPTVAR_ARRAY;
-    data = TINYJS_BLANK_DATA;
     intData = 0;
     doubleData = 0;
     removeAllChildren();
 }
 
+string &CScriptVar::getBytes() {
+    ASSERT(isString() || isBuffer());
+    // a buffer is shared by reference, but a string may only change where nothing else sees it
+    ASSERT(isBuffer() || (!isConstant() && refs<=1));
+#ifdef TINYJS_INTERN_STRINGS
+    // it's about to be changed, so it needs its own copy
+    if (isString() && interned) {
+      data = interned->str;
+      CScriptStrings::unref(interned);
+      interned = 0;
+    }
+#endif
+    return data;
+}
+
+void CScriptVar::setStringData(const string &str) {
+    ASSERT(isString());
+#ifdef TINYJS_INTERN_STRINGS
+    // 'str' may be what's interned now, so that goes last
+    CScriptStrings::Entry *e = CScriptStrings::intern(str);
+    data = e ? TINYJS_BLANK_DATA : str;
+    if (interned) CScriptStrings::unref(interned);
+    interned = e;
+#else
+    data = str;
+#endif
+}
+
+void CScriptVar::dropStringData() {
+#ifdef TINYJS_INTERN_STRINGS
+    if (isString() && interned) {
+      CScriptStrings::unref(interned);
+      interned = 0;
+    }
+#endif
+    data = TINYJS_BLANK_DATA;
+}
+
+bool CScriptVar::mathsOpInPlace(CScriptVar *b, int op) {
+    // anything else might be looking at this value
+    if (refs>1 || firstChild || (op!='+' && op!='-')) return false;
+    if (isInt() && b->isInt()) {
+        int da = getInt(), db = b->getInt();
+        intData = op=='+' ? da+db : da-db;
+        return true;
+    }
+    if (isNumeric() && b->isNumeric()) {
+        double da = getDouble(), db = b->getDouble();
+        setDouble(op=='+' ? da+db : da-db);
+        return true;
+    }
+    if (isString() && op=='+' && (b->isString() || b->isNumeric())) {
+        string &bytes = getBytes();
+        bytes.append(b->getString());
+        return true;
+    }
+    return false;
+}
+
 bool CScriptVar::equals(CScriptVar *v) {
     CScriptVar *resV = mathsOp(v, LEX_EQUAL);
     bool res = resV->getBool();
@@ -1024,6 +1814,14 @@ bool CScriptVar::equals(CScriptVar *v) {
 }
 
 CScriptVar *CScriptVar::mathsOp(CScriptVar *b, int op) {
+    const char *typeName;
+    CScriptVar *res = tryMathsOp(b, op, &typeName);
+    if (!res)
+        throw new CScriptException("Operation "+CScriptLex::getTokenStr(op)+" not supported on the "+typeName+" datatype");
+    return res;
+}
+
+CScriptVar *CScriptVar::tryMathsOp(CScriptVar *b, int op, const char **typeName) {
     CScriptVar *a = this;
     // Type equality check
     if (op == LEX_TYPEEQUAL || op == LEX_NTYPEEQUAL) {
@@ -1067,7 +1865,7 @@ CScriptVar *CScriptVar::mathsOp(CScriptVar *b, int op) {
                 case LEX_LEQUAL:    return new CScriptVar(da<=db);
                 case '>':     return new CScriptVar(da>db);
                 case LEX_GEQUAL:    return new CScriptVar(da>=db);
-                default: throw new CScriptException("Operation "+CScriptLex::getTokenStr(op)+" not supported on the Int datatype");
+                default: *typeName = "Int"; return 0;
             }
         } else {
             // use doubles
@@ -1084,26 +1882,38 @@ CScriptVar *CScriptVar::mathsOp(CScriptVar *b, int op) {
                 case LEX_LEQUAL:    return new CScriptVar(da<=db);
                 case '>':     return new CScriptVar(da>db);
                 case LEX_GEQUAL:    return new CScriptVar(da>=db);
-                default: throw new CScriptException("Operation "+CScriptLex::getTokenStr(op)+" not supported on the Double datatype");
+                default: *typeName = "Double"; return 0;
             }
         }
+    } else if (a->isBuffer()) {
+      /* Just check pointers */
+      switch (op) {
+           case LEX_EQUAL: return new CScriptVar(a==b);
+           case LEX_NEQUAL: return new CScriptVar(a!=b);
+           default: *typeName = "Buffer"; return 0;
+      }
     } else if (a->isArray()) {
       /* Just check pointers */
       switch (op) {
            case LEX_EQUAL: return new CScriptVar(a==b);
            case LEX_NEQUAL: return new CScriptVar(a!=b);
-           default: throw new CScriptException("Operation "+CScriptLex::getTokenStr(op)+" not supported on the Array datatype");
+           default: *typeName = "Array"; return 0;
       }
     } else if (a->isObject()) {
           /* Just check pointers */
           switch (op) {
                case LEX_EQUAL: return new CScriptVar(a==b);
                case LEX_NEQUAL: return new CScriptVar(a!=b);
-               default: throw new CScriptException("Operation "+CScriptLex::getTokenStr(op)+" not supported on the Object datatype");
+               default: *typeName = "Object"; return 0;
           }
     } else {
-       string da = a->getString();
-       string db = b->getString();
+#ifdef TINYJS_INTERN_STRINGS
+       // the same contents are always the same entry
+       if (a->isString() && b->isString() && a->interned && b->interned && (op==LEX_EQUAL || op==LEX_NEQUAL))
+         return new CScriptVar((a->interned==b->interned) == (op==LEX_EQUAL));
+#endif
+       const string &da = a->getString();
+       const string &db = b->getString();
        // use strings
        switch (op) {
            case '+':           return new CScriptVar(da+db, SCRIPTVAR_STRING);
@@ -1113,7 +1923,7 @@ CScriptVar *CScriptVar::mathsOp(CScriptVar *b, int op) {
            case LEX_LEQUAL:    return new CScriptVar(da<=db);
            case '>':     return new CScriptVar(da>db);
            case LEX_GEQUAL:    return new CScriptVar(da>=db);
-           default: throw new CScriptException("Operation "+CScriptLex::getTokenStr(op)+" not supported on the string datatype");
+           default: *typeName = "string"; return 0;
        }
     }
     ASSERT(0);
@@ -1121,10 +1931,16 @@ CScriptVar *CScriptVar::mathsOp(CScriptVar *b, int op) {
 }
 
 void CScriptVar::copySimpleData(CScriptVar *val) {
+#ifdef TINYJS_INTERN_STRINGS
+    // copying doubleData copies 'interned' too - it just needs the references changing
+    if (val->isString() && val->interned) CScriptStrings::ref(val->interned);
+    if (isString() && interned) CScriptStrings::unref(interned);
+#endif
     data = val->data;
     intData = val->intData;
     doubleData = val->doubleData;
     flags = (flags & ~SCRIPTVAR_VARTYPEMASK) | (val->flags & SCRIPTVAR_VARTYPEMASK);
+    if (isFunction() && !isNative()) scope = val->getScope();
 }
 
 void CScriptVar::copyValue(CScriptVar *val) {
@@ -1146,6 +1962,7 @@ void CScriptVar::copyValue(CScriptVar *val) {
 
         child = child->nextSibling;
       }
+      if (val->hash) hash = val->hash->copy(true);
     } else {
       setUndefined();
     }
@@ -1167,6 +1984,7 @@ CScriptVar *CScriptVar::deepCopy() {
         newVar->addChild(child->name, copied);
         child = child->nextSibling;
     }
+    if (hash) newVar->hash = hash->copy(true);
     return newVar;
 }
 
@@ -1182,6 +2000,12 @@ void CScriptVar::trace(string indentStr, const string &name) {
       link->var->trace(indent, link->name);
       link = link->nextSibling;
     }
+    if (hash) {
+      for (size_t i=0;i<hash->entries.size();i++) {
+        CScriptHash::Entry &e = hash->entries[i];
+        if (e.key) (e.value ? e.value : e.key)->trace(indent, "["+e.key->getString()+"]");
+      }
+    }
 }
 
 string CScriptVar::getFlagsAsString() {
@@ -1189,6 +2013,8 @@ string CScriptVar::getFlagsAsString() {
   if (flags&SCRIPTVAR_FUNCTION) flagstr = flagstr + "FUNCTION ";
   if (flags&SCRIPTVAR_OBJECT) flagstr = flagstr + "OBJECT ";
   if (flags&SCRIPTVAR_ARRAY) flagstr = flagstr + "ARRAY ";
+  if (flags&SCRIPTVAR_BUFFER) flagstr = flagstr + "BUFFER ";
+  if (hash) flagstr = flagstr + (hash->keysOnly ? "SET " : "MAP ");
   if (flags&SCRIPTVAR_NATIVE) flagstr = flagstr + "NATIVE ";
   if (flags&SCRIPTVAR_DOUBLE) flagstr = flagstr + "DOUBLE ";
   if (flags&SCRIPTVAR_INTEGER) flagstr = flagstr + "INTEGER ";
@@ -1214,8 +2040,8 @@ string CScriptVar::getParsableString() {
     funcStr << ") " << getString();
     return funcStr.str();
   }
-  // if it is a string then we quote it
-  if (isString())
+  // if it is a string (or the bytes of a buffer) then we quote it
+  if (isString() || isBuffer())
     return getJSString(getString());
   if (isNull())
       return "null";
@@ -1223,7 +2049,29 @@ string CScriptVar::getParsableString() {
 }
 
 void CScriptVar::getJSON(ostringstream &destination, const string linePrefix) {
-   if (isObject()) {
+   if (hash) {
+      // a Map is written as an array of [key, value], as its keys needn't be strings, and a Set as an array
+      string indentedLinePrefix = linePrefix+"  ";
+      destination << "[\n";
+      bool first = true;
+      for (size_t i=0;i<hash->entries.size();i++) {
+        CScriptHash::Entry &e = hash->entries[i];
+        if (!e.key) continue;
+        if (!first) destination << ",\n";
+        first = false;
+        destination << indentedLinePrefix;
+        if (hash->keysOnly) {
+          e.key->getJSON(destination, indentedLinePrefix);
+        } else {
+          destination << "[";
+          e.key->getJSON(destination, indentedLinePrefix);
+          destination << ", ";
+          e.value->getJSON(destination, indentedLinePrefix);
+          destination << "]";
+        }
+      }
+      destination << "\n" << linePrefix << "]";
+    } else if (isObject()) {
       string indentedLinePrefix = linePrefix+"  ";
       // children - handle with bracketed list
       destination << "{ \n";
@@ -1280,97 +2128,293 @@ int CScriptVar::getRefs() {
 }
 
 
+// ----------------------------------------------------------------------------------- CSCRIPTSWITCH
+
+static unsigned int getIntHash(int n) {
+    return (unsigned int)n * 2654435761u;
+}
+
+static bool sameCase(const CScriptSwitch::Case &a, const CScriptSwitch::Case &b) {
+    return a.isString==b.isString && a.hash==b.hash && a.value==b.value && a.label==b.label;
+}
+
+void CScriptSwitch::add(const string &label, int value, bool isString, int pos) {
+    Case c;
+    c.label = label;
+    c.value = value;
+    c.isString = isString;
+    c.hash = isString ? getStringHash(label) : getIntHash(value);
+    c.pos = pos;
+    cases.push_back(c);
+}
+
+void CScriptSwitch::build() {
+    // integer labels close enough together index a jump table
+    int ints = 0, lo = 0, hi = 0;
+    for (size_t i=0;i<cases.size();i++) {
+        if (cases[i].isString) continue;
+        int v = cases[i].value;
+        if (!ints || v<lo) lo = v;
+        if (!ints || v>hi) hi = v;
+        ints++;
+    }
+    if (ints && (double)hi-lo < (double)ints*TINYJS_SWITCH_DENSITY) {
+        jumpMin = lo;
+        jumps.assign(hi-lo+1, -1);
+        vector<Case> rest;
+        for (size_t i=0;i<cases.size();i++) {
+            if (cases[i].isString)
+                rest.push_back(cases[i]);
+            else if (jumps[cases[i].value-lo]<0) // of two the same, the first is the one reached
+                jumps[cases[i].value-lo] = cases[i].pos;
+        }
+        cases.swap(rest);
+    }
+    // the rest are hashed, with buckets at most half full
+    if (cases.empty()) return;
+    size_t size = 4;
+    while (size < cases.size()*2) size *= 2;
+    buckets.assign(size, -1);
+    for (size_t i=0;i<cases.size();i++) {
+        size_t b = cases[i].hash & (size-1);
+        while (buckets[b]>=0 && !sameCase(cases[buckets[b]], cases[i]))
+            b = (b+1) & (size-1);
+        if (buckets[b]<0) buckets[b] = i;
+    }
+}
+
+int CScriptSwitch::find(CScriptVar *value) {
+    bool isString = value->isString();
+    int n = 0;
+    if (!isString) {
+        // only numbers equal to an integer can match - the labels are integers or strings
+        if (value->isInt())
+            n = value->getInt();
+        else if (value->isDouble()) {
+            double d = value->getDouble();
+            if (!(d>=-2147483648.0 && d<=2147483647.0 && d==(int)d)) return defaultPos;
+            n = (int)d;
+        } else
+            return defaultPos;
+        if (!jumps.empty()) { // then all the integers are in it
+            long long i = (long long)n - jumpMin;
+            if (i<0 || i>=(long long)jumps.size() || jumps[i]<0) return defaultPos;
+            return jumps[i];
+        }
+    }
+    if (buckets.empty()) return defaultPos;
+    unsigned int hash = isString ? getStringHash(value->getString()) : getIntHash(n);
+    size_t mask = buckets.size()-1;
+    for (size_t b = hash & mask; buckets[b]>=0; b = (b+1) & mask) {
+        Case &c = cases[buckets[b]];
+        if (c.hash==hash && c.isString==isString &&
+            (isString ? c.label==value->getString() : c.value==n))
+            return c.pos;
+    }
+    return defaultPos;
+}
+
 // ----------------------------------------------------------------------------------- CSCRIPT
 
+CScriptMemory *CScriptMemory::current = 0;
+size_t CScriptMemory::defaultQuota = TINYJS_MEMORY_QUOTA;
+size_t CScriptMemory::lastPeak = 0;
+
 CTinyJS::CTinyJS() {
+    CScriptMemoryScope accounting(&memory);
     l = 0;
+    profiler = 0;
+    resultUnused = false;
+    jumping = 0;
+    breakable = 0;
+    continuable = 0;
+    moduleScope = 0;
     root = (new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT))->ref();
     // Add built-in classes
     stringClass = (new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT))->ref();
     arrayClass = (new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT))->ref();
+    bufferClass = (new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT))->ref();
     objectClass = (new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT))->ref();
     root->addChild("String", stringClass);
     root->addChild("Array", arrayClass);
+    root->addChild("Buffer", bufferClass);
     root->addChild("Object", objectClass);
 }
 
 CTinyJS::~CTinyJS() {
     ASSERT(!l);
+    // a script that never called Profiler.stop() leaves the timer running
+    if (profiler) profiler->stop();
+    CScriptMemory *outside = CScriptMemory::current;
+    CScriptMemory::current = &memory;
     scopes.clear();
     stringClass->unref();
     arrayClass->unref();
+    bufferClass->unref();
     objectClass->unref();
+    // a module's scope holds its functions, which point back at it
+    for (size_t i=0;i<moduleScopes.size();i++) {
+      moduleScopes[i]->removeAllChildren();
+      moduleScopes[i]->unref();
+    }
     root->unref();
+    collect();
 
 #if DEBUG_MEMORY
     show_allocated();
 #endif
+    CScriptMemory::lastPeak = memory.peak;
+    // nothing may be accounted to an interpreter that's gone
+    CScriptMemory::current = outside==&memory ? 0 : outside;
+}
+
+void CTinyJS::collect() {
+    std::map<std::string, CScriptVar*>::iterator it;
+    for (it=numberConstants.begin();it!=numberConstants.end();it++)
+      it->second->unref();
+    for (it=stringConstants.begin();it!=stringConstants.end();it++)
+      it->second->unref();
+    std::map<CScriptFoldKey, CScriptVar*>::iterator fold;
+    for (fold=folds.begin();fold!=folds.end();fold++) {
+      fold->first.a->unref();
+      fold->first.b->unref();
+      fold->second->unref();
+    }
+    std::map<CScriptSwitchKey, CScriptSwitch*>::iterator sw;
+    for (sw=switches.begin();sw!=switches.end();sw++)
+      delete sw->second;
+    numberConstants.clear();
+    stringConstants.clear();
+    folds.clear();
+    switches.clear();
 }
 
 void CTinyJS::trace() {
     root->trace();
 }
 
-void CTinyJS::execute(const string &code) {
+#ifdef TINYJS_CALL_STACK
+string CTinyJS::getCallFrameText(CScriptCallFrame &frame) {
+    if (frame.text.empty())
+        frame.text = frame.function->name + " from " + (frame.lex ? frame.lex->getPosition(frame.pos) : "native code");
+    return frame.text;
+}
+#endif
+
+/// Format the pending error with the calls it went through, then forget about it
+string CTinyJS::getErrorReport(size_t callDepth) {
+    ostringstream msg;
+    msg << "Error " << error.text;
+#ifdef TINYJS_CALL_STACK
+    for (int i=(int)call_stack.size()-1;i>=(int)callDepth;i--)
+      msg << "\n" << i << ": " << getCallFrameText(call_stack[i]);
+#endif
+    msg << " at " << l->getPosition();
+    return msg.str();
+}
+
+bool CTinyJS::executeCode(CScriptLex *lex, CScriptVar *scope, string *report) {
+    CScriptMemoryScope accounting(&memory);
     CScriptLex *oldLex = l;
     vector<CScriptVar*> oldScopes = scopes;
-    l = new CScriptLex(code);
+    l = lex;
+    l->errors = &error;
 #ifdef TINYJS_CALL_STACK
-    call_stack.clear();
+    size_t callDepth = call_stack.size();
+#else
+    size_t callDepth = 0;
 #endif
     scopes.clear();
     scopes.push_back(root);
-    try {
-        bool execute = true;
-        while (l->tk) statement(execute);
-    } catch (CScriptException *e) {
-        ostringstream msg;
-        msg << "Error " << e->text;
+    if (scope) scopes.push_back(scope);
+    // 'break' can't leave the code for a loop it was run from
+    int oldBreakable = breakable, oldContinuable = continuable;
+    breakable = continuable = 0;
+    CScriptVar *oldModuleScope = moduleScope;
+    moduleScope = scope;
+    char stackHere;
+    char *oldStackBase = memory.stackBase;
+    if (!oldStackBase) memory.stackBase = &stackHere;
+    bool execute = true;
+    while (l->tk && !error.pending) {
+        statement(execute);
+        // anything this statement defined has been copied out of the lexer by now
+        l->release(l->tokenLastEnd);
+    }
+    bool ok = !error.pending;
+    if (!ok) {
+        if (report) *report = getErrorReport(callDepth);
+        error.pending = false;
 #ifdef TINYJS_CALL_STACK
-        for (int i=(int)call_stack.size()-1;i>=0;i--)
-          msg << "\n" << i << ": " << call_stack.at(i);
+        call_stack.resize(callDepth);
 #endif
-        msg << " at " << l->getPosition();
-        delete l;
-        l = oldLex;
-
-        throw new CScriptException(msg.str());
     }
     delete l;
     l = oldLex;
     scopes = oldScopes;
+    breakable = oldBreakable;
+    continuable = oldContinuable;
+    moduleScope = oldModuleScope;
+    memory.stackBase = oldStackBase;
+    return ok;
+}
+
+void CTinyJS::execute(const string &code, CScriptVar *scope) {
+    string report;
+    if (!executeCode(new CScriptLex(code), scope, &report))
+        throw new CScriptException(report);
+}
+
+bool CTinyJS::run(const string &code, CScriptVar *scope) {
+    return executeCode(new CScriptLex(code), scope, 0);
+}
+
+void CTinyJS::execute(CScriptReader *reader, CScriptVar *scope) {
+    string report;
+    if (!executeCode(new CScriptLex(reader), scope, &report))
+        throw new CScriptException(report);
+}
+
+bool CTinyJS::run(CScriptReader *reader, CScriptVar *scope) {
+    return executeCode(new CScriptLex(reader), scope, 0);
 }
 
 CScriptVarLink CTinyJS::evaluateComplex(const string &code) {
+    CScriptMemoryScope accounting(&memory);
     CScriptLex *oldLex = l;
     vector<CScriptVar*> oldScopes = scopes;
 
     l = new CScriptLex(code);
+    l->errors = &error;
 #ifdef TINYJS_CALL_STACK
-    call_stack.clear();
+    size_t callDepth = call_stack.size();
+#else
+    size_t callDepth = 0;
 #endif
     scopes.clear();
     scopes.push_back(root);
+    char stackHere;
+    char *oldStackBase = memory.stackBase;
+    if (!oldStackBase) memory.stackBase = &stackHere;
     CScriptVarLink *v = 0;
-    try {
-        bool execute = true;
-        do {
-          CLEAN(v);
-          v = base(execute);
-          if (l->tk!=LEX_EOF) l->match(';');
-        } while (l->tk!=LEX_EOF);
-    } catch (CScriptException *e) {
-      ostringstream msg;
-      msg << "Error " << e->text;
+    bool execute = true;
+    do {
+      CLEAN(v);
+      v = base(execute);
+      if (l->tk!=LEX_EOF) l->match(';');
+    } while (l->tk!=LEX_EOF && !error.pending);
+    memory.stackBase = oldStackBase;
+    if (error.pending) {
+      string report = getErrorReport(callDepth);
+      error.pending = false;
 #ifdef TINYJS_CALL_STACK
-      for (int i=(int)call_stack.size()-1;i>=0;i--)
-        msg << "\n" << i << ": " << call_stack.at(i);
+      call_stack.resize(callDepth);
 #endif
-      msg << " at " << l->getPosition();
+      CLEAN(v);
       delete l;
       l = oldLex;
-
-        throw new CScriptException(msg.str());
+      scopes = oldScopes;
+      throw new CScriptException(report);
     }
     delete l;
     l = oldLex;
@@ -1391,7 +2435,7 @@ string CTinyJS::evaluate(const string &code) {
 
 void CTinyJS::parseFunctionArguments(CScriptVar *funcVar) {
   l->match('(');
-  while (l->tk!=')') {
+  while (l->tk!=')' && l->tk!=LEX_EOF) {
       funcVar->addChildNoDup(l->tkStr);
       l->match(LEX_ID);
       if (l->tk!=')') l->match(',');
@@ -1400,6 +2444,18 @@ void CTinyJS::parseFunctionArguments(CScriptVar *funcVar) {
 }
 
 void CTinyJS::addNative(const string &funcDesc, JSCallback ptr, void *userdata) {
+    defineNative(funcDesc, ptr, userdata);
+}
+
+void CTinyJS::addBound(const string &funcDesc, JSBoundCallback ptr, void *userdata) {
+    // the callback is only ever called as what it really is
+    CScriptVar *funcVar = defineNative(funcDesc, (JSCallback)ptr, userdata);
+    ASSERT(funcVar->getChildren()<=TINYJS_BOUND_MAX_ARGS);
+    funcVar->flags |= SCRIPTVAR_BOUND;
+}
+
+CScriptVar *CTinyJS::defineNative(const string &funcDesc, JSCallback ptr, void *userdata) {
+    CScriptMemoryScope accounting(&memory);
     CScriptLex *oldLex = l;
     l = new CScriptLex(funcDesc);
 
@@ -1425,7 +2481,8 @@ void CTinyJS::addNative(const string &funcDesc, JSCallback ptr, void *userdata)
     delete l;
     l = oldLex;
 
-    base->addChild(funcName, funcVar);
+    base->addChildNoDup(funcName, funcVar); // registering a function again replaces it
+    return funcVar;
 }
 
 CScriptVarLink *CTinyJS::parseFunctionDefinition() {
@@ -1437,12 +2494,17 @@ CScriptVarLink *CTinyJS::parseFunctionDefinition() {
     funcName = l->tkStr;
     l->match(LEX_ID);
   }
-  CScriptVarLink *funcVar = new CScriptVarLink(new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_FUNCTION), funcName);
+  CScriptVarLink *funcVar = CScriptVarLink::create(new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_FUNCTION), funcName);
   parseFunctionArguments(funcVar->var);
   int funcBegin = l->tokenStart;
   bool noexecute = false;
   block(noexecute);
   funcVar->var->data = l->getSubString(funcBegin);
+  if (moduleScope) {
+    funcVar->var->scope = moduleScope;
+    if (std::find(moduleScopes.begin(), moduleScopes.end(), moduleScope)==moduleScopes.end())
+      moduleScopes.push_back(moduleScope->ref());
+  }
   return funcVar;
 }
 
@@ -1451,12 +2513,13 @@ CScriptVarLink *CTinyJS::parseFunctionDefinition() {
  * if there was one (otherwise it's just a normnal function).
  */
 CScriptVarLink *CTinyJS::functionCall(bool &execute, CScriptVarLink *function, CScriptVar *parent) {
-  if (execute) {
-    if (!function->var->isFunction()) {
-        string errorMsg = "Expecting '";
-        errorMsg = errorMsg + function->name + "' to be a function";
-        throw new CScriptException(errorMsg.c_str());
-    }
+  if (execute && !function->var->isFunction()) {
+    error.set("Expecting '%s' to be a function", function->name.c_str());
+    execute = false;
+  }
+  if (execute && function->var->isBound()) {
+    return boundCall(execute, function, parent);
+  } else if (execute) {
     l->match('(');
     // create a new symbol table entry for execution of this function
     CScriptVar *functionRoot = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_FUNCTION);
@@ -1465,6 +2528,12 @@ CScriptVarLink *CTinyJS::functionCall(bool &execute, CScriptVarLink *function, C
     // grab in all parameters
     CScriptVarLink *v = function->var->firstChild;
     while (v) {
+        if (l->tk==')') {
+            // fewer arguments than parameters - the rest are undefined
+            if (execute) functionRoot->addChild(v->name);
+            v = v->nextSibling;
+            continue;
+        }
         CScriptVarLink *value = base(execute);
         if (execute) {
             if (value->var->isBasic()) {
@@ -1480,44 +2549,243 @@ CScriptVarLink *CTinyJS::functionCall(bool &execute, CScriptVarLink *function, C
         v = v->nextSibling;
     }
     l->match(')');
+    if (!execute || error.pending) {
+      // an argument or the list itself failed - as with boundCall, the function isn't run
+      execute = false;
+      delete functionRoot;
+      return function;
+    }
+    return runFunction(execute, function, functionRoot);
+  } else {
+    // function, but not executing - just parse args and be done
+    l->match('(');
+    while (l->tk != ')' && l->tk != LEX_EOF) {
+      CScriptVarLink *value = base(execute);
+      CLEAN(value);
+      if (l->tk!=')') l->match(',');
+    }
+    l->match(')');
+    if (l->tk == '{') { // TODO: why is this here?
+      block(execute);
+    }
+    /* function will be a blank scriptvarlink if we're not executing,
+     * so just return it rather than an alloc/free */
+    return function;
+  }
+}
+
+/** Call a bound native (see addBound) with arguments parsed straight into
+ * an array, rather than a symbol table. Only the error path needs the
+ * bookkeeping of runFunction. A first parameter called 'this' is given
+ * the object the function was called on, rather than an argument */
+NOINLINE CScriptVarLink *CTinyJS::boundCall(bool &execute, CScriptVarLink *function, CScriptVar *parent) {
+    CScriptVarLink *values[TINYJS_BOUND_MAX_ARGS];
+    CScriptVar *args[TINYJS_BOUND_MAX_ARGS];
+    CScriptVar *undefined = 0; // shared by any arguments left out, and a void result
+    int count = 0;
+    l->match('(');
+    CScriptVarLink *v = function->var->firstChild;
+    if (v && v->name=="this") {
+        if (!parent) {
+            undefined = (new CScriptVar())->ref();
+            parent = undefined;
+        }
+        values[count] = 0;
+        args[count++] = parent;
+        v = v->nextSibling;
+    }
+    for (; v; v = v->nextSibling) {
+        if (l->tk==')') {
+            // fewer arguments than parameters - the rest are undefined
+            if (!undefined) undefined = (new CScriptVar())->ref();
+            values[count] = 0;
+            args[count++] = undefined;
+            continue;
+        }
+        values[count] = base(execute);
+        args[count] = values[count]->var;
+        count++;
+        if (l->tk!=')') l->match(',');
+    }
+    l->match(')');
+    // a bad argument list leaves the error pending, but not 'execute' cleared
+    if (error.pending) execute = false;
+    CScriptVar *result = 0;
+    if (execute) {
+        if (profiler) profiler->enter(function->name);
+#ifdef TINYJS_TRACE_ALLOC
+        jsAllocTrace.enter(function->name, true);
+#endif
+        bool wasNative = memory.inNative;
+        memory.inNative = true;
+        try {
+            result = ((JSBoundCallback)function->var->jsCallback)(args, function->var->jsCallbackUserData);
+        } catch (CScriptException *e) {
+            error.set("%s", e->text.c_str());
+            delete e;
+            execute = false;
+        } catch (std::bad_alloc &) {
+            outOfMemory();
+            execute = false;
+        }
+        memory.inNative = wasNative;
+        if (profiler) profiler->leave();
+#ifdef TINYJS_TRACE_ALLOC
+        jsAllocTrace.leave();
+#endif
+#ifdef TINYJS_CALL_STACK
+        if (error.pending) {
+            // as runFunction would have left it
+            CScriptCallFrame frame;
+            frame.function = function;
+            frame.lex = l;
+            frame.pos = l->tokenLastEnd;
+            call_stack.push_back(frame);
+            getCallFrameText(call_stack.back());
+        }
+#endif
+    }
+    for (int i=0;i<count;i++)
+        CLEAN(values[i]);
+    CScriptVarLink *link = new CScriptVarLink(result ? result : undefined ? undefined : new CScriptVar());
+    if (undefined) undefined->unref();
+    return link;
+}
+
+/// Call a bound native with the parameters in a symbol table, as callFunction does
+NOINLINE void CTinyJS::callBoundByName(CScriptVar *function, CScriptVar *functionRoot) {
+    CScriptVar *args[TINYJS_BOUND_MAX_ARGS];
+    int count = 0;
+    for (CScriptVarLink *v = function->firstChild; v; v = v->nextSibling)
+        args[count++] = functionRoot->getParameter(v->name);
+    CScriptVar *result = ((JSBoundCallback)function->jsCallback)(args, function->jsCallbackUserData);
+    if (result) functionRoot->setReturnVar(result);
+}
+
+/** Call a native with the parameters in a symbol table. Natives are outside
+ * the interpreter core, so they still report errors by throwing - kept out
+ * of runFunction so the try doesn't add to every JS call's stack frame */
+NOINLINE void CTinyJS::callNative(CScriptVar *function, CScriptVar *functionRoot) {
+    ASSERT(function->jsCallback);
+    bool wasNative = memory.inNative;
+    memory.inNative = true;
+    try {
+      if (function->isBound())
+        callBoundByName(function, functionRoot);
+      else
+        function->jsCallback(functionRoot, function->jsCallbackUserData);
+    } catch (CScriptException *e) {
+      error.set("%s", e->text.c_str());
+      delete e;
+    } catch (std::bad_alloc &) {
+      outOfMemory();
+    }
+    memory.inNative = wasNative;
+}
+
+/** Measure the C stack used below the outermost script or call in progress.
+ * Nesting in the script - calls, brackets, blocks - is only bounded by this,
+ * so past the limit the script is stopped with an error, and the rest of it
+ * skipped so the parsers unwind without going deeper */
+NOINLINE bool CTinyJS::outOfStack(bool &execute) {
+    // the stack grows down
+    char stackHere;
+    size_t stackUsed = memory.stackBase ? memory.stackBase - &stackHere : 0;
+    if (stackUsed>memory.stackPeak) memory.stackPeak = stackUsed;
+    if (!memory.stackLimit || stackUsed<=memory.stackLimit) return false;
+    error.set("Out of stack - %lu bytes used, limit is %lu", (unsigned long)stackUsed, (unsigned long)memory.stackLimit);
+    execute = false;
+    if (l) l->skipToEnd();
+    return true;
+}
+
+NOINLINE void CTinyJS::outOfMemory() {
+    if (memory.quota)
+        error.set("Out of memory - %lu bytes used, quota is %lu", (unsigned long)memory.used, (unsigned long)memory.quota);
+    else
+        error.set("Out of memory - %lu bytes used", (unsigned long)memory.used);
+}
+
+/** Run a function whose parameters have already been put in 'functionRoot'
+ * (which is deleted afterwards) and return a link to the result */
+CScriptVarLink *CTinyJS::runFunction(bool &execute, CScriptVarLink *function, CScriptVar *functionRoot) {
     // setup a return variable
     CScriptVarLink *returnVar = NULL;
+    // a call from outside any script measures the stack from here
+    char stackHere;
+    char *oldStackBase = memory.stackBase;
+    if (!oldStackBase) memory.stackBase = &stackHere;
+    memory.calls++;
+    if (memory.calls>memory.callPeak) memory.callPeak = memory.calls;
+    bool overLimit = true;
+    if (memory.callLimit && memory.calls>memory.callLimit)
+        error.set("Too much recursion - %d calls deep", memory.calls);
+    else
+        overLimit = outOfStack(execute);
     // execute function!
     // add the function's execute space to the symbol table so we can recurse
     CScriptVarLink *returnVarLink = functionRoot->addChild(TINYJS_RETURN_VAR);
+    // a function from a module sees the module's scope, below its own
+    CScriptVar *functionScope = function->var->getScope();
+    if (functionScope) scopes.push_back(functionScope);
     scopes.push_back(functionRoot);
 #ifdef TINYJS_CALL_STACK
-    call_stack.push_back(function->name + " from " + l->getPosition());
+    size_t frame = call_stack.size();
+    call_stack.resize(frame+1);
+    call_stack[frame].function = function;
+    call_stack[frame].lex = l;
+    call_stack[frame].pos = l ? l->tokenLastEnd : 0;
+#endif
+    if (profiler) profiler->enter(function->name);
+#ifdef TINYJS_TRACE_ALLOC
+    jsAllocTrace.enter(function->name, function->var->isNative());
 #endif
 
-    if (function->var->isNative()) {
-        ASSERT(function->var->jsCallback);
-        function->var->jsCallback(functionRoot, function->var->jsCallbackUserData);
+    if (overLimit) {
+        // don't run it - the error ends the script
+    } else if (function->var->isNative()) {
+        callNative(function->var, functionRoot);
     } else {
         /* we just want to execute the block, but something could
          * have messed up and left us with the wrong ScriptLex, so
          * we want to be careful here... */
-        CScriptException *exception = 0;
         CScriptLex *oldLex = l;
         CScriptLex *newLex = new CScriptLex(function->var->getString());
+        newLex->errors = &error;
         l = newLex;
-        try {
-          block(execute);
-          // because return will probably have called this, and set execute to false
-          execute = true;
-        } catch (CScriptException *e) {
-          exception = e;
-        }
+        // nor can it leave a function for a loop it was called from
+        int oldBreakable = breakable, oldContinuable = continuable;
+        breakable = continuable = 0;
+        CScriptVar *oldModuleScope = moduleScope;
+        moduleScope = functionScope;
+        // a callback from a native is script again, checked at each statement
+        bool wasNative = memory.inNative;
+        memory.inNative = false;
+        block(execute);
+        memory.inNative = wasNative;
+        breakable = oldBreakable;
+        continuable = oldContinuable;
+        moduleScope = oldModuleScope;
         delete newLex;
         l = oldLex;
-
-        if (exception)
-          throw exception;
     }
+    // because return will probably have set execute to false
+    execute = !error.pending;
 #ifdef TINYJS_CALL_STACK
-    if (!call_stack.empty()) call_stack.pop_back();
+    if (error.pending) {
+      // keep the frame for the report - and describe it now, as the caller's lexer may not last
+      getCallFrameText(call_stack[frame]);
+    } else
+      call_stack.resize(frame);
+#endif
+    if (profiler) profiler->leave();
+#ifdef TINYJS_TRACE_ALLOC
+    jsAllocTrace.leave();
 #endif
     scopes.pop_back();
+    if (functionScope) scopes.pop_back();
+    memory.calls--;
+    memory.stackBase = oldStackBase;
     /* get the real return var before we remove it from our function */
     returnVar = new CScriptVarLink(returnVarLink->var);
     functionRoot->removeLink(returnVarLink);
@@ -1526,22 +2794,216 @@ CScriptVarLink *CTinyJS::functionCall(bool &execute, CScriptVarLink *function, C
       return returnVar;
     else
       return new CScriptVarLink(new CScriptVar());
-  } else {
-    // function, but not executing - just parse args and be done
-    l->match('(');
-    while (l->tk != ')') {
-      CScriptVarLink *value = base(execute);
-      CLEAN(value);
-      if (l->tk!=')') l->match(',');
+}
+
+CScriptVarLink *CTinyJS::callFunction(CScriptVar *function, CScriptVar *thisObj, CScriptVar **args, int argCount) {
+    if (error.pending) return 0;
+    CScriptMemoryScope accounting(&memory);
+    if (!function->isFunction()) {
+        error.set("Expecting a function to call");
+    } else {
+        CScriptVar *functionRoot = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_FUNCTION);
+        if (thisObj)
+          functionRoot->addChildNoDup("this", thisObj);
+        // parameters are passed just as functionCall() does, missing ones are undefined
+        CScriptVarLink *v = function->firstChild;
+        for (int i=0; v; i++, v = v->nextSibling) {
+            CScriptVar *value = i<argCount ? args[i] : new CScriptVar();
+            functionRoot->addChild(v->name, value->isBasic() ? value->deepCopy() : value);
+        }
+        static const string callbackName("<callback>");
+        CScriptVarLink functionLink(function, &callbackName);
+        bool execute = true;
+        if (!l) scopes.push_back(root); // called from outside execute()
+        CScriptVarLink *result = runFunction(execute, &functionLink, functionRoot);
+        if (!l) scopes.pop_back();
+        if (!error.pending) return result;
+        CLEAN(result);
     }
-    l->match(')');
-    if (l->tk == '{') { // TODO: why is this here?
-      block(execute);
+    if (!l) {
+        // we're not inside execute(), so this is the API boundary
+        string report = error.text;
+        error.pending = false;
+#ifdef TINYJS_CALL_STACK
+        call_stack.clear();
+#endif
+        throw new CScriptException(report);
+    }
+    return 0;
+}
+
+/// Do a maths op, recording an error and stopping execution if the op isn't supported
+CScriptVar *CTinyJS::mathsOp(bool &execute, CScriptVar *a, CScriptVar *b, int op) {
+    const char *typeName;
+    if (a->isConstant() && b->isConstant()) {
+        // both constant, so the result is too - and may be known already
+        CScriptFoldKey key = { a, b, op };
+        std::map<CScriptFoldKey, CScriptVar*>::iterator it = folds.find(key);
+        if (it!=folds.end()) return it->second;
+        CScriptVar *res = a->tryMathsOp(b, op, &typeName);
+        if (res && folds.size()<TINYJS_FOLD_CACHE_SIZE &&
+            (!res->isString() || res->getString().size()<=TINYJS_CONSTANT_MAX_STRING)) {
+            res->flags |= SCRIPTVAR_CONSTANT;
+            a->ref(); b->ref(); // so the key can't be reused by another constant
+            folds[key] = res->ref();
+        }
+        if (res) return res;
+    }
+    CScriptVar *res = a->tryMathsOp(b, op, &typeName);
+    if (!res) {
+        if (execute)
+            error.set("Operation %s not supported on the %s datatype",
+                      CScriptLex::getTokenStr(op).c_str(), typeName);
+        execute = false;
+        res = new CScriptVar();
+    }
+    return res;
+}
+
+CScriptVar *CTinyJS::getConstant(int tk, const string &text) {
+    int varFlags = tk==LEX_INT ? SCRIPTVAR_INTEGER : (tk==LEX_FLOAT ? SCRIPTVAR_DOUBLE : SCRIPTVAR_STRING);
+    if (tk==LEX_STR && text.size()>TINYJS_CONSTANT_MAX_STRING)
+      return new CScriptVar(text, varFlags);
+    std::map<std::string, CScriptVar*> &pool = tk==LEX_STR ? stringConstants : numberConstants;
+    std::map<std::string, CScriptVar*>::iterator it = pool.find(text);
+    if (it!=pool.end()) return it->second;
+    CScriptVar *v = new CScriptVar(text, varFlags);
+    if (numberConstants.size()+stringConstants.size() < TINYJS_CONSTANT_POOL_SIZE) {
+      v->flags |= SCRIPTVAR_CONSTANT;
+      pool[text] = v->ref();
+    }
+    return v;
+}
+
+NOINLINE CScriptVarLink *CTinyJS::objectLiteral(bool &execute) {
+    CScriptVar *contents = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT);
+    /* JSON-style object definition */
+    l->match('{');
+    while (l->tk != '}' && l->tk != LEX_EOF) {
+      string id = l->tkStr;
+      // we only allow strings or IDs on the left hand side of an initialisation
+      if (l->tk==LEX_STR) l->match(LEX_STR);
+      else l->match(LEX_ID);
+      l->match(':');
+      if (execute) {
+        CScriptVarLink *a = base(execute);
+        contents->addChild(id, a->var);
+        CLEAN(a);
+      }
+      // no need to clean here, as it will definitely be used
+      if (l->tk != '}') l->match(',');
+    }
+
+    l->match('}');
+    return new CScriptVarLink(contents);
+}
+
+NOINLINE CScriptVarLink *CTinyJS::arrayLiteral(bool &execute) {
+    CScriptVar *contents = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_ARRAY);
+    /* JSON-style array */
+    l->match('[');
+    int idx = 0;
+    while (l->tk != ']' && l->tk != LEX_EOF) {
+      if (execute) {
+        char idx_str[16]; // big enough for 2^32
+        sprintf_s(idx_str, sizeof(idx_str), "%d",idx);
+
+        CScriptVarLink *a = base(execute);
+        contents->addChild(idx_str, a->var);
+        CLEAN(a);
+      }
+      // no need to clean here, as it will definitely be used
+      if (l->tk != ']') l->match(',');
+      idx++;
+    }
+    l->match(']');
+    return new CScriptVarLink(contents);
+}
+
+NOINLINE CScriptVarLink *CTinyJS::newObject(bool &execute) {
+  // new -> create a new object
+  l->match(LEX_R_NEW);
+  const string &className = l->tkStr;
+  if (execute) {
+    CScriptVarLink *objClassOrFunc = findInScopes(className);
+    if (!objClassOrFunc) {
+      TRACE("%s is not a valid class name", className.c_str());
+      return new CScriptVarLink(new CScriptVar());
+    }
+    l->match(LEX_ID);
+    CScriptVar *obj = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT);
+    CScriptVarLink *objLink = new CScriptVarLink(obj);
+    if (objClassOrFunc->var->isFunction()) {
+      CLEAN(functionCall(execute, objClassOrFunc, obj));
+    } else {
+      obj->addChild(TINYJS_PROTOTYPE_CLASS, objClassOrFunc->var);
+      // an object class may have a constructor to take the arguments
+      CScriptVarLink *constructor = objClassOrFunc->var->findChild("constructor");
+      if (constructor && constructor->var->isFunction() && l->tk == '(') {
+        CLEAN(functionCall(execute, constructor, obj));
+      } else if (l->tk == '(') {
+        l->match('(');
+        l->match(')');
+      }
+    }
+    return objLink;
+  } else {
+    l->match(LEX_ID);
+    if (l->tk == '(') {
+      l->match('(');
+      l->match(')');
     }
-    /* function will be a blank scriptvarlink if we're not executing,
-     * so just return it rather than an alloc/free */
-    return function;
   }
+  return new CScriptVarLink(new CScriptVar());
+}
+
+/** A '.' or '[' after 'a'. Returns the member, which 'parent' is then set to
+ * the object of. If 'a' isn't owned by anything, it's kept in 'temp' (freeing
+ * what was there) as the member may belong to it */
+NOINLINE CScriptVarLink *CTinyJS::memberAccess(bool &execute, CScriptVarLink *a, CScriptVar *&parent, CScriptVarLink *&temp) {
+    if (l->tk == '.') {
+        l->match('.');
+        if (execute) {
+          const string &name = l->tkStr;
+          CScriptVarLink *child = a->var->findChild(name);
+          if (!child) child = findInParentClasses(a->var, name);
+          if (!child) {
+            /* if we haven't found this defined yet, use the built-in
+               'length' properly */
+            if (a->var->isConstant() && !(name == "length"))
+              a->replaceWith(a->var->deepCopy()); // don't add to a shared literal
+            if (a->var->isArray() && name == "length") {
+              int l = a->var->getArrayLength();
+              child = new CScriptVarLink(new CScriptVar(l));
+            } else if ((a->var->isString() || a->var->isBuffer()) && name == "length") {
+              int l = a->var->getString().size();
+              child = new CScriptVarLink(new CScriptVar(l));
+            } else if (a->var->hash && name == "size") {
+              child = new CScriptVarLink(new CScriptVar(a->var->hash->count));
+            } else {
+              child = a->var->addChild(name);
+            }
+          }
+          parent = a->var;
+          if (!a->owned) { CLEAN(temp); temp = a; }
+          a = child;
+        }
+        l->match(LEX_ID);
+    } else {
+        l->match('[');
+        CScriptVarLink *index = base(execute);
+        l->match(']');
+        if (execute) {
+          if (a->var->isConstant() && !a->var->findChild(index->var->getString()))
+            a->replaceWith(a->var->deepCopy()); // don't add to a shared literal
+          CScriptVarLink *child = a->var->findChildOrCreate(index->var->getString());
+          parent = a->var;
+          if (!a->owned) { CLEAN(temp); temp = a; }
+          a = child;
+        }
+        CLEAN(index);
+    }
+    return a;
 }
 
 CScriptVarLink *CTinyJS::factor(bool &execute) {
@@ -1572,299 +3034,190 @@ CScriptVarLink *CTinyJS::factor(bool &execute) {
         //printf("0x%08X for %s at %s\n", (unsigned int)a, l->tkStr.c_str(), l->getPosition().c_str());
         /* The parent if we're executing a method call */
         CScriptVar *parent = 0;
+        /* A temporary (say the result of a call) whose members are being
+           accessed - kept until we're done with them */
+        CScriptVarLink *temp = 0;
 
         if (execute && !a) {
           /* Variable doesn't exist! JavaScript says we should create it
            * (we won't add it here. This is done in the assignment operator)*/
-          a = new CScriptVarLink(new CScriptVar(), l->tkStr);
+          a = CScriptVarLink::create(new CScriptVar(), l->tkStr);
         }
         l->match(LEX_ID);
         while (l->tk=='(' || l->tk=='.' || l->tk=='[') {
             if (l->tk=='(') { // ------------------------------------- Function Call
                 a = functionCall(execute, a, parent);
-            } else if (l->tk == '.') { // ------------------------------------- Record Access
-                l->match('.');
-                if (execute) {
-                  const string &name = l->tkStr;
-                  CScriptVarLink *child = a->var->findChild(name);
-                  if (!child) child = findInParentClasses(a->var, name);
-                  if (!child) {
-                    /* if we haven't found this defined yet, use the built-in
-                       'length' properly */
-                    if (a->var->isArray() && name == "length") {
-                      int l = a->var->getArrayLength();
-                      child = new CScriptVarLink(new CScriptVar(l));
-                    } else if (a->var->isString() && name == "length") {
-                      int l = a->var->getString().size();
-                      child = new CScriptVarLink(new CScriptVar(l));
-                    } else {
-                      child = a->var->addChild(name);
-                    }
-                  }
-                  parent = a->var;
-                  a = child;
-                }
-                l->match(LEX_ID);
-            } else if (l->tk == '[') { // ------------------------------------- Array Access
-                l->match('[');
-                CScriptVarLink *index = base(execute);
-                l->match(']');
-                if (execute) {
-                  CScriptVarLink *child = a->var->findChildOrCreate(index->var->getString());
-                  parent = a->var;
-                  a = child;
-                }
-                CLEAN(index);
-            } else ASSERT(0);
+            } else { // ------------------------------------- Record or Array Access
+                a = memberAccess(execute, a, parent, temp);
+            }
+        }
+        if (temp) {
+            // if nothing else holds the temporary, 'a' may belong to it
+            if (a->owned && temp->var->getRefs()<=1)
+              a = new CScriptVarLink(a->var);
+            CLEAN(temp);
         }
         return a;
     }
-    if (l->tk==LEX_INT || l->tk==LEX_FLOAT) {
-        CScriptVar *a = new CScriptVar(l->tkStr,
-            ((l->tk==LEX_INT)?SCRIPTVAR_INTEGER:SCRIPTVAR_DOUBLE));
+    if (l->tk==LEX_INT || l->tk==LEX_FLOAT || l->tk==LEX_STR) {
+        CScriptVar *a = execute ? getConstant(l->tk, l->tkStr) : 0;
         l->match(l->tk);
-        return new CScriptVarLink(a);
-    }
-    if (l->tk==LEX_STR) {
-        CScriptVar *a = new CScriptVar(l->tkStr, SCRIPTVAR_STRING);
-        l->match(LEX_STR);
-        return new CScriptVarLink(a);
-    }
-    if (l->tk=='{') {
-        CScriptVar *contents = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT);
-        /* JSON-style object definition */
-        l->match('{');
-        while (l->tk != '}') {
-          string id = l->tkStr;
-          // we only allow strings or IDs on the left hand side of an initialisation
-          if (l->tk==LEX_STR) l->match(LEX_STR);
-          else l->match(LEX_ID);
-          l->match(':');
-          if (execute) {
-            CScriptVarLink *a = base(execute);
-            contents->addChild(id, a->var);
-            CLEAN(a);
-          }
-          // no need to clean here, as it will definitely be used
-          if (l->tk != '}') l->match(',');
-        }
-
-        l->match('}');
-        return new CScriptVarLink(contents);
-    }
-    if (l->tk=='[') {
-        CScriptVar *contents = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_ARRAY);
-        /* JSON-style array */
-        l->match('[');
-        int idx = 0;
-        while (l->tk != ']') {
-          if (execute) {
-            char idx_str[16]; // big enough for 2^32
-            sprintf_s(idx_str, sizeof(idx_str), "%d",idx);
-
-            CScriptVarLink *a = base(execute);
-            contents->addChild(idx_str, a->var);
-            CLEAN(a);
-          }
-          // no need to clean here, as it will definitely be used
-          if (l->tk != ']') l->match(',');
-          idx++;
-        }
-        l->match(']');
-        return new CScriptVarLink(contents);
+        return a ? new CScriptVarLink(a) : new CScriptVarLink(new CScriptVar());
     }
+    if (l->tk=='{')
+        return objectLiteral(execute);
+    if (l->tk=='[')
+        return arrayLiteral(execute);
     if (l->tk==LEX_R_FUNCTION) {
       CScriptVarLink *funcVar = parseFunctionDefinition();
         if (funcVar->name != TINYJS_TEMP_NAME)
           TRACE("Functions not defined at statement-level are not meant to have a name");
         return funcVar;
     }
-    if (l->tk==LEX_R_NEW) {
-      // new -> create a new object
-      l->match(LEX_R_NEW);
-      const string &className = l->tkStr;
-      if (execute) {
-        CScriptVarLink *objClassOrFunc = findInScopes(className);
-        if (!objClassOrFunc) {
-          TRACE("%s is not a valid class name", className.c_str());
-          return new CScriptVarLink(new CScriptVar());
-        }
-        l->match(LEX_ID);
-        CScriptVar *obj = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT);
-        CScriptVarLink *objLink = new CScriptVarLink(obj);
-        if (objClassOrFunc->var->isFunction()) {
-          CLEAN(functionCall(execute, objClassOrFunc, obj));
-        } else {
-          obj->addChild(TINYJS_PROTOTYPE_CLASS, objClassOrFunc->var);
-          if (l->tk == '(') {
-            l->match('(');
-            l->match(')');
-          }
-        }
-        return objLink;
-      } else {
-        l->match(LEX_ID);
-        if (l->tk == '(') {
-          l->match('(');
-          l->match(')');
-        }
-      }
-    }
+    if (l->tk==LEX_R_NEW)
+        return newObject(execute);
     // Nothing we can do here... just hope it's the end...
     l->match(LEX_EOF);
-    return 0;
-}
-
-CScriptVarLink *CTinyJS::unary(bool &execute) {
-    CScriptVarLink *a;
-    if (l->tk=='!') {
-        l->match('!'); // binary not
-        a = factor(execute);
-        if (execute) {
-            CScriptVar zero(0);
-            CScriptVar *res = a->var->mathsOp(&zero, LEX_EQUAL);
-            CREATE_LINK(a, res);
-        }
-    } else
-        a = factor(execute);
-    return a;
+    return new CScriptVarLink(new CScriptVar());
 }
 
-CScriptVarLink *CTinyJS::term(bool &execute) {
-    CScriptVarLink *a = unary(execute);
-    while (l->tk=='*' || l->tk=='/' || l->tk=='%') {
-        int op = l->tk;
-        l->match(l->tk);
-        CScriptVarLink *b = unary(execute);
-        if (execute) {
-            CScriptVar *res = a->var->mathsOp(b->var, op);
-            CREATE_LINK(a, res);
-        }
-        CLEAN(b);
+/// Apply a prefix operator ('!', '-', or ++ and --) to 'a'
+NOINLINE CScriptVarLink *CTinyJS::prefixOp(bool &execute, CScriptVarLink *a, int op) {
+    if (op=='!') {
+        CScriptVar zero(0);
+        CScriptVar *res = mathsOp(execute, a->var, &zero, LEX_EQUAL);
+        CREATE_LINK(a, res);
+    } else if (op=='-') {
+        // the pooled 0, so that negating a literal folds too
+        CScriptVar *zero = getConstant(LEX_INT, "0")->ref();
+        CScriptVar *res = mathsOp(execute, zero, a->var, '-');
+        zero->unref();
+        CREATE_LINK(a, res);
+    } else {
+        // ++ and -- - the result is the variable itself, so nothing to allocate
+        CScriptVar one(1);
+        int add = op==LEX_PLUSPLUS ? '+' : '-';
+        if (!a->var->mathsOpInPlace(&one, add))
+            a->replaceWith(mathsOp(execute, a->var, &one, add));
     }
     return a;
 }
 
-CScriptVarLink *CTinyJS::expression(bool &execute) {
-    bool negate = false;
-    if (l->tk=='-') {
-        l->match('-');
-        negate = true;
-    }
-    CScriptVarLink *a = term(execute);
-    if (negate) {
-        CScriptVar zero(0);
-        CScriptVar *res = zero.mathsOp(a->var, '-');
-        CREATE_LINK(a, res);
-    }
+/** Apply a postfix ++ or -- to 'a', returning the old value - unless 'unused'
+ * says it won't be looked at */
+NOINLINE CScriptVarLink *CTinyJS::postfixOp(bool &execute, CScriptVarLink *a, int op, bool unused) {
+    CScriptVar one(1);
+    int add = op==LEX_PLUSPLUS ? '+' : '-';
+    /* 'i++;' - the statement ends here so the old value won't be
+       looked at, and the variable can just be changed */
+    if (unused && (l->tk==';' || l->tk==LEX_EOF) &&
+        a->var->mathsOpInPlace(&one, add))
+      return a;
+    CScriptVar *res = mathsOp(execute, a->var, &one, add);
+    CScriptVarLink *oldValue = new CScriptVarLink(a->var);
+    a->replaceWith(res);
+    CLEAN(a);
+    return oldValue;
+}
 
-    while (l->tk=='+' || l->tk=='-' ||
-        l->tk==LEX_PLUSPLUS || l->tk==LEX_MINUSMINUS) {
-        int op = l->tk;
-        l->match(l->tk);
+CScriptVarLink *CTinyJS::unary(bool &execute) {
+    // only the first operand of a statement can have its value thrown away
+    bool unused = resultUnused;
+    resultUnused = false;
+    CScriptVarLink *a;
+    int op = l->tk;
+    if (op=='!' || op=='-') {
+        l->match(op);
+        a = unary(execute);
+        if (execute) a = prefixOp(execute, a, op);
+    } else if (op==LEX_PLUSPLUS || op==LEX_MINUSMINUS) {
+        l->match(op);
+        a = factor(execute);
+        if (execute) a = prefixOp(execute, a, op);
+    } else {
+        a = factor(execute);
+        op = l->tk;
         if (op==LEX_PLUSPLUS || op==LEX_MINUSMINUS) {
-            if (execute) {
-                CScriptVar one(1);
-                CScriptVar *res = a->var->mathsOp(&one, op==LEX_PLUSPLUS ? '+' : '-');
-                CScriptVarLink *oldValue = new CScriptVarLink(a->var);
-                // in-place add/subtract
-                a->replaceWith(res);
-                CLEAN(a);
-                a = oldValue;
-            }
-        } else {
-            CScriptVarLink *b = term(execute);
-            if (execute) {
-                // not in-place, so just replace
-                CScriptVar *res = a->var->mathsOp(b->var, op);
-                CREATE_LINK(a, res);
-            }
-            CLEAN(b);
+            l->match(op);
+            if (execute) a = postfixOp(execute, a, op, unused);
         }
     }
     return a;
 }
 
-CScriptVarLink *CTinyJS::shift(bool &execute) {
-  CScriptVarLink *a = expression(execute);
-  if (l->tk==LEX_LSHIFT || l->tk==LEX_RSHIFT || l->tk==LEX_RSHIFTUNSIGNED) {
-    int op = l->tk;
-    l->match(op);
-    CScriptVarLink *b = base(execute);
-    int shift = execute ? b->var->getInt() : 0;
-    CLEAN(b);
-    if (execute) {
-      if (op==LEX_LSHIFT) a->var->setInt(a->var->getInt() << shift);
-      if (op==LEX_RSHIFT) a->var->setInt(a->var->getInt() >> shift);
-      if (op==LEX_RSHIFTUNSIGNED) a->var->setInt(((unsigned int)a->var->getInt()) >> shift);
+/// How tightly a binary operator binds, or 0 if the token isn't one
+static int binaryPrecedence(int tk) {
+    switch (tk) {
+    case LEX_OROR: return 1;
+    case LEX_ANDAND: return 2;
+    case '|': return 3;
+    case '^': return 4;
+    case '&': return 5;
+    case LEX_EQUAL: case LEX_NEQUAL: case LEX_TYPEEQUAL: case LEX_NTYPEEQUAL: return 6;
+    case '<': case '>': case LEX_LEQUAL: case LEX_GEQUAL: return 7;
+    case LEX_LSHIFT: case LEX_RSHIFT: case LEX_RSHIFTUNSIGNED: return 8;
+    case '+': case '-': return 9;
+    case '*': case '/': case '%': return 10;
     }
-  }
-  return a;
+    return 0;
 }
 
-CScriptVarLink *CTinyJS::condition(bool &execute) {
-    CScriptVarLink *a = shift(execute);
-    CScriptVarLink *b;
-    while (l->tk==LEX_EQUAL || l->tk==LEX_NEQUAL ||
-           l->tk==LEX_TYPEEQUAL || l->tk==LEX_NTYPEEQUAL ||
-           l->tk==LEX_LEQUAL || l->tk==LEX_GEQUAL ||
-           l->tk=='<' || l->tk=='>') {
-        int op = l->tk;
-        l->match(l->tk);
-        b = shift(execute);
-        if (execute) {
-            CScriptVar *res = a->var->mathsOp(b->var, op);
-            CREATE_LINK(a,res);
-        }
-        CLEAN(b);
+/// Apply a binary operator, replacing 'a' with the result and freeing 'b'
+NOINLINE CScriptVarLink *CTinyJS::binaryOp(bool &execute, CScriptVarLink *a, CScriptVarLink *b, int op) {
+    if (op==LEX_ANDAND || op==LEX_OROR) {
+        CScriptVar *newa = new CScriptVar(a->var->getBool());
+        CScriptVar *newb = new CScriptVar(b->var->getBool());
+        CREATE_LINK(a, newa);
+        CREATE_LINK(b, newb);
+        CScriptVar *res = mathsOp(execute, a->var, b->var, op==LEX_ANDAND ? '&' : '|');
+        CREATE_LINK(a, res);
+    } else if (op==LEX_LSHIFT || op==LEX_RSHIFT || op==LEX_RSHIFTUNSIGNED) {
+        // a new value - 'a' may be a variable, or a shared constant
+        int value = a->var->getInt();
+        int shift = b->var->getInt();
+        if (op==LEX_LSHIFT) value = value << shift;
+        if (op==LEX_RSHIFT) value = value >> shift;
+        if (op==LEX_RSHIFTUNSIGNED) value = ((unsigned int)value) >> shift;
+        CREATE_LINK(a, new CScriptVar(value));
+    } else {
+        CScriptVar *res = mathsOp(execute, a->var, b->var, op);
+        CREATE_LINK(a, res);
     }
+    CLEAN(b);
     return a;
 }
 
-CScriptVarLink *CTinyJS::logic(bool &execute) {
-    CScriptVarLink *a = condition(execute);
-    CScriptVarLink *b;
-    while (l->tk=='&' || l->tk=='|' || l->tk=='^' || l->tk==LEX_ANDAND || l->tk==LEX_OROR) {
-        bool noexecute = false;
+/* All the binary operators, by precedence climbing: an operand, then each
+   operator binding at least as tightly as 'minPrecedence' with its right
+   hand side - which is parsed the same way, but only taking operators that
+   bind more tightly. So 'a+b' costs one C stack frame here, rather than one
+   per level of precedence. */
+CScriptVarLink *CTinyJS::binary(bool &execute, int minPrecedence) {
+    CScriptVarLink *a = unary(execute);
+    int precedence;
+    while ((precedence = binaryPrecedence(l->tk)) >= minPrecedence && precedence) {
         int op = l->tk;
-        l->match(l->tk);
-        bool shortCircuit = false;
-        bool boolean = false;
-        // if we have short-circuit ops, then if we know the outcome
-        // we don't bother to execute the other op. Even if not
-        // we need to tell mathsOp it's an & or |
-        if (op==LEX_ANDAND) {
-            op = '&';
-            shortCircuit = !a->var->getBool();
-            boolean = true;
-        } else if (op==LEX_OROR) {
-            op = '|';
-            shortCircuit = a->var->getBool();
-            boolean = true;
-        }
-        b = condition(shortCircuit ? noexecute : execute);
-        if (execute && !shortCircuit) {
-            if (boolean) {
-              CScriptVar *newa = new CScriptVar(a->var->getBool());
-              CScriptVar *newb = new CScriptVar(b->var->getBool());
-              CREATE_LINK(a, newa);
-              CREATE_LINK(b, newb);
-            }
-            CScriptVar *res = a->var->mathsOp(b->var, op);
-            CREATE_LINK(a, res);
-        }
-        CLEAN(b);
+        l->match(op);
+        // if we know the outcome of && or || we don't bother to execute the other side
+        bool shortCircuit = (op==LEX_ANDAND && !a->var->getBool()) ||
+                            (op==LEX_OROR && a->var->getBool());
+        bool noexecute = false;
+        CScriptVarLink *b = binary(shortCircuit ? noexecute : execute, precedence+1);
+        if (execute && !shortCircuit)
+            a = binaryOp(execute, a, b, op);
+        else
+            CLEAN(b);
     }
     return a;
 }
 
 CScriptVarLink *CTinyJS::ternary(bool &execute) {
-  CScriptVarLink *lhs = logic(execute);
+  CScriptVarLink *lhs = binary(execute, 1);
   bool noexec = false;
   if (l->tk=='?') {
     l->match('?');
     if (!execute) {
-      CLEAN(lhs);
+      // lhs is what's returned, so it's kept
       CLEAN(base(noexec));
       l->match(':');
       CLEAN(base(noexec));
@@ -1887,6 +3240,8 @@ CScriptVarLink *CTinyJS::ternary(bool &execute) {
 }
 
 CScriptVarLink *CTinyJS::base(bool &execute) {
+    // every nested (, [ and { comes back here
+    outOfStack(execute);
     CScriptVarLink *lhs = ternary(execute);
     if (l->tk=='=' || l->tk==LEX_PLUSEQUAL || l->tk==LEX_MINUSEQUAL) {
         /* If we're assigning to this and we don't have a parent,
@@ -1906,12 +3261,12 @@ CScriptVarLink *CTinyJS::base(bool &execute) {
         if (execute) {
             if (op=='=') {
                 lhs->replaceWith(rhs);
-            } else if (op==LEX_PLUSEQUAL) {
-                CScriptVar *res = lhs->var->mathsOp(rhs->var, '+');
-                lhs->replaceWith(res);
-            } else if (op==LEX_MINUSEQUAL) {
-                CScriptVar *res = lhs->var->mathsOp(rhs->var, '-');
-                lhs->replaceWith(res);
+            } else if (op==LEX_PLUSEQUAL || op==LEX_MINUSEQUAL) {
+                int mathsOperator = op==LEX_PLUSEQUAL ? '+' : '-';
+                if (!lhs->var->mathsOpInPlace(rhs->var, mathsOperator)) {
+                  CScriptVar *res = mathsOp(execute, lhs->var, rhs->var, mathsOperator);
+                  lhs->replaceWith(res);
+                }
             } else ASSERT(0);
         }
         CLEAN(rhs);
@@ -1920,30 +3275,435 @@ CScriptVarLink *CTinyJS::base(bool &execute) {
 }
 
 void CTinyJS::block(bool &execute) {
+    if (!execute && l->tk=='{') {
+      // fast skip of blocks - function bodies are only parsed when called
+      l->skipBlock();
+      l->match('}');
+      return;
+    }
     l->match('{');
+    while (l->tk && l->tk!='}' && !error.pending)
+      statement(execute);
+    l->match('}');
+}
+
+NOINLINE void CTinyJS::varStatement(bool &execute) {
+    /* variable creation. TODO - we need a better way of parsing the left
+     * hand side. Maybe just have a flag called can_create_var that we
+     * set and then we parse as if we're doing a normal equals.*/
+    l->match(LEX_R_VAR);
+    while (l->tk != ';' && l->tk != LEX_EOF) {
+      CScriptVarLink *a = 0;
+      if (execute)
+        a = scopes.back()->findChildOrCreate(l->tkStr);
+      l->match(LEX_ID);
+      // now do stuff defined with dots
+      while (l->tk == '.') {
+          l->match('.');
+          if (execute) {
+              CScriptVarLink *lastA = a;
+              a = lastA->var->findChildOrCreate(l->tkStr);
+          }
+          l->match(LEX_ID);
+      }
+      // sort out initialiser
+      if (l->tk == '=') {
+          l->match('=');
+          CScriptVarLink *var = base(execute);
+          if (execute)
+              a->replaceWith(var);
+          CLEAN(var);
+      }
+      if (l->tk != ';')
+        l->match(',');
+    }       
+    l->match(';');
+}
+
+NOINLINE void CTinyJS::whileStatement(bool &execute) {
+    // We do repetition by pulling out the string representing our statement
+    // there's definitely some opportunity for optimisation here
+    l->match(LEX_R_WHILE);
+    l->match('(');
+    breakable++;
+    continuable++;
+    int whileCondStart = l->tokenStart;
+    bool noexecute = false;
+    CScriptVarLink *cond = base(execute);
+    bool loopCond = execute && cond->var->getBool();
+    CLEAN(cond);
+    CScriptLex *whileCond = l->getSubLex(whileCondStart);
+    l->match(')');
+    int whileBodyStart = l->tokenStart;
+    statement(loopCond ? execute : noexecute);
+    if (loopCond && !loopJump(execute)) loopCond = false;
+    CScriptLex *whileBody = l->getSubLex(whileBodyStart);
+    CScriptLex *oldLex = l;
+    int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
+    while (loopCond && loopCount-->0) {
+        whileCond->reset();
+        l = whileCond;
+        cond = base(execute);
+        loopCond = execute && cond->var->getBool();
+        CLEAN(cond);
+        if (loopCond) {
+            whileBody->reset();
+            l = whileBody;
+            statement(execute);
+            if (!loopJump(execute)) loopCond = false;
+        }
+    }
+    l = oldLex;
+    delete whileCond;
+    delete whileBody;
+    breakable--;
+    continuable--;
+
+    if (loopCount<=0) {
+        root->trace();
+        TRACE("WHILE Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
+        error.set("LOOP_ERROR");
+        execute = false;
+    }
+}
+
+NOINLINE void CTinyJS::forStatement(bool &execute) {
+    l->match(LEX_R_FOR);
+    l->match('(');
+    if ((l->tk==LEX_ID && l->peek()==LEX_R_IN) ||
+        (l->tk==LEX_R_VAR && l->peek(2)==LEX_R_IN)) {
+        forInStatement(execute);
+        return;
+    }
+    breakable++;
+    continuable++;
+    statement(execute); // initialisation
+    //l->match(';');
+    int forCondStart = l->tokenStart;
+    bool noexecute = false;
+    CScriptVarLink *cond = base(execute); // condition
+    bool loopCond = execute && cond->var->getBool();
+    CLEAN(cond);
+    CScriptLex *forCond = l->getSubLex(forCondStart);
+    l->match(';');
+    int forIterStart = l->tokenStart;
+    CLEAN(base(noexecute)); // iterator
+    CScriptLex *forIter = l->getSubLex(forIterStart);
+    l->match(')');
+    int forBodyStart = l->tokenStart;
+    statement(loopCond ? execute : noexecute);
+    if (loopCond && !loopJump(execute)) loopCond = false;
+    CScriptLex *forBody = l->getSubLex(forBodyStart);
+    CScriptLex *oldLex = l;
+    if (loopCond) {
+        forIter->reset();
+        l = forIter;
+        resultUnused = true;
+        CLEAN(base(execute));
+    }
+    int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
+    while (execute && loopCond && loopCount-->0) {
+        forCond->reset();
+        l = forCond;
+        cond = base(execute);
+        loopCond = cond->var->getBool();
+        CLEAN(cond);
+        if (execute && loopCond) {
+            forBody->reset();
+            l = forBody;
+            statement(execute);
+            if (!loopJump(execute)) loopCond = false;
+        }
+        if (execute && loopCond) {
+            forIter->reset();
+            l = forIter;
+            resultUnused = true;
+            CLEAN(base(execute));
+        }
+    }
+    l = oldLex;
+    delete forCond;
+    delete forIter;
+    delete forBody;
+    breakable--;
+    continuable--;
+    if (loopCount<=0) {
+        root->trace();
+        TRACE("FOR Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
+        error.set("LOOP_ERROR");
+        execute = false;
+    }
+}
+
+/* for (key in object) - the keys are read from the object's children as
+   the loop reaches them, rather than all being copied into an array first. */
+NOINLINE void CTinyJS::forInStatement(bool &execute) {
+    bool declared = l->tk==LEX_R_VAR;
+    if (declared) l->match(LEX_R_VAR);
+    string name = l->tkStr;
+    l->match(LEX_ID);
+    l->match(LEX_R_IN);
+    CScriptVarLink *objLink = base(execute);
+    l->match(')');
+    CScriptVar *obj = 0;
+    CScriptVarLink *key = 0;
     if (execute) {
-      while (l->tk && l->tk!='}')
+        obj = objLink->var->ref(); // whatever the body does with the variable it came from
+        if (declared)
+            key = scopes.back()->findChildOrCreate(name);
+        else if (!(key = findInScopes(name)))
+            key = root->addChild(name); // as assigning to a variable that doesn't exist would
+    }
+    CLEAN(objLink);
+    breakable++;
+    continuable++;
+    CScriptVarLink *child = obj ? obj->firstChild : 0;
+    while (child && child->name==TINYJS_PROTOTYPE_CLASS) child = child->nextSibling;
+    bool noexecute = false;
+    bool loopCond = child!=0;
+    int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
+    string keyName;
+    unsigned long removed = 0;
+    if (loopCond) {
+        keyName = child->name;
+        key->replaceWith(new CScriptVar(keyName));
+        removed = CScriptVar::linksRemoved;
+        loopCount--;
+    }
+    int forBodyStart = l->tokenStart;
+    statement(loopCond ? execute : noexecute);
+    if (loopCond && !loopJump(execute)) loopCond = false;
+    CScriptLex *forBody = l->getSubLex(forBodyStart);
+    CScriptLex *oldLex = l;
+    while (execute && loopCond) {
+        /* If the body removed anything, the child we were on may have gone:
+           carry on after the one with its name, if there still is one */
+        if (CScriptVar::linksRemoved!=removed)
+            child = obj->findChild(keyName);
+        if (child) child = child->nextSibling;
+        while (child && child->name==TINYJS_PROTOTYPE_CLASS) child = child->nextSibling;
+        if (!child || loopCount--<=0) break;
+        keyName = child->name;
+        key->replaceWith(new CScriptVar(keyName));
+        removed = CScriptVar::linksRemoved;
+        forBody->reset();
+        l = forBody;
         statement(execute);
-      l->match('}');
-    } else {
-      // fast skip of blocks
-      int brackets = 1;
-      while (l->tk && brackets) {
-        if (l->tk == '{') brackets++;
-        if (l->tk == '}') brackets--;
-        l->match(l->tk);
-      }
+        if (!loopJump(execute)) loopCond = false;
+    }
+    l = oldLex;
+    delete forBody;
+    breakable--;
+    continuable--;
+    if (obj) obj->unref();
+    if (loopCount<0) {
+        root->trace();
+        TRACE("FOR Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
+        error.set("LOOP_ERROR");
+        execute = false;
+    }
+}
+
+NOINLINE void CTinyJS::jumpStatement(bool &execute) {
+    int jump = l->tk;
+    l->match(jump);
+    if (execute) {
+      if (jump==LEX_R_BREAK ? breakable : continuable)
+        jumping = jump; // the loop or switch it leaves picks this up
+      else
+        error.set("'%s' outside of a %s", jump==LEX_R_BREAK ? "break" : "continue",
+                  jump==LEX_R_BREAK ? "loop or switch" : "loop");
+      execute = false;
+    }
+    l->match(';');
+}
+
+/// After a loop's body - true if it should go round again, false if it did 'break'
+bool CTinyJS::loopJump(bool &execute) {
+    if (!jumping) return true;
+    bool again = jumping==LEX_R_CONTINUE;
+    jumping = 0;
+    execute = true;
+    return again;
+}
+
+NOINLINE void CTinyJS::switchStatement(bool &execute) {
+    l->match(LEX_R_SWITCH);
+    l->match('(');
+    CScriptVarLink *value = base(execute);
+    l->match(')');
+    if (l->tk!='{') {
+        l->match('{');
+        CLEAN(value);
+        return;
+    }
+    // the cases are only tokenised when the switch is first run
+    int start = l->tokenStart+1;
+    l->skipBlock();
+    int end = l->tokenStart;
+    l->match('}');
+    if (execute && !error.pending) {
+        CScriptSwitchKey key = { l->source, start };
+        std::map<CScriptSwitchKey, CScriptSwitch*>::iterator it = switches.find(key);
+        if (it!=switches.end() && !l->isSubString(start, it->second->body)) {
+            // other text is there now
+            delete it->second;
+            switches.erase(it);
+            it = switches.end();
+        }
+        bool cached = it!=switches.end();
+        CScriptSwitch *sw = cached ? it->second : compileSwitch(start, end);
+        if (sw && !cached && switches.size()<TINYJS_SWITCH_CACHE_SIZE) {
+            sw->body = l->getSubString(start);
+            switches[key] = sw;
+            cached = true;
+        }
+        int pos = -1;
+        if (sw && sw->constant) {
+            pos = sw->find(value->var);
+        } else if (sw) {
+            // some labels are expressions, so they're tried in turn as written
+            int defaultPos = sw->defaultPos;
+            if (!cached) delete sw;
+            sw = 0; // running the labels may collect() the cached one
+            pos = findCase(execute, value->var, start, end);
+            if (pos<0) pos = defaultPos;
+        }
+        if (sw && !cached) delete sw;
+        if (pos>=0 && execute) {
+            breakable++;
+            runCases(execute, start+pos, end);
+            breakable--;
+            if (jumping==LEX_R_BREAK) {
+                jumping = 0;
+                execute = true;
+            }
+        }
     }
+    CLEAN(value);
+}
 
+/// Scan the body of a switch, from after its '{' to its '}', for the case labels
+CScriptSwitch *CTinyJS::compileSwitch(int start, int end) {
+    CScriptSwitch *sw = new CScriptSwitch();
+    sw->constant = true;
+    sw->defaultPos = -1;
+    sw->jumpMin = 0;
+    CScriptLex *oldLex = l;
+    l = new CScriptLex(oldLex, start, end);
+    bool noexecute = false;
+    while (l->tk && !error.pending) {
+        if (l->tk==LEX_R_CASE) {
+            l->match(LEX_R_CASE);
+            bool negative = l->tk=='-' && l->peek()==LEX_INT && l->peek(2)==':';
+            if (negative) l->match('-');
+            int tk = l->tk;
+            string label = l->tkStr;
+            bool literal = (tk==LEX_INT || tk==LEX_STR) && l->peek()==':';
+            CLEAN(base(noexecute));
+            l->match(':');
+            int pos = l->tokenStart<end ? l->tokenStart-start : end-start;
+            if (!literal)
+                sw->constant = false;
+            else if (tk==LEX_STR)
+                sw->add(label, 0, true, pos);
+            else {
+                CScriptVar *v = getConstant(tk, label);
+                sw->add("", negative ? -v->getInt() : v->getInt(), false, pos);
+                if (!v->getRefs()) delete v;
+            }
+        } else if (l->tk==LEX_R_DEFAULT) {
+            l->match(LEX_R_DEFAULT);
+            l->match(':');
+            sw->defaultPos = l->tokenStart<end ? l->tokenStart-start : end-start;
+        } else
+            statement(noexecute);
+    }
+    delete l;
+    l = oldLex;
+    if (error.pending) {
+        delete sw;
+        return 0;
+    }
+    if (sw->constant) sw->build();
+    return sw;
+}
+
+/// Offset of the first case whose label is === value, evaluating the labels in turn, or -1
+int CTinyJS::findCase(bool &execute, CScriptVar *value, int start, int end) {
+    CScriptLex *oldLex = l;
+    l = new CScriptLex(oldLex, start, end);
+    bool noexecute = false;
+    int pos = -1;
+    while (l->tk && pos<0 && execute) {
+        if (l->tk==LEX_R_CASE) {
+            l->match(LEX_R_CASE);
+            CScriptVarLink *label = base(execute);
+            bool matched = false;
+            if (execute) {
+                CScriptVar *eq = mathsOp(execute, value, label->var, LEX_TYPEEQUAL);
+                matched = eq->getBool();
+                if (!eq->getRefs()) delete eq;
+            }
+            CLEAN(label);
+            l->match(':');
+            if (matched) pos = l->tokenStart<end ? l->tokenStart-start : end-start;
+        } else if (l->tk==LEX_R_DEFAULT) {
+            l->match(LEX_R_DEFAULT);
+            l->match(':');
+        } else
+            statement(noexecute);
+    }
+    delete l;
+    l = oldLex;
+    return pos;
+}
+
+/// Run the statements of a switch from a case to the end (or a 'break'), passing over the labels
+void CTinyJS::runCases(bool &execute, int start, int end) {
+    CScriptLex *oldLex = l;
+    l = new CScriptLex(oldLex, start, end);
+    bool noexecute = false;
+    while (l->tk && execute) {
+        if (l->tk==LEX_R_CASE) {
+            l->match(LEX_R_CASE);
+            CLEAN(base(noexecute));
+            l->match(':');
+        } else if (l->tk==LEX_R_DEFAULT) {
+            l->match(LEX_R_DEFAULT);
+            l->match(':');
+        } else
+            statement(execute);
+    }
+    delete l;
+    l = oldLex;
 }
 
 void CTinyJS::statement(bool &execute) {
+    // as does every nested block
+    outOfStack(execute);
+    if (profiler && profiler->pending) profiler->sample(l);
+#ifdef TINYJS_TRACE_ALLOC
+    jsAllocTrace.statement(l);
+#endif
+    if (memory.quota && memory.used>memory.quota && execute) {
+        collect();
+        // only a statement that's still growing the heap fails, so the script can free things
+        if (memory.used>memory.quota && memory.used>memory.checked) {
+            outOfMemory();
+            execute = false;
+        }
+    }
+    memory.checked = memory.used;
     if (l->tk==LEX_ID ||
         l->tk==LEX_INT ||
         l->tk==LEX_FLOAT ||
         l->tk==LEX_STR ||
+        l->tk==LEX_PLUSPLUS ||
+        l->tk==LEX_MINUSMINUS ||
         l->tk=='-') {
         /* Execute a simple statement that only contains basic arithmetic... */
+        resultUnused = true;
         CLEAN(base(execute));
         l->match(';');
     } else if (l->tk=='{') {
@@ -1953,36 +3713,7 @@ void CTinyJS::statement(bool &execute) {
         /* Empty statement - to allow things like ;;; */
         l->match(';');
     } else if (l->tk==LEX_R_VAR) {
-        /* variable creation. TODO - we need a better way of parsing the left
-         * hand side. Maybe just have a flag called can_create_var that we
-         * set and then we parse as if we're doing a normal equals.*/
-        l->match(LEX_R_VAR);
-        while (l->tk != ';') {
-          CScriptVarLink *a = 0;
-          if (execute)
-            a = scopes.back()->findChildOrCreate(l->tkStr);
-          l->match(LEX_ID);
-          // now do stuff defined with dots
-          while (l->tk == '.') {
-              l->match('.');
-              if (execute) {
-                  CScriptVarLink *lastA = a;
-                  a = lastA->var->findChildOrCreate(l->tkStr);
-              }
-              l->match(LEX_ID);
-          }
-          // sort out initialiser
-          if (l->tk == '=') {
-              l->match('=');
-              CScriptVarLink *var = base(execute);
-              if (execute)
-                  a->replaceWith(var);
-              CLEAN(var);
-          }
-          if (l->tk != ';')
-            l->match(',');
-        }       
-        l->match(';');
+        varStatement(execute);
     } else if (l->tk==LEX_R_IF) {
         l->match(LEX_R_IF);
         l->match('(');
@@ -1997,95 +3728,13 @@ void CTinyJS::statement(bool &execute) {
             statement(cond ? noexecute : execute);
         }
     } else if (l->tk==LEX_R_WHILE) {
-        // We do repetition by pulling out the string representing our statement
-        // there's definitely some opportunity for optimisation here
-        l->match(LEX_R_WHILE);
-        l->match('(');
-        int whileCondStart = l->tokenStart;
-        bool noexecute = false;
-        CScriptVarLink *cond = base(execute);
-        bool loopCond = execute && cond->var->getBool();
-        CLEAN(cond);
-        CScriptLex *whileCond = l->getSubLex(whileCondStart);
-        l->match(')');
-        int whileBodyStart = l->tokenStart;
-        statement(loopCond ? execute : noexecute);
-        CScriptLex *whileBody = l->getSubLex(whileBodyStart);
-        CScriptLex *oldLex = l;
-        int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
-        while (loopCond && loopCount-->0) {
-            whileCond->reset();
-            l = whileCond;
-            cond = base(execute);
-            loopCond = execute && cond->var->getBool();
-            CLEAN(cond);
-            if (loopCond) {
-                whileBody->reset();
-                l = whileBody;
-                statement(execute);
-            }
-        }
-        l = oldLex;
-        delete whileCond;
-        delete whileBody;
-
-        if (loopCount<=0) {
-            root->trace();
-            TRACE("WHILE Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
-            throw new CScriptException("LOOP_ERROR");
-        }
+        whileStatement(execute);
     } else if (l->tk==LEX_R_FOR) {
-        l->match(LEX_R_FOR);
-        l->match('(');
-        statement(execute); // initialisation
-        //l->match(';');
-        int forCondStart = l->tokenStart;
-        bool noexecute = false;
-        CScriptVarLink *cond = base(execute); // condition
-        bool loopCond = execute && cond->var->getBool();
-        CLEAN(cond);
-        CScriptLex *forCond = l->getSubLex(forCondStart);
-        l->match(';');
-        int forIterStart = l->tokenStart;
-        CLEAN(base(noexecute)); // iterator
-        CScriptLex *forIter = l->getSubLex(forIterStart);
-        l->match(')');
-        int forBodyStart = l->tokenStart;
-        statement(loopCond ? execute : noexecute);
-        CScriptLex *forBody = l->getSubLex(forBodyStart);
-        CScriptLex *oldLex = l;
-        if (loopCond) {
-            forIter->reset();
-            l = forIter;
-            CLEAN(base(execute));
-        }
-        int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
-        while (execute && loopCond && loopCount-->0) {
-            forCond->reset();
-            l = forCond;
-            cond = base(execute);
-            loopCond = cond->var->getBool();
-            CLEAN(cond);
-            if (execute && loopCond) {
-                forBody->reset();
-                l = forBody;
-                statement(execute);
-            }
-            if (execute && loopCond) {
-                forIter->reset();
-                l = forIter;
-                CLEAN(base(execute));
-            }
-        }
-        l = oldLex;
-        delete forCond;
-        delete forIter;
-        delete forBody;
-        if (loopCount<=0) {
-            root->trace();
-            TRACE("FOR Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
-            throw new CScriptException("LOOP_ERROR");
-        }
+        forStatement(execute);
+    } else if (l->tk==LEX_R_SWITCH) {
+        switchStatement(execute);
+    } else if (l->tk==LEX_R_BREAK || l->tk==LEX_R_CONTINUE) {
+        jumpStatement(execute);
     } else if (l->tk==LEX_R_RETURN) {
         l->match(LEX_R_RETURN);
         CScriptVarLink *result = 0;
@@ -2115,20 +3764,28 @@ void CTinyJS::statement(bool &execute) {
 
 /// Get the given variable specified by a path (var1.var2.etc), or return 0
 CScriptVar *CTinyJS::getScriptVariable(const string &path) {
+    if (path.empty()) return root;
+    CScriptVarLink *link = getScriptVariableLink(path);
+    return link ? link->var : 0;
+}
+
+/// Get the link to the given variable specified by a path (var1.var2.etc), or return 0
+CScriptVarLink *CTinyJS::getScriptVariableLink(const string &path) {
     // traverse path
     size_t prevIdx = 0;
     size_t thisIdx = path.find('.');
     if (thisIdx == string::npos) thisIdx = path.length();
     CScriptVar *var = root;
+    CScriptVarLink *varl = 0;
     while (var && prevIdx<path.length()) {
         string el = path.substr(prevIdx, thisIdx-prevIdx);
-        CScriptVarLink *varl = var->findChild(el);
+        varl = var->findChild(el);
         var = varl?varl->var:0;
         prevIdx = thisIdx+1;
         thisIdx = path.find('.', prevIdx);
         if (thisIdx == string::npos) thisIdx = path.length();
     }
-    return var;
+    return var ? varl : 0;
 }
 
 /// Get the value of the given variable, or return 0
@@ -2143,9 +3800,12 @@ const string *CTinyJS::getVariable(const string &path) {
 
 /// set the value of the given variable, return trur if it exists and gets set
 bool CTinyJS::setVariable(const std::string &path, const std::string &varData) {
-    CScriptVar *var = getScriptVariable(path);
+    CScriptVarLink *link = getScriptVariableLink(path);
     // return result
-    if (var) {
+    if (link) {
+        if (link->var->isConstant()) // shared, so give this variable its own
+          link->replaceWith(link->var->deepCopy());
+        CScriptVar *var = link->var;
         if (var->isInt())
             var->setInt((int)strtol(varData.c_str(),0,0));
         else if (var->isDouble())
@@ -2186,6 +3846,10 @@ CScriptVarLink *CTinyJS::findInParentClasses(CScriptVar *object, const std::stri
       CScriptVarLink *implementation = arrayClass->findChild(name);
       if (implementation) return implementation;
     }
+    if (object->isBuffer()) {
+      CScriptVarLink *implementation = bufferClass->findChild(name);
+      if (implementation) return implementation;
+    }
     CScriptVarLink *implementation = objectClass->findChild(name);
     if (implementation) return implementation;
 
@@ -32,6 +32,12 @@
 // If defined, this keeps a note of all calls and where from in memory. This is slower, but good for debugging
 #define TINYJS_CALL_STACK
 
+// If defined (make TRACE_ALLOC=1), allocations are traced to script lines - see TinyJS_AllocTrace.h
+// #define TINYJS_TRACE_ALLOC
+
+// If defined (make INTERN_STRINGS=1), short strings with the same contents share one copy - see CScriptStrings
+// #define TINYJS_INTERN_STRINGS
+
 #ifdef _WIN32
 #ifdef _DEBUG
 #define _CRTDBG_MAP_ALLOC
@@ -41,6 +47,7 @@
 #endif
 #include <string>
 #include <vector>
+#include <map>
 
 #ifndef TRACE
 #define TRACE printf
@@ -93,6 +100,10 @@ enum LEX_TYPES {
     LEX_R_NULL,
     LEX_R_UNDEFINED,
     LEX_R_NEW,
+    LEX_R_IN,
+    LEX_R_SWITCH,
+    LEX_R_CASE,
+    LEX_R_DEFAULT,
 
 	LEX_R_LIST_END /* always the last entry */
 };
@@ -108,6 +119,9 @@ enum SCRIPTVAR_FLAGS {
     SCRIPTVAR_NULL        = 64, // it seems null is its own data type
 
     SCRIPTVAR_NATIVE      = 128, // to specify this is a native function
+    SCRIPTVAR_CONSTANT    = 256, // a literal from the constant pool, shared and never changed
+    SCRIPTVAR_BOUND       = 512, // a native taking its arguments by position (a JSBoundCallback)
+    SCRIPTVAR_BUFFER      = 1024, // bytes, in 'data', passed by reference like an object
     SCRIPTVAR_NUMERICMASK = SCRIPTVAR_NULL |
                             SCRIPTVAR_DOUBLE |
                             SCRIPTVAR_INTEGER,
@@ -117,6 +131,7 @@ enum SCRIPTVAR_FLAGS {
                             SCRIPTVAR_FUNCTION |
                             SCRIPTVAR_OBJECT |
                             SCRIPTVAR_ARRAY |
+                            SCRIPTVAR_BUFFER |
                             SCRIPTVAR_NULL,
 
 };
@@ -135,10 +150,55 @@ public:
     CScriptException(const std::string &exceptionText);
 };
 
+#define TINYJS_ERROR_LENGTH 128
+
+/* Inside the interpreter, errors are recorded here instead of being thrown:
+   execution stops, the parser unwinds as if it were skipping code, and only
+   execute()/evaluate() turn the error into a CScriptException. The buffer is
+   allocated once, so a failed lookup costs no heap allocation and no C++
+   unwinding unless it reaches the API boundary. */
+class CScriptError {
+public:
+    CScriptError() { clear(); }
+
+    bool pending; ///< An error has been recorded and not reported yet
+    char text[TINYJS_ERROR_LENGTH]; ///< Text of the first error recorded
+
+    void set(const char *fmt, ...); ///< Record an error, unless one is already pending
+    void clear() { pending = false; text[0] = 0; }
+};
+
+/// Initial size of the window a streaming CScriptLex keeps over its text
+#define TINYJS_LEX_WINDOW 256
+
+/// Source of script text for a streaming CScriptLex
+class CScriptReader {
+public:
+    virtual ~CScriptReader() {}
+    virtual int read(char *buf, int len) = 0; ///< Read up to len bytes, returns 0 at the end of the text
+};
+
+/// Reads script text from a file descriptor (on the board, the posix layer over FatFS)
+class CScriptFdReader : public CScriptReader {
+public:
+    CScriptFdReader(int fd) { this->fd = fd; }
+    virtual int read(char *buf, int len);
+protected:
+    int fd;
+};
+
+/// Reads script text from a file it opens, and closes again when it goes
+class CScriptFileReader : public CScriptFdReader {
+public:
+    CScriptFileReader(const std::string &filename); ///< Throws if the file can't be opened
+    virtual ~CScriptFileReader();
+};
+
 class CScriptLex
 {
 public:
     CScriptLex(const std::string &input);
+    CScriptLex(CScriptReader *reader); ///< Read text as it is needed - see release()
     CScriptLex(CScriptLex *owner, int startChar, int endChar);
     ~CScriptLex(void);
 
@@ -148,50 +208,218 @@ public:
     int tokenEnd; ///< Position in the data at the last character of the token we have here
     int tokenLastEnd; ///< Position in the data at the last character of the last token
     std::string tkStr; ///< Data contained in the token we have here
+    CScriptError *errors; ///< If set, match() records errors here and skips to the end rather than throwing
+    const void *source; ///< The string or reader the text is from (a sub-lexer's is its owner's), so a position identifies a place in it
 
     void match(int expected_tk); ///< Lexical match wotsit
     static std::string getTokenStr(int token); ///< Get the string representation of the given token
-    void reset(); ///< Reset this lex so we can start again
+    void reset(); ///< Reset this lex so we can start again (not for a streaming lex that has released text)
+    void skipToEnd(); ///< Stop returning tokens (LEX_EOF from now on)
+    void skipBlock(); ///< On a '{', skip to its matching '}' without making tokens of what's between
+    int peek(int n=1); ///< The type of the token n on from this one, without moving on
 
     std::string getSubString(int pos); ///< Return a sub-string from the given position up until right now
+    bool isSubString(int pos, const std::string &text); ///< Is getSubString(pos) the same as 'text'? Without making the copy
     CScriptLex *getSubLex(int lastPosition); ///< Return a sub-lexer from the given position up until right now
 
     std::string getPosition(int pos=-1); ///< Return a string representing the position in lines and columns of the character pos given
+    int getLine(int pos=-1); ///< Return the line number of the character pos given
+    void release(int pos); ///< Text before pos won't be needed again - a streaming lex drops it from its window
 
 protected:
     /* When we go into a loop, we use getSubLex to get a lexer for just the sub-part of the
        relevant string. This doesn't re-allocate and copy the string, but instead copies
-       the data pointer and sets dataOwned to false, and dataStart/dataEnd to the relevant things. */
+       the data pointer and sets dataOwned to false, and dataStart/dataEnd to the relevant things.
+       A streaming lex only holds a window of its text, starting at dataBase, that moves on as
+       text is released - so sub-lexers of it get a copy of their part instead. */
     char *data; ///< Data string to get tokens from
     int dataStart, dataEnd; ///< Start and end position in data string
     bool dataOwned; ///< Do we own this data string?
+    int dataBase; ///< Position of data[0] in the text
+    int dataSize; ///< Bytes allocated for data (when streaming)
+    int baseLine, baseCol; ///< Line and column of data[0]
+    CScriptReader *reader; ///< Where more text comes from, or 0 once it's all been read
+    bool streaming; ///< Is data a window over text from a reader?
 
     int dataPos; ///< Position in data (we CAN go past the end of the string here)
 
     void getNextCh();
     void getNextToken(); ///< Get the text token from our text string
+    void readMore(); ///< Append more text from the reader to the window
+    void getLineCol(int pos, int &line, int &col);
+    bool endsOperand(char last, int pos); ///< For skipBlock(): does the character 'last' at pos end an operand?
 };
 
 class CScriptVar;
+class CScriptProfiler;
 
 typedef void (*JSCallback)(CScriptVar *var, void *userdata);
+/** A native taking its arguments by position, so that calling it needs no
+ * symbol table. It returns the result (0 for undefined) and must not change
+ * the arguments - they may be the caller's variables. These are usually
+ * generated from a C function by TINYJS_BIND (TinyJS_Bind.h) */
+typedef CScriptVar *(*JSBoundCallback)(CScriptVar **args, void *userdata);
+
+#define TINYJS_BOUND_MAX_ARGS 4 ///< Most parameters a bound native can have
+
+#define TINYJS_SHAPE_MAX_SLOTS 32 ///< Objects with more properties than this use a plain list
+#define TINYJS_SHAPE_MAX_SHAPES 512 ///< Shapes that may exist at once
+#define TINYJS_SHAPE_INDEX_MIN 8 ///< Shapes with this many properties get a name->slot map
+#define TINYJS_SHAPE_SLOTS_MIN 4 ///< Slots allocated for an object's first property (a power of two)
+
+/* A shape describes the properties of an object - their names, and the
+   order they were added in, which gives each one a slot number. Objects
+   that get the same properties in the same order (all the objects made by
+   one constructor, say) share a shape, and so share the names and the
+   work of finding them. Shapes form a tree from an empty root, one branch
+   per property added.
+
+   An object with a shape keeps its links in the usual list, but also in
+   an array by slot, so finding a property is a lookup in the shared shape
+   and then a slot load. Objects that lose a property, have too many, or
+   are built in some other way drop back to just the list ('dictionary
+   mode') until they are emptied. Their links are still named by the
+   shape, so they keep it until then.
+
+   Shapes are referenced by the objects that have them and by the shapes
+   made from them, and go with the last reference - so objects used as
+   dictionaries, with keys no other object has, don't use up the shapes
+   that may exist for good. */
+class CScriptShape {
+public:
+    CScriptShape(CScriptShape *parent, const std::string &name);
+    ~CScriptShape();
+
+    CScriptShape *parent; ///< The shape before the last property was added
+    std::string name; ///< The name of the last property - links of objects with this shape share it
+    int slot; ///< The slot of the last property (-1 for the root)
+    int refs; ///< Objects with this shape, and shapes made from it
+
+    CScriptShape *ref() { refs++; return this; }
+    void unref(); ///< Remove a reference, and delete this shape (and then maybe its parent) with the last
+
+    int getSlot(const std::string &name); ///< The slot of the given property, or -1
+    CScriptShape *addProperty(const std::string &name); ///< The shape after adding the given property, or 0 if it can't have one. Reference it to keep it
+
+    static CScriptShape *getRoot(); ///< The shape of objects with no properties
+    static int count; ///< Shapes in existence
+
+protected:
+    std::vector<CScriptShape*> transitions; ///< Shapes made from this one by adding a property
+    std::vector<std::pair<std::string, int> > *index; ///< Sorted names of all properties, for big shapes
+};
+
+#define TINYJS_HASH_BUCKETS_MIN 8 ///< Buckets in the table of a Map or Set's first entry (a power of two)
+
+/* The entries of a Map or a Set. They are kept in the order they were
+   added (with holes where entries were deleted) and found through an
+   open-addressing table of entry numbers, so a lookup is a hash and a
+   probe or two. Numbers are keys by value - 1 and 1.0 are the same key -
+   strings by contents, and anything else by identity. Keys and values are
+   referenced, as children are. */
+class CScriptHash {
+public:
+    struct Entry {
+        CScriptVar *key; ///< 0 if the entry was deleted
+        CScriptVar *value; ///< 0 in a Set
+        unsigned int hash;
+    };
+
+    CScriptHash(bool keysOnly);
+    ~CScriptHash();
+
+    bool keysOnly; ///< This is a Set
+    int count; ///< Entries that haven't been deleted
+    int iterating; ///< While non-zero, entries stay where they are - so they can be walked by index as callbacks change the table
+    std::vector<Entry> entries; ///< In the order added - skip those with no key
+
+    Entry *find(CScriptVar *key); ///< The entry for 'key', or 0
+    void set(CScriptVar *key, CScriptVar *value); ///< Add an entry, or change the value of the one there
+    bool remove(CScriptVar *key); ///< Delete an entry. Returns false if there wasn't one
+    void clear();
+    CScriptHash *copy(bool deep); ///< A copy of the table, with copies of the values if 'deep'
+    size_t getMemoryUsage(); ///< Bytes the table takes
+
+    static unsigned int getHash(CScriptVar *key);
+    static bool sameKey(CScriptVar *a, CScriptVar *b);
+
+protected:
+    std::vector<int> buckets; ///< 1+the entry number, 0 if empty or -1 if its entry was deleted
+    int used; ///< Buckets that aren't empty, counting deleted ones
+
+    int findBucket(CScriptVar *key, unsigned int hash); ///< The bucket holding 'key', or -1
+    void resize(); ///< Drop deleted entries (unless iterating) and rebuild the buckets for what's left
+};
+
+#ifdef TINYJS_INTERN_STRINGS
+#define TINYJS_INTERN_MAX_STRING 32 ///< Longer strings aren't interned
+#define TINYJS_INTERN_BUCKETS_MIN 64 ///< Buckets in the table of interned strings (a power of two)
+
+/* Interned strings. A string value of up to TINYJS_INTERN_MAX_STRING bytes
+   is kept once, however many vars hold it: they point at a shared,
+   refcounted entry instead of each holding a copy - so records full of
+   "OK", "ERR" and channel names, however they were made, hold just one of
+   each. As the same contents are always the same entry, two interned
+   strings are equal exactly when they point at the same one. A var takes
+   its own copy again when getBytes() or an in-place '+' is going to change
+   it. Entries are found by contents through a chained hash table. */
+class CScriptStrings {
+public:
+    struct Entry {
+        std::string str;
+        unsigned int hash; ///< As CScriptHash::getHash gives for the string
+        int refs;
+        Entry *next; ///< Next in the same bucket
+    };
+
+    static Entry *intern(const std::string &str); ///< The entry for 'str', with a reference added - or 0 if it's too long
+    static Entry *ref(Entry *e) { e->refs++; refs++; return e; }
+    static void unref(Entry *e); ///< Remove a reference, freeing the entry with the last
+
+    static int count; ///< Entries there are
+    static int refs; ///< References to them
+    static size_t getMemoryUsage(); ///< Bytes the table and the entries take
+    static size_t getDuplicateBytes(); ///< Bytes of contents vars would hold again, each having a copy
+
+protected:
+    static std::vector<Entry*> buckets;
 
+    static void resize(); ///< Rebuild the buckets for the entries there are now
+};
+#endif
+
+/* A link's name refers to a string kept elsewhere. Links made by create()
+   have their own copy, in the same block just after the link. The links of
+   an object with a shape use the shape's copy, and temporary links all
+   share one blank name, so neither needs room for one. */
 class CScriptVarLink
 {
 public:
-  std::string name;
+  const std::string &name;
   CScriptVarLink *nextSibling;
   CScriptVarLink *prevSibling;
   CScriptVar *var;
   bool owned;
 
-  CScriptVarLink(CScriptVar *var, const std::string &name = TINYJS_TEMP_NAME);
-  CScriptVarLink(const CScriptVarLink &link); ///< Copy constructor
+  CScriptVarLink(CScriptVar *var); ///< A temporary link, with a blank name
+  CScriptVarLink(CScriptVar *var, const std::string *sharedName); ///< A link named by a string that must outlive it
+  CScriptVarLink(const CScriptVarLink &link); ///< Copy constructor - the copy is a temporary link
   ~CScriptVarLink();
+  static CScriptVarLink *create(CScriptVar *var, const std::string &name); ///< A link with its own copy of the name
+  // links with their own name are bigger, so they are never given a sized delete
+  static void *operator new(size_t size) { return ::operator new(size); }
+  static void *operator new(size_t, void *ptr) { return ptr; }
+  static void operator delete(void *ptr) { ::operator delete(ptr); }
+  static void operator delete(void *, void *) {}
   void replaceWith(CScriptVar *newVar); ///< Replace the Variable pointed to
   void replaceWith(CScriptVarLink *newVar); ///< Replace the Variable pointed to (just dereferences)
   int getIntName(); ///< Get the name as an integer (for arrays)
-  void setIntName(int n); ///< Set the name as an integer (for arrays)
+  void setIntName(int n); ///< Set the name as an integer (for arrays - whose links have their own names)
+
+protected:
+  bool ownsName; ///< The name is the link's own copy - see create()
+
+  CScriptVarLink &operator=(const CScriptVarLink &); ///< Not allowed
 };
 
 /// Variable class (containing a doubly-linked list of children)
@@ -232,6 +460,7 @@ public:
     void setString(const std::string &str);
     void setUndefined();
     void setArray();
+    std::string &getBytes(); ///< The storage of a string or buffer, for natives to fill in place without copying it - a string only if nothing else holds it
     bool equals(CScriptVar *v);
 
     bool isInt() { return (flags&SCRIPTVAR_INTEGER)!=0; }
@@ -242,11 +471,16 @@ public:
     bool isObject() { return (flags&SCRIPTVAR_OBJECT)!=0; }
     bool isArray() { return (flags&SCRIPTVAR_ARRAY)!=0; }
     bool isNative() { return (flags&SCRIPTVAR_NATIVE)!=0; }
+    bool isBound() { return (flags&SCRIPTVAR_BOUND)!=0; } ///< Is this a native taking its arguments by position?
+    bool isBuffer() { return (flags&SCRIPTVAR_BUFFER)!=0; }
     bool isUndefined() { return (flags & SCRIPTVAR_VARTYPEMASK) == SCRIPTVAR_UNDEFINED; }
     bool isNull() { return (flags & SCRIPTVAR_NULL)!=0; }
-    bool isBasic() { return firstChild==0; } ///< Is this *not* an array/object/etc
+    bool isBasic() { return firstChild==0 && !isBuffer(); } ///< Is this *not* an array/object/buffer/etc
+    bool isConstant() { return (flags&SCRIPTVAR_CONSTANT)!=0; } ///< Is this shared from the constant pool?
 
     CScriptVar *mathsOp(CScriptVar *b, int op); ///< do a maths op with another script variable
+    CScriptVar *tryMathsOp(CScriptVar *b, int op, const char **typeName); ///< as mathsOp, but returns 0 (and the datatype) if the op isn't supported
+    bool mathsOpInPlace(CScriptVar *b, int op); ///< do '+' or '-' by changing this value, if nothing else refers to it. Returns false if it couldn't
     void copyValue(CScriptVar *val); ///< copy the value from the value given
     CScriptVar *deepCopy(); ///< deep copy this node and return the result
 
@@ -257,6 +491,12 @@ public:
 
     CScriptVarLink *firstChild;
     CScriptVarLink *lastChild;
+    CScriptShape *shape; ///< Shape naming this object's children, or 0 - kept in dictionary mode while any link is named by it
+    CScriptHash *hash; ///< Entries of a Map or Set, or 0. Like children, they go when this does
+    static unsigned long linksRemoved; ///< Links removed from any var so far - unchanged, a for-in loop knows its link is still there
+#ifdef TINYJS_TRACE_ALLOC
+    unsigned long birth; ///< jsAllocTrace.now() when this was created
+#endif
 
     /// For memory management/garbage collection
     CScriptVar *ref(); ///< Add reference to this variable
@@ -266,19 +506,189 @@ protected:
     int refs; ///< The number of references held to this - used for garbage collection
 
     std::string data; ///< The contents of this variable if it is a string
-    long intData; ///< The contents of this variable if it is an int
-    double doubleData; ///< The contents of this variable if it is a double
+    long intData; ///< The contents of this variable if it is an int (for arrays, the cached length or -1)
+    union {
+      double doubleData; ///< The contents of this variable if it is a double
+#ifdef TINYJS_INTERN_STRINGS
+      CScriptStrings::Entry *interned; ///< If it's a string, where the contents are if interned (then 'data' is blank) - or 0. Sharing doubleData's room keeps vars as small
+#endif
+    };
     int flags; ///< the flags determine the type of the variable - int/double/string/etc
     JSCallback jsCallback; ///< Callback for native functions
-    void *jsCallbackUserData; ///< user data passed as second argument to native functions
+    union {
+      void *jsCallbackUserData; ///< user data passed as second argument to native functions
+      CScriptVar *scope; ///< For other functions, the scope of the module they were defined in, or 0 - see CTinyJS::moduleScope
+    };
+    CScriptVarLink **slots; ///< Links by slot number while the shape describes the children, else 0 (dictionary mode)
+
+    void dropShape(); ///< Go to dictionary mode - the shape is kept, as the links are still named by it
+    CScriptVar *getScope() { return isFunction() && !isNative() ? scope : 0; } ///< The scope a script function was defined in, if not the global one
 
     void init(); ///< initialisation of data members
+    void setStringData(const std::string &str); ///< Set the contents of a string - interning them if that's on
+    void dropStringData(); ///< Let go of a string's contents - before it becomes something else
 
     /** Copy the basic data and flags from the variable given, with no
       * children. Should be used internally only - by copyValue and deepCopy */
     void copySimpleData(CScriptVar *val);
 
     friend class CTinyJS;
+    friend class CScriptHash;
+};
+
+#ifdef TINYJS_CALL_STACK
+/* A function call in progress. Turning this into text means rescanning the
+   caller's source for line and column, so that's left until an error is
+   actually reported. */
+struct CScriptCallFrame {
+    CScriptVarLink *function; ///< The function being called
+    CScriptLex *lex; ///< Lexer of the caller - only valid while the call is in progress
+    int pos; ///< Position of the call in the caller's lexer
+    std::string text; ///< Filled in when an error leaves the call, before 'lex' goes away
+};
+#endif
+
+#define TINYJS_CONSTANT_POOL_SIZE 256 ///< Literals kept in the constant pool
+#define TINYJS_CONSTANT_MAX_STRING 64 ///< Longer strings aren't pooled
+#define TINYJS_FOLD_CACHE_SIZE 256 ///< Results of operations on constants that are kept
+
+/* Literals are parsed once into values in the constant pool, which all
+   evaluations of the literal then share. Nothing changes a constant: the
+   in-place operators see it is shared, and a property added to a
+   variable holding one gets a copy first.
+
+   There's no compile step to fold '1024*4' in, so the results of
+   operations on two constants are kept too, keyed by operands and
+   operator - running the expression again just looks the result up. */
+struct CScriptFoldKey {
+    CScriptVar *a, *b;
+    int op;
+    bool operator<(const CScriptFoldKey &k) const {
+        if (a!=k.a) return a<k.a;
+        if (b!=k.b) return b<k.b;
+        return op<k.op;
+    }
+};
+
+#define TINYJS_SWITCH_CACHE_SIZE 32 ///< Switch statements whose cases are kept
+#define TINYJS_SWITCH_DENSITY 4 ///< Integer cases use a jump table if it has at most this many entries per case
+
+/* A switch whose case labels are all literals is scanned once into tables
+   from label to the offset of that case's statements, so picking the case
+   is a lookup however many cases there are: integers close enough together
+   index a jump table, and other labels are hashed. Switches are found
+   again by where their body starts in the text being lexed: a function's
+   body is lexed afresh at each call, but from the same string. As that
+   string may have been freed and its place reused since, the body's text
+   is compared too - but only with the one switch found there. */
+struct CScriptSwitch {
+    struct Case {
+        std::string label; ///< A string label
+        int value; ///< An integer label
+        bool isString;
+        unsigned int hash;
+        int pos; ///< Offset of its statements from the start of the body
+    };
+    bool constant; ///< All the labels are literals, so the tables are complete
+    int defaultPos; ///< Offset of the statements after 'default:', or -1
+    int jumpMin; ///< The integer label jumps[0] is for
+    std::vector<int> jumps; ///< Offset for each integer label from jumpMin, or -1 - if they are dense enough
+    std::vector<Case> cases; ///< The labels that aren't in 'jumps'
+    std::vector<int> buckets; ///< Index in 'cases' by hash (open addressing), or -1
+    std::string body; ///< The text it was scanned from, from after the '{' to the '}'
+
+    void add(const std::string &label, int value, bool isString, int pos);
+    void build(); ///< Make the jump table and the buckets once all the labels are there
+    int find(CScriptVar *value); ///< Offset of the case 'value' matches, or of default, or -1
+};
+
+/// Where the body of a switch starts: the text it's in (see CScriptLex::source) and the position in it
+struct CScriptSwitchKey {
+    const void *source;
+    int start;
+    bool operator<(const CScriptSwitchKey &k) const {
+        if (source!=k.source) return source<k.source;
+        return start<k.start;
+    }
+};
+
+#ifndef TINYJS_MEMORY_QUOTA
+#ifdef __linux__
+#define TINYJS_MEMORY_QUOTA 0 ///< Default heap quota of an interpreter in bytes, 0 for none
+#else
+#define TINYJS_MEMORY_QUOTA (48*1024)
+#endif
+#endif
+
+#ifndef TINYJS_STACK_LIMIT
+#ifdef __linux__
+#define TINYJS_STACK_LIMIT (4*1024*1024) ///< Default C stack the calls may use in bytes, 0 for no limit
+#else
+#define TINYJS_STACK_LIMIT (24*1024) // of the shell's 32k
+#endif
+#endif
+
+#ifndef TINYJS_CALL_LIMIT
+#ifdef __linux__
+#define TINYJS_CALL_LIMIT 10000 ///< Default deepest nesting of JS calls, 0 for no limit
+#else
+/* The smallest JS call - a plain recursive function - takes 823 bytes of
+   stack at -Os (Memory.usage().stackPerCall), and statements or brackets
+   nested inside it only add to that, so no script gets deeper than this
+   before the stack limit stops it anyway. */
+#define TINYJS_CALL_LIMIT (TINYJS_STACK_LIMIT / 823)
+#endif
+#endif
+
+/* Heap used by an interpreter. operator new and delete (TinyJS_Memory.cpp)
+   add every block to the interpreter that is running or being set up, so
+   vars, links, strings and lexer buffers all count. The quota is checked at
+   each statement: over it, the interpreter first drops its caches, and if
+   that isn't enough and the heap is still growing, it stops the script with
+   an error. That happens long before the shared heap runs out under FatFS
+   and lwIP. A native can't go over the quota at all - a block that would
+   is refused, and the script stops with the same error - so a single call
+   like Buffer.alloc() can't take the heap in one go.
+
+   The C stack is watched at each JS call, statement and expression, from
+   the outermost script or call down: calls nested deeper than the call
+   limit, or going past the stack limit, stop the script with an error
+   rather than overflowing the thread. */
+class CScriptMemory {
+public:
+    CScriptMemory() : used(0), peak(0), checked(0), quota(defaultQuota), allocations(0),
+                      inNative(false), calls(0), callPeak(0), callLimit(TINYJS_CALL_LIMIT),
+                      stackBase(0), stackPeak(0), stackLimit(TINYJS_STACK_LIMIT) {}
+
+    size_t used; ///< Bytes allocated now
+    size_t peak; ///< Most bytes allocated at once
+    size_t checked; ///< 'used' at the last quota check
+    size_t quota; ///< Most bytes the interpreter may use, 0 for no limit
+    unsigned long allocations; ///< Blocks allocated so far
+    bool inNative; ///< A native is running, so blocks that would go over the quota are refused
+    int calls; ///< JS calls in progress
+    int callPeak; ///< Most JS calls in progress at once
+    int callLimit; ///< Most JS calls that may be in progress, 0 for no limit
+    char *stackBase; ///< C stack at the outermost script or call in progress, 0 if none
+    size_t stackPeak; ///< Most C stack used below the outermost script or call
+    size_t stackLimit; ///< Most C stack the script may use, 0 for no limit
+
+    void allocated(size_t size) { used += size; if (used>peak) peak = used; allocations++; }
+    void freed(size_t size) { used = size<used ? used-size : 0; } // blocks from before the interpreter may be freed too
+    bool refuses(size_t size) const { return inNative && quota && used+size>quota; }
+
+    static CScriptMemory *current; ///< Where operator new/delete account blocks, or 0
+    static size_t defaultQuota; ///< Quota of interpreters created from now on
+    static size_t lastPeak; ///< Peak of the last interpreter deleted
+};
+
+/// Accounts the heap to 'memory' for as long as it exists, then to whatever it was before
+class CScriptMemoryScope {
+public:
+    CScriptMemoryScope(CScriptMemory *memory) : outside(CScriptMemory::current) { CScriptMemory::current = memory; }
+    ~CScriptMemoryScope() { CScriptMemory::current = outside; }
+private:
+    CScriptMemory *outside;
 };
 
 class CTinyJS {
@@ -286,7 +696,19 @@ public:
     CTinyJS();
     ~CTinyJS();
 
-    void execute(const std::string &code);
+    /** Execute the given code. If 'scope' is given, it is used as the innermost
+     * scope (above root) so 'var' and function declarations end up in it */
+    void execute(const std::string &code, CScriptVar *scope = 0);
+    /** As execute, but returns false on error instead of throwing. The
+     * error text (without call stack) is then available from getError() */
+    bool run(const std::string &code, CScriptVar *scope = 0);
+    /** Execute code as it is read. Each top-level statement runs as soon as
+     * it has been read, and is then dropped - so only the statement being run
+     * and the bodies of the functions defined so far are kept in memory */
+    void execute(CScriptReader *reader, CScriptVar *scope = 0);
+    bool run(CScriptReader *reader, CScriptVar *scope = 0);
+    /// The last error reported by run() or execute()
+    const char *getError() { return error.text; }
     /** Evaluate the given code and return a link to a javascript object,
      * useful for (dangerous) JSON parsing. If nothing to return, will return
      * 'undefined' variable type. CScriptVarLink is returned as this will
@@ -312,9 +734,12 @@ public:
        \endcode
     */
     void addNative(const std::string &funcDesc, JSCallback ptr, void *userdata);
+    /// As addNative, for a native taking its arguments by position - see TinyJS_Bind.h
+    void addBound(const std::string &funcDesc, JSBoundCallback ptr, void *userdata);
 
     /// Get the given variable specified by a path (var1.var2.etc), or return 0
     CScriptVar *getScriptVariable(const std::string &path);
+    CScriptVarLink *getScriptVariableLink(const std::string &path);
     /// Get the value of the given variable, or return 0
     const std::string *getVariable(const std::string &path);
     /// set the value of the given variable, return trur if it exists and gets set
@@ -322,33 +747,86 @@ public:
 
     /// Send all variables to stdout
     void trace();
+    /// Drop the constant pool and folded results, freeing whatever isn't in use
+    void collect();
+
+    /** Call a JS (or native) function from a native, with the given 'this' (or 0)
+     * and arguments. Returns a link to the result, which must be deleted, or 0 if
+     * the function failed - the native should then just return, so the error
+     * reaches the script. Outside of execute(), errors are thrown instead. */
+    CScriptVarLink *callFunction(CScriptVar *function, CScriptVar *thisObj, CScriptVar **args, int argCount);
 
     CScriptVar *root;   /// root of symbol table
+    CScriptProfiler *profiler; /// profiler sampling this interpreter, or 0
+    CScriptMemory memory; /// heap used by this interpreter
 private:
     CScriptLex *l;             /// current lexer
     std::vector<CScriptVar*> scopes; /// stack of scopes when parsing
+    CScriptError error; /// error raised while parsing, if any
+    bool resultUnused; /// the statement being parsed throws its value away (so 'i++' needn't keep the old one)
 #ifdef TINYJS_CALL_STACK
-    std::vector<std::string> call_stack; /// Names of places called so we can show when erroring
+    std::vector<CScriptCallFrame> call_stack; /// Places called so we can show when erroring
+    std::string getCallFrameText(CScriptCallFrame &frame);
 #endif
 
     CScriptVar *stringClass; /// Built in string class
     CScriptVar *objectClass; /// Built in object class
     CScriptVar *arrayClass; /// Built in array class
+    CScriptVar *bufferClass; /// Built in buffer class
+
+    bool executeCode(CScriptLex *lex, CScriptVar *scope, std::string *report);
+    std::string getErrorReport(size_t callDepth);
+    CScriptVar *mathsOp(bool &execute, CScriptVar *a, CScriptVar *b, int op);
+
+    std::map<std::string, CScriptVar*> numberConstants; /// Constant pool - numeric literals by their text
+    std::map<std::string, CScriptVar*> stringConstants; /// Constant pool - string literals
+    std::map<CScriptFoldKey, CScriptVar*> folds; /// Results of operations on constants
+    std::map<CScriptSwitchKey, CScriptSwitch*> switches; /// Compiled switch statements, by where their body is
+    int jumping; /// LEX_R_BREAK or LEX_R_CONTINUE while the statements it leaves are skipped, else 0
+    int breakable; /// Loops and switches the statement is in, in this function
+    int continuable; /// Loops the statement is in, in this function
+    /** Scope given to execute() for the code being run (a module's), or 0.
+     * Functions defined in it are run with it in their scope chain, so they
+     * can still see its functions and variables once it has finished - it's
+     * kept in moduleScopes until the interpreter goes */
+    CScriptVar *moduleScope;
+    std::vector<CScriptVar*> moduleScopes; /// Scopes functions were defined in, referenced
+    CScriptVar *getConstant(int tk, const std::string &text); ///< The value of a literal token, shared if possible
+    CScriptVar *defineNative(const std::string &funcDesc, JSCallback ptr, void *userdata); ///< Add a native function, returning it
 
     // parsing - in order of precedence
     CScriptVarLink *functionCall(bool &execute, CScriptVarLink *function, CScriptVar *parent);
+    CScriptVarLink *runFunction(bool &execute, CScriptVarLink *function, CScriptVar *functionRoot);
+    bool outOfStack(bool &execute); ///< Whether the C stack has gone past the limit, which stops the script
+    void outOfMemory(); ///< Stop the script, as the heap is over the quota or a block was refused
     CScriptVarLink *factor(bool &execute);
     CScriptVarLink *unary(bool &execute);
-    CScriptVarLink *term(bool &execute);
-    CScriptVarLink *expression(bool &execute);
-    CScriptVarLink *shift(bool &execute);
-    CScriptVarLink *condition(bool &execute);
-    CScriptVarLink *logic(bool &execute);
+    CScriptVarLink *binary(bool &execute, int minPrecedence); ///< Binary operators binding at least as tightly as minPrecedence
     CScriptVarLink *ternary(bool &execute);
     CScriptVarLink *base(bool &execute);
     void block(bool &execute);
     void statement(bool &execute);
-    // parsing utility functions
+    // parsing utility functions - the branches of the above that are kept out of line
+    CScriptVarLink *objectLiteral(bool &execute);
+    CScriptVarLink *arrayLiteral(bool &execute);
+    CScriptVarLink *newObject(bool &execute);
+    CScriptVarLink *memberAccess(bool &execute, CScriptVarLink *a, CScriptVar *&parent, CScriptVarLink *&temp);
+    CScriptVarLink *prefixOp(bool &execute, CScriptVarLink *a, int op);
+    CScriptVarLink *postfixOp(bool &execute, CScriptVarLink *a, int op, bool unused);
+    CScriptVarLink *binaryOp(bool &execute, CScriptVarLink *a, CScriptVarLink *b, int op);
+    CScriptVarLink *boundCall(bool &execute, CScriptVarLink *function, CScriptVar *parent);
+    void callBoundByName(CScriptVar *function, CScriptVar *functionRoot);
+    void callNative(CScriptVar *function, CScriptVar *functionRoot);
+    void varStatement(bool &execute);
+    void whileStatement(bool &execute);
+    void forStatement(bool &execute);
+    void forInStatement(bool &execute);
+    void switchStatement(bool &execute);
+    void jumpStatement(bool &execute); ///< 'break' or 'continue'
+    CScriptSwitch *compileSwitch(int start, int end); ///< Scan the body of a switch for its case labels
+    int findCase(bool &execute, CScriptVar *value, int start, int end); ///< Try the case labels of a switch in turn
+    void runCases(bool &execute, int start, int end); ///< Run the statements of a switch from one case on
+    bool loopJump(bool &execute); ///< After a loop's body - false if it did 'break'
     CScriptVarLink *parseFunctionDefinition();
     void parseFunctionArguments(CScriptVar *funcVar);
 
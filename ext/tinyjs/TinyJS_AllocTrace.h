@@ -0,0 +1,84 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Allocation tracing
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_ALLOCTRACE_H
+#define TINYJS_ALLOCTRACE_H
+
+#include "TinyJS.h"
+
+/* Only built with TINYJS_TRACE_ALLOC defined (make TRACE_ALLOC=1). Without it
+   the hooks in the interpreter and in operator new aren't compiled at all.
+
+   Every block from operator new is counted against a site: the line of the
+   statement being run, in the JS function running it (lines of functions
+   are relative to the start of the function body, as for the profiler), or
+   the native running. Vars are stamped with the allocation count when they
+   are created, so their lifetimes - in allocations - go into a histogram per
+   type when they are freed. The heap dump walks everything reachable from
+   each global and reports the size only reachable from it. */
+
+#ifdef TINYJS_TRACE_ALLOC
+
+#include <map>
+
+#define TINYJS_TRACE_LIFETIME_BUCKETS 24 ///< Powers of two
+#define TINYJS_TRACE_TYPES 6
+
+class CScriptAllocTrace {
+public:
+    CScriptAllocTrace();
+    ~CScriptAllocTrace();
+
+    void reset(); ///< Forget sites and lifetimes recorded so far
+
+    void enter(const std::string &function, bool native); ///< A function has been called
+    void leave(); ///< The last function called has returned
+    void statement(CScriptLex *lex); ///< A statement starts at lex's current token
+    void forget(CScriptLex *lex); ///< The lexer is being deleted
+    void allocated(size_t size); ///< operator new handed out a block
+    unsigned long now() { return clock; } ///< Allocations so far, the clock for lifetimes
+    void died(CScriptVar *var); ///< A var is being deleted
+
+    void dumpSites(); ///< Print bytes and blocks allocated per site
+    void dumpLifetimes(); ///< Print the lifetime histogram of each type of var
+    void dumpHeap(CScriptVar *root); ///< Print the size retained by each child of root
+
+protected:
+    struct Frame {
+        std::string function;
+        bool native;
+        CScriptLex *lex; ///< Lexer of the current statement, or 0 before the first
+        int pos;
+    };
+    struct Site {
+        std::string name;
+        unsigned long blocks;
+        unsigned long bytes;
+    };
+
+    bool running; ///< False until constructed - operator new is used before that
+    bool busy; ///< Set while the tracer allocates for itself
+    unsigned long clock;
+    int site; ///< Index of the current site, or -1 if not looked up yet
+    std::vector<Frame> stack;
+    std::vector<Site> sites;
+    std::map<std::string, int> siteIndex; ///< Site name -> index in sites
+    std::map<std::pair<CScriptLex*, int>, int> lexSites; ///< Statement -> site, so lines are only counted once
+    unsigned long lifetimes[TINYJS_TRACE_TYPES][TINYJS_TRACE_LIFETIME_BUCKETS];
+
+    int findSite();
+};
+
+/// The tracer the interpreter and operator new report to
+extern CScriptAllocTrace jsAllocTrace;
+
+#endif
+
+#endif
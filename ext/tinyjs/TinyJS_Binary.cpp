@@ -0,0 +1,331 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Binary data: DataView and struct
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_Binary.h"
+#include "TinyJS_Bind.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace std;
+
+// ----------------------------------------------- Numbers <-> bytes
+
+static bool isLittleEndian() {
+    unsigned short one = 1;
+    return *(unsigned char *)&one == 1;
+}
+
+/// Bytes a field of this type takes (0 if it isn't one)
+static int getFieldSize(char type) {
+    switch (type) {
+        case 'x': case 'b': case 'B': case 's': return 1;
+        case 'h': case 'H': return 2;
+        case 'i': case 'I': case 'l': case 'L': case 'f': return 4;
+        case 'd': return 8;
+    }
+    return 0;
+}
+
+static unsigned long long loadBits(const unsigned char *p, int size, bool little) {
+    unsigned long long bits = 0;
+    for (int i=0;i<size;i++)
+        bits = (bits<<8) | p[little ? size-1-i : i];
+    return bits;
+}
+
+static void storeBits(unsigned char *p, int size, bool little, unsigned long long bits) {
+    for (int i=0;i<size;i++) {
+        p[little ? i : size-1-i] = (unsigned char)bits;
+        bits >>= 8;
+    }
+}
+
+/// A new var for the number of the given type at 'p'
+static CScriptVar *loadValue(const unsigned char *p, char type, bool little) {
+    unsigned long long bits = loadBits(p, getFieldSize(type), little);
+    switch (type) {
+        case 'b': return new CScriptVar((int)(signed char)bits);
+        case 'h': return new CScriptVar((int)(short)bits);
+        case 'i': case 'l': return new CScriptVar((int)(unsigned int)bits);
+        case 'I': case 'L':
+            // too big for an int, so it has to be a double
+            if (bits > 0x7FFFFFFF) return new CScriptVar((double)bits);
+            return new CScriptVar((int)bits);
+        case 'f': {
+            unsigned int i = (unsigned int)bits;
+            float f;
+            memcpy(&f, &i, sizeof(f));
+            return new CScriptVar((double)f);
+        }
+        case 'd': {
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return new CScriptVar(d);
+        }
+    }
+    return new CScriptVar((int)bits); // B, H
+}
+
+/// Store 'value' (0 if there's none) as the given type at 'p'. Integers wrap, as in JS
+static void storeValue(unsigned char *p, char type, bool little, CScriptVar *value) {
+    unsigned long long bits = 0;
+    if (type=='f') {
+        float f = value ? (float)value->getDouble() : 0;
+        unsigned int i;
+        memcpy(&i, &f, sizeof(i));
+        bits = i;
+    } else if (type=='d') {
+        double d = value ? value->getDouble() : 0;
+        memcpy(&bits, &d, sizeof(bits));
+    } else if (value && value->isInt()) {
+        bits = (unsigned long long)(long long)value->getInt();
+    } else if (value) {
+        double d = value->getDouble();
+        if (d==d) bits = (unsigned long long)(long long)d; // NaN is 0
+    }
+    storeBits(p, getFieldSize(type), little, bits);
+}
+
+// ----------------------------------------------- DataView
+
+static CScriptVar *getViewBuffer(CScriptVar *view) {
+    CScriptVarLink *buffer = view->findChild("buffer");
+    if (!buffer || !buffer->var->isBuffer())
+        throw new CScriptException("Not a DataView");
+    return buffer->var;
+}
+
+/// Where 'size' bytes at 'offset' in the view start in its buffer's bytes - or throw
+static size_t getViewIndex(CScriptVar *view, const string &bytes, int offset, int size) {
+    CScriptVarLink *start = view->findChild("byteOffset");
+    CScriptVarLink *length = view->findChild("byteLength");
+    int byteOffset = start ? start->var->getInt() : 0;
+    int byteLength = length ? length->var->getInt() : (int)bytes.size()-byteOffset;
+    // the view's fields are only script vars, so check it still fits the buffer
+    if (byteOffset<0 || byteLength<0 || byteOffset > (int)bytes.size()-byteLength ||
+        offset<0 || offset > byteLength-size)
+        throw new CScriptException("Offset is outside the bounds of the DataView");
+    return byteOffset + offset;
+}
+
+static CScriptVar *viewGet(CScriptVar *view, int offset, bool little, char type) {
+    const string &bytes = getViewBuffer(view)->getString();
+    size_t i = getViewIndex(view, bytes, offset, getFieldSize(type));
+    return loadValue((const unsigned char *)bytes.data()+i, type, little);
+}
+
+static void viewSet(CScriptVar *view, int offset, CScriptVar *value, bool little, char type) {
+    string &bytes = getViewBuffer(view)->getBytes();
+    size_t i = getViewIndex(view, bytes, offset, getFieldSize(type));
+    storeValue((unsigned char *)&bytes[i], type, little, value);
+}
+
+// ----------------------------------------------- struct formats
+
+/// A compiled struct format
+struct CScriptStructFormat {
+    struct Field {
+        char type;
+        int count; ///< Repeats - or for 's', the length of the string
+    };
+    string format;
+    bool little;
+    int size; ///< Bytes it takes
+    vector<Field> fields;
+};
+
+static void compileFormat(CScriptStructFormat *f, const string &format) {
+    f->format = format;
+    f->little = false;
+    f->size = 0;
+    size_t i = 0;
+    if (i<format.size()) {
+        char c = format[i];
+        if (c=='<') f->little = true;
+        else if (c=='=' || c=='@') f->little = isLittleEndian();
+        if (c=='<' || c=='>' || c=='!' || c=='=' || c=='@') i++;
+    }
+    while (i<format.size()) {
+        char c = format[i];
+        if (c==' ') { i++; continue; }
+        CScriptStructFormat::Field field;
+        field.count = 1;
+        if (c>='0' && c<='9') {
+            field.count = 0;
+            while (i<format.size() && format[i]>='0' && format[i]<='9' && field.count<65536)
+                field.count = field.count*10 + format[i++]-'0';
+        }
+        field.type = i<format.size() ? format[i++] : 0;
+        int size = getFieldSize(field.type);
+        if (!size || field.count>=65536)
+            throw new CScriptException("Bad struct format '"+format+"'");
+        f->size += size*field.count;
+        if (field.count) f->fields.push_back(field);
+    }
+}
+
+/* Compiled like RegExps are (see TinyJS_RegExp.cpp), and looked up by the
+   format - a protocol usually has just a few, so the one wanted is found
+   after a compare or two. The oldest is dropped when it's full, so a
+   format found is only good until the next is looked up. */
+static vector<CScriptStructFormat> structCache;
+
+static CScriptStructFormat *getFormat(const string &format) {
+    for (size_t i=0;i<structCache.size();i++)
+        if (structCache[i].format == format) return &structCache[i];
+    CScriptStructFormat f;
+    compileFormat(&f, format);
+    if (structCache.size() >= TINYJS_STRUCT_CACHE)
+        structCache.erase(structCache.begin());
+    structCache.push_back(f);
+    return &structCache.back();
+}
+
+/// Write the items of the array 'values' at 'p', as the format says
+static void packValues(CScriptStructFormat *f, unsigned char *p, CScriptVar *values) {
+    int n = 0;
+    for (size_t i=0;i<f->fields.size();i++) {
+        const CScriptStructFormat::Field &field = f->fields[i];
+        int count = field.type=='s' ? 1 : field.count;
+        for (int j=0;j<count;j++) {
+            CScriptVar *value = 0;
+            if (field.type!='x') {
+                char idx[16];
+                sprintf(idx, "%d", n++);
+                CScriptVarLink *link = values->findChild(idx);
+                if (link) value = link->var;
+            }
+            if (field.type=='x') {
+                *p++ = 0;
+            } else if (field.type=='s') {
+                // cut short or padded with zeros
+                size_t len = 0;
+                if (value) {
+                    const string &s = value->getString();
+                    len = s.size()<(size_t)field.count ? s.size() : field.count;
+                    memcpy(p, s.data(), len);
+                }
+                memset(p+len, 0, field.count-len);
+                p += field.count;
+            } else {
+                storeValue(p, field.type, f->little, value);
+                p += getFieldSize(field.type);
+            }
+        }
+    }
+}
+
+// ----------------------------------------------- Actual Functions
+void scDataViewConstructor(CScriptVar *c, void *) {
+    CScriptVar *view = c->getParameter("this");
+    CScriptVar *buffer = c->getParameter("buffer");
+    if (!buffer->isBuffer())
+        throw new CScriptException("DataView needs a Buffer");
+    int size = (int)buffer->getString().size();
+    CScriptVar *offsetVar = c->getParameter("byteOffset");
+    CScriptVar *lengthVar = c->getParameter("byteLength");
+    int byteOffset = offsetVar->isUndefined() ? 0 : offsetVar->getInt();
+    if (byteOffset<0 || byteOffset>size)
+        throw new CScriptException("Start offset is outside the bounds of the buffer");
+    int byteLength = lengthVar->isUndefined() ? size-byteOffset : lengthVar->getInt();
+    if (byteLength<0 || byteLength>size-byteOffset)
+        throw new CScriptException("Invalid DataView length");
+    view->addChildNoDup("buffer", buffer);
+    view->addChildNoDup("byteOffset", new CScriptVar(byteOffset));
+    view->addChildNoDup("byteLength", new CScriptVar(byteLength));
+}
+
+#define TINYJS_VIEW_ACCESSORS(NAME, TYPE) \
+    CScriptVar *viewGet##NAME(CScriptVar *view, int offset, bool littleEndian) { \
+        return viewGet(view, offset, littleEndian, TYPE); \
+    } \
+    void viewSet##NAME(CScriptVar *view, int offset, CScriptVar *value, bool littleEndian) { \
+        viewSet(view, offset, value, littleEndian, TYPE); \
+    }
+
+TINYJS_VIEW_ACCESSORS(Int8, 'b')
+TINYJS_VIEW_ACCESSORS(Uint8, 'B')
+TINYJS_VIEW_ACCESSORS(Int16, 'h')
+TINYJS_VIEW_ACCESSORS(Uint16, 'H')
+TINYJS_VIEW_ACCESSORS(Int32, 'i')
+TINYJS_VIEW_ACCESSORS(Uint32, 'I')
+TINYJS_VIEW_ACCESSORS(Float32, 'f')
+TINYJS_VIEW_ACCESSORS(Float64, 'd')
+
+CScriptVar *structPack(const string &format, CScriptVar *values) {
+    CScriptStructFormat *f = getFormat(format);
+    CScriptVar *buffer = new CScriptVar(string(f->size, '\0'), SCRIPTVAR_BUFFER);
+    if (f->size) packValues(f, (unsigned char *)&buffer->getBytes()[0], values);
+    return buffer;
+}
+
+void structPackInto(const string &format, CScriptVar *buffer, int offset, CScriptVar *values) {
+    CScriptStructFormat *f = getFormat(format);
+    if (!buffer->isBuffer())
+        throw new CScriptException("struct.packInto needs a Buffer");
+    string &bytes = buffer->getBytes();
+    if (offset<0 || offset > (int)bytes.size()-f->size)
+        throw new CScriptException("struct.packInto would write past the end of the buffer");
+    if (f->size) packValues(f, (unsigned char *)&bytes[offset], values);
+}
+
+CScriptVar *structUnpack(const string &format, CScriptVar *data, int offset) {
+    CScriptStructFormat *f = getFormat(format);
+    const string &bytes = data->getString();
+    if (offset<0 || offset > (int)bytes.size()-f->size)
+        throw new CScriptException("struct.unpack would read past the end of the data");
+    const unsigned char *p = (const unsigned char *)bytes.data()+offset;
+    CScriptVar *result = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_ARRAY);
+    int n = 0;
+    for (size_t i=0;i<f->fields.size();i++) {
+        const CScriptStructFormat::Field &field = f->fields[i];
+        if (field.type=='x') {
+            p += field.count;
+        } else if (field.type=='s') {
+            result->setArrayIndex(n++, new CScriptVar(string((const char *)p, field.count)));
+            p += field.count;
+        } else {
+            for (int j=0;j<field.count;j++) {
+                result->setArrayIndex(n++, loadValue(p, field.type, f->little));
+                p += getFieldSize(field.type);
+            }
+        }
+    }
+    return result;
+}
+
+int structSize(const string &format) {
+    return getFormat(format)->size;
+}
+
+// ----------------------------------------------- Register Functions
+void registerBinaryFunctions(CTinyJS *tinyJS) {
+    tinyJS->addNative("function DataView.constructor(buffer, byteOffset, byteLength)", scDataViewConstructor, 0);
+    tinyJS->addBound("function DataView.getInt8(this, offset, littleEndian)", TINYJS_BIND(viewGetInt8), 0);
+    tinyJS->addBound("function DataView.getUint8(this, offset, littleEndian)", TINYJS_BIND(viewGetUint8), 0);
+    tinyJS->addBound("function DataView.getInt16(this, offset, littleEndian)", TINYJS_BIND(viewGetInt16), 0);
+    tinyJS->addBound("function DataView.getUint16(this, offset, littleEndian)", TINYJS_BIND(viewGetUint16), 0);
+    tinyJS->addBound("function DataView.getInt32(this, offset, littleEndian)", TINYJS_BIND(viewGetInt32), 0);
+    tinyJS->addBound("function DataView.getUint32(this, offset, littleEndian)", TINYJS_BIND(viewGetUint32), 0);
+    tinyJS->addBound("function DataView.getFloat32(this, offset, littleEndian)", TINYJS_BIND(viewGetFloat32), 0);
+    tinyJS->addBound("function DataView.getFloat64(this, offset, littleEndian)", TINYJS_BIND(viewGetFloat64), 0);
+    tinyJS->addBound("function DataView.setInt8(this, offset, value, littleEndian)", TINYJS_BIND(viewSetInt8), 0);
+    tinyJS->addBound("function DataView.setUint8(this, offset, value, littleEndian)", TINYJS_BIND(viewSetUint8), 0);
+    tinyJS->addBound("function DataView.setInt16(this, offset, value, littleEndian)", TINYJS_BIND(viewSetInt16), 0);
+    tinyJS->addBound("function DataView.setUint16(this, offset, value, littleEndian)", TINYJS_BIND(viewSetUint16), 0);
+    tinyJS->addBound("function DataView.setInt32(this, offset, value, littleEndian)", TINYJS_BIND(viewSetInt32), 0);
+    tinyJS->addBound("function DataView.setUint32(this, offset, value, littleEndian)", TINYJS_BIND(viewSetUint32), 0);
+    tinyJS->addBound("function DataView.setFloat32(this, offset, value, littleEndian)", TINYJS_BIND(viewSetFloat32), 0);
+    tinyJS->addBound("function DataView.setFloat64(this, offset, value, littleEndian)", TINYJS_BIND(viewSetFloat64), 0);
+    tinyJS->addBound("function struct.pack(format, values)", TINYJS_BIND(structPack), 0); // a new Buffer
+    tinyJS->addBound("function struct.packInto(format, buffer, offset, values)", TINYJS_BIND(structPackInto), 0);
+    tinyJS->addBound("function struct.unpack(format, data, offset)", TINYJS_BIND(structUnpack), 0); // an array
+    tinyJS->addBound("function struct.size(format)", TINYJS_BIND(structSize), 0);
+}
@@ -0,0 +1,49 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Binary data: DataView and struct
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_BINARY_H
+#define TINYJS_BINARY_H
+
+#include "TinyJS.h"
+
+/* Numbers read from and written to the bytes of a Buffer (see TinyJS.h),
+   for taking apart CAN frames, Modbus registers and UART packets without
+   a call per byte. Every method is a bound native (see TinyJS_Bind.h), so
+   a read costs one call and the number it returns.
+
+     new DataView(buffer, byteOffset, byteLength) - a view of part of a
+         Buffer (by default all of it). view.buffer, view.byteOffset and
+         view.byteLength are as given
+     view.getInt8/Uint8/Int16/Uint16/Int32/Uint32/Float32/Float64(offset, littleEndian)
+     view.setInt8/.../Float64(offset, value, littleEndian)
+         - big endian unless littleEndian is true, as in JS. Going outside
+           the view throws
+
+   struct works as Python's module does, on Buffers and strings:
+
+     struct.pack(format, values) - a new Buffer holding the array 'values'
+     struct.packInto(format, buffer, offset, values) - the same, written into a Buffer
+     struct.unpack(format, data, offset) - an array of the values
+     struct.size(format) - the bytes the format takes
+
+   A format is an optional byte order - '<' little, '>' or '!' big (the
+   default), '=' or '@' this machine's - then fields, each an optional
+   count and one of
+     x pad byte, b/B 8 bit, h/H 16 bit, i/I/l/L 32 bit (upper case is
+     unsigned), f float, d double, s a string of 'count' bytes
+   with no alignment, so "<BxH4s" is 8 bytes. Formats are compiled the
+   first time they're seen, and the last TINYJS_STRUCT_CACHE kept. */
+
+#define TINYJS_STRUCT_CACHE 8 ///< Compiled struct formats kept around
+
+/// Register DataView and struct
+extern void registerBinaryFunctions(CTinyJS *tinyJS);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Binding C functions as natives
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_BIND_H
+#define TINYJS_BIND_H
+
+#include "TinyJS.h"
+
+/* TINYJS_BIND(f) is a JSBoundCallback for the C function f, generated at
+   compile time: it converts each argument to f's parameter type, calls f
+   and boxes what it returns. So
+
+       int gpioRead(int port, int pad);
+       tinyJS->addBound("function gpio.read(port, pad)", TINYJS_BIND(gpioRead), 0);
+
+   makes gpio.read(3, 12) cost the evaluation of its arguments, the call
+   and one var for the result - there's no symbol table for the call, and
+   no parameter is looked up by name.
+
+   Parameters may be any integer type, bool, float, double, std::string,
+   const char * (valid during the call) or CScriptVar * (not to be
+   changed). Results may be void, any of the numeric types, std::string,
+   const char * or a new CScriptVar *. Functions taking pointers to
+   drivers or ports - or that are macros, like palSetPad - need a small
+   wrapper taking numbers instead. Before C++11 a function can only be a
+   template argument if it has external linkage, so the wrappers can't be
+   static. Errors are thrown as for any native.
+
+   A method can have the object it was called on as well: name the first
+   parameter 'this', and it's passed as the first argument -
+
+       double viewGetFloat32(CScriptVar *view, int offset, bool littleEndian);
+       tinyJS->addBound("function DataView.getFloat32(this, offset, littleEndian)", TINYJS_BIND(viewGetFloat32), 0);
+
+   - and counts towards TINYJS_BOUND_MAX_ARGS like any other. */
+
+// ----------------------------------------------- Arguments
+template<typename T> struct CScriptArg {
+    // all the integer types, enums included
+    static T get(CScriptVar *v) { return (T)v->getInt(); }
+};
+template<> struct CScriptArg<bool> {
+    static bool get(CScriptVar *v) { return v->getBool(); }
+};
+template<> struct CScriptArg<float> {
+    static float get(CScriptVar *v) { return (float)v->getDouble(); }
+};
+template<> struct CScriptArg<double> {
+    static double get(CScriptVar *v) { return v->getDouble(); }
+};
+template<> struct CScriptArg<const char *> {
+    static const char *get(CScriptVar *v) { return v->getString().c_str(); }
+};
+template<> struct CScriptArg<std::string> {
+    static std::string get(CScriptVar *v) { return v->getString(); }
+};
+template<> struct CScriptArg<const std::string &> {
+    static const std::string &get(CScriptVar *v) { return v->getString(); }
+};
+template<> struct CScriptArg<CScriptVar *> {
+    static CScriptVar *get(CScriptVar *v) { return v; }
+};
+
+// ----------------------------------------------- Results
+template<typename T> struct CScriptResult {
+    static CScriptVar *box(T value) { return new CScriptVar((int)value); }
+};
+template<> struct CScriptResult<float> {
+    static CScriptVar *box(float value) { return new CScriptVar((double)value); }
+};
+template<> struct CScriptResult<double> {
+    static CScriptVar *box(double value) { return new CScriptVar(value); }
+};
+template<> struct CScriptResult<const char *> {
+    static CScriptVar *box(const char *value) { return new CScriptVar(std::string(value ? value : "")); }
+};
+template<> struct CScriptResult<std::string> {
+    static CScriptVar *box(const std::string &value) { return new CScriptVar(value); }
+};
+template<> struct CScriptResult<CScriptVar *> {
+    static CScriptVar *box(CScriptVar *value) { return value; }
+};
+
+// ----------------------------------------------- Calls
+/* One specialisation per number of parameters, and again for void
+   functions, up to TINYJS_BOUND_MAX_ARGS. 'call' is instantiated for each
+   function bound, with the function as a template argument - so the call
+   is direct, and can be inlined. */
+template<typename F> struct CScriptBinder;
+
+template<typename R> struct CScriptBinder<R (*)()> {
+    template<R (*F)()> static CScriptVar *call(CScriptVar **, void *) {
+        return CScriptResult<R>::box(F());
+    }
+};
+template<> struct CScriptBinder<void (*)()> {
+    template<void (*F)()> static CScriptVar *call(CScriptVar **, void *) {
+        F();
+        return 0;
+    }
+};
+
+template<typename R, typename A1> struct CScriptBinder<R (*)(A1)> {
+    template<R (*F)(A1)> static CScriptVar *call(CScriptVar **args, void *) {
+        return CScriptResult<R>::box(F(CScriptArg<A1>::get(args[0])));
+    }
+};
+template<typename A1> struct CScriptBinder<void (*)(A1)> {
+    template<void (*F)(A1)> static CScriptVar *call(CScriptVar **args, void *) {
+        F(CScriptArg<A1>::get(args[0]));
+        return 0;
+    }
+};
+
+template<typename R, typename A1, typename A2> struct CScriptBinder<R (*)(A1, A2)> {
+    template<R (*F)(A1, A2)> static CScriptVar *call(CScriptVar **args, void *) {
+        return CScriptResult<R>::box(F(CScriptArg<A1>::get(args[0]),
+                                       CScriptArg<A2>::get(args[1])));
+    }
+};
+template<typename A1, typename A2> struct CScriptBinder<void (*)(A1, A2)> {
+    template<void (*F)(A1, A2)> static CScriptVar *call(CScriptVar **args, void *) {
+        F(CScriptArg<A1>::get(args[0]),
+          CScriptArg<A2>::get(args[1]));
+        return 0;
+    }
+};
+
+template<typename R, typename A1, typename A2, typename A3> struct CScriptBinder<R (*)(A1, A2, A3)> {
+    template<R (*F)(A1, A2, A3)> static CScriptVar *call(CScriptVar **args, void *) {
+        return CScriptResult<R>::box(F(CScriptArg<A1>::get(args[0]),
+                                       CScriptArg<A2>::get(args[1]),
+                                       CScriptArg<A3>::get(args[2])));
+    }
+};
+template<typename A1, typename A2, typename A3> struct CScriptBinder<void (*)(A1, A2, A3)> {
+    template<void (*F)(A1, A2, A3)> static CScriptVar *call(CScriptVar **args, void *) {
+        F(CScriptArg<A1>::get(args[0]),
+          CScriptArg<A2>::get(args[1]),
+          CScriptArg<A3>::get(args[2]));
+        return 0;
+    }
+};
+
+template<typename R, typename A1, typename A2, typename A3, typename A4> struct CScriptBinder<R (*)(A1, A2, A3, A4)> {
+    template<R (*F)(A1, A2, A3, A4)> static CScriptVar *call(CScriptVar **args, void *) {
+        return CScriptResult<R>::box(F(CScriptArg<A1>::get(args[0]),
+                                       CScriptArg<A2>::get(args[1]),
+                                       CScriptArg<A3>::get(args[2]),
+                                       CScriptArg<A4>::get(args[3])));
+    }
+};
+template<typename A1, typename A2, typename A3, typename A4> struct CScriptBinder<void (*)(A1, A2, A3, A4)> {
+    template<void (*F)(A1, A2, A3, A4)> static CScriptVar *call(CScriptVar **args, void *) {
+        F(CScriptArg<A1>::get(args[0]),
+          CScriptArg<A2>::get(args[1]),
+          CScriptArg<A3>::get(args[2]),
+          CScriptArg<A4>::get(args[3]));
+        return 0;
+    }
+};
+
+/// The JSBoundCallback for the C function FUNC - for CTinyJS::addBound
+#define TINYJS_BIND(FUNC) (&CScriptBinder<__typeof__(&FUNC)>::call<&FUNC>)
+
+#endif
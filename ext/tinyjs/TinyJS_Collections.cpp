@@ -0,0 +1,179 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Map and Set
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_Collections.h"
+#include "TinyJS_Bind.h"
+#include <stdio.h>
+
+using namespace std;
+
+/* The natives are bound (see TinyJS_Bind.h), so they get their arguments
+   as they are - a plain native would have been passed a copy of an empty
+   object or array, as they look like basic values. */
+
+/// What a Map or Set keeps of a key or value: numbers and strings are copied, objects and arrays kept
+static CScriptVar *kept(CScriptVar *v) {
+    return v->isObject() || v->isArray() || v->isFunction() || v->isBuffer() ? v : v->deepCopy();
+}
+
+/// The table of 'obj', made if it hasn't one yet (as for 'new Map' with no brackets)
+static CScriptHash *getHash(CScriptVar *obj, bool keysOnly) {
+    if (!obj->hash) {
+        if (!obj->isObject())
+            throw new CScriptException(keysOnly ? "Not a Set" : "Not a Map");
+        obj->hash = new CScriptHash(keysOnly);
+    }
+    return obj->hash;
+}
+
+/// Add the items of an array to a new Map or Set
+static void addItems(CScriptHash *hash, CScriptVar *items) {
+    if (!items->isArray()) return;
+    int len = items->getArrayLength();
+    for (int i=0;i<len;i++) {
+        char idx[16];
+        sprintf(idx, "%d", i);
+        CScriptVarLink *item = items->findChild(idx);
+        if (!item) continue;
+        if (hash->keysOnly) {
+            hash->set(kept(item->var), 0);
+        } else {
+            CScriptVarLink *key = item->var->findChild("0");
+            CScriptVarLink *value = item->var->findChild("1");
+            if (!key) continue;
+            hash->set(kept(key->var), value ? kept(value->var) : new CScriptVar());
+        }
+    }
+}
+
+/// An array of the keys, values or [key, value] pairs
+static CScriptVar *getItems(CScriptVar *obj, bool keys, bool values) {
+    CScriptHash *hash = obj->hash;
+    CScriptVar *result = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_ARRAY);
+    if (!hash) return result;
+    int n = 0;
+    for (size_t i=0;i<hash->entries.size();i++) {
+        CScriptHash::Entry &e = hash->entries[i];
+        if (!e.key) continue;
+        CScriptVar *value = e.value ? e.value : e.key;
+        CScriptVar *item;
+        if (keys && values) {
+            item = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_ARRAY);
+            item->setArrayIndex(0, kept(e.key));
+            item->setArrayIndex(1, kept(value));
+        } else {
+            item = kept(keys ? e.key : value);
+        }
+        result->setArrayIndex(n++, item);
+    }
+    return result;
+}
+
+// ----------------------------------------------- Actual Functions
+void mapConstructor(CScriptVar *map, CScriptVar *pairs) {
+    addItems(getHash(map, false), pairs);
+}
+
+void setConstructor(CScriptVar *set, CScriptVar *values) {
+    addItems(getHash(set, true), values);
+}
+
+CScriptVar *mapSet(CScriptVar *map, CScriptVar *key, CScriptVar *value) {
+    getHash(map, false)->set(kept(key), kept(value));
+    return map;
+}
+
+CScriptVar *setAdd(CScriptVar *set, CScriptVar *value) {
+    getHash(set, true)->set(kept(value), 0);
+    return set;
+}
+
+CScriptVar *mapGet(CScriptVar *map, CScriptVar *key) {
+    CScriptHash::Entry *e = map->hash ? map->hash->find(key) : 0;
+    return e ? e->value : 0;
+}
+
+bool mapHas(CScriptVar *map, CScriptVar *key) {
+    return map->hash && map->hash->find(key);
+}
+
+bool mapDelete(CScriptVar *map, CScriptVar *key) {
+    return map->hash && map->hash->remove(key);
+}
+
+void mapClear(CScriptVar *map) {
+    if (map->hash) map->hash->clear();
+}
+
+/// Written out rather than bound with TINYJS_BIND, as it needs the interpreter to call back
+static CScriptVar *mapForEach(CScriptVar **args, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    CScriptVar *obj = args[0];
+    CScriptVar *callback = args[1];
+    CScriptHash *hash = obj->hash;
+    if (!hash) return 0;
+    // entries added by the callback are visited too, as they go on the end
+    hash->iterating++;
+    for (size_t i=0;i<hash->entries.size();i++) {
+        CScriptHash::Entry &e = hash->entries[i];
+        if (!e.key) continue;
+        CScriptVar *key = e.key->ref();
+        CScriptVar *value = (e.value ? e.value : e.key)->ref();
+        CScriptVar *callArgs[3] = { value, key, obj };
+        CScriptVarLink *r = tinyJS->callFunction(callback, 0, callArgs, 3);
+        key->unref();
+        value->unref();
+        if (!r) break;
+        delete r;
+    }
+    hash->iterating--;
+    return 0;
+}
+
+CScriptVar *mapKeys(CScriptVar *map) {
+    return getItems(map, true, false);
+}
+
+CScriptVar *mapValues(CScriptVar *map) {
+    return getItems(map, false, true);
+}
+
+CScriptVar *mapEntries(CScriptVar *map) {
+    return getItems(map, true, true);
+}
+
+int mapMemoryUsage(CScriptVar *map) {
+    return map->hash ? (int)map->hash->getMemoryUsage() : 0;
+}
+
+// ----------------------------------------------- Register Functions
+void registerCollectionFunctions(CTinyJS *tinyJS) {
+    tinyJS->addBound("function Map.constructor(this, pairs)", TINYJS_BIND(mapConstructor), 0); // new Map([[key, value], ...])
+    tinyJS->addBound("function Map.set(this, key, value)", TINYJS_BIND(mapSet), 0); // returns the map
+    tinyJS->addBound("function Map.get(this, key)", TINYJS_BIND(mapGet), 0); // undefined if it isn't there
+    tinyJS->addBound("function Map.has(this, key)", TINYJS_BIND(mapHas), 0);
+    tinyJS->addBound("function Map.delete(this, key)", TINYJS_BIND(mapDelete), 0); // returns whether it was there
+    tinyJS->addBound("function Map.clear(this)", TINYJS_BIND(mapClear), 0);
+    tinyJS->addBound("function Map.forEach(this, callback)", mapForEach, tinyJS); // callback(value, key, map)
+    tinyJS->addBound("function Map.keys(this)", TINYJS_BIND(mapKeys), 0);
+    tinyJS->addBound("function Map.values(this)", TINYJS_BIND(mapValues), 0);
+    tinyJS->addBound("function Map.entries(this)", TINYJS_BIND(mapEntries), 0); // [[key, value], ...]
+    tinyJS->addBound("function Map.memoryUsage(this)", TINYJS_BIND(mapMemoryUsage), 0); // bytes in the entry table
+    tinyJS->addBound("function Set.constructor(this, values)", TINYJS_BIND(setConstructor), 0); // new Set([value, ...])
+    tinyJS->addBound("function Set.add(this, value)", TINYJS_BIND(setAdd), 0); // returns the set
+    tinyJS->addBound("function Set.has(this, key)", TINYJS_BIND(mapHas), 0);
+    tinyJS->addBound("function Set.delete(this, key)", TINYJS_BIND(mapDelete), 0);
+    tinyJS->addBound("function Set.clear(this)", TINYJS_BIND(mapClear), 0);
+    tinyJS->addBound("function Set.forEach(this, callback)", mapForEach, tinyJS); // callback(value, value, set)
+    tinyJS->addBound("function Set.keys(this)", TINYJS_BIND(mapValues), 0); // the values, as for a Map's keys
+    tinyJS->addBound("function Set.values(this)", TINYJS_BIND(mapValues), 0);
+    tinyJS->addBound("function Set.entries(this)", TINYJS_BIND(mapEntries), 0); // [[value, value], ...]
+    tinyJS->addBound("function Set.memoryUsage(this)", TINYJS_BIND(mapMemoryUsage), 0);
+}
@@ -0,0 +1,181 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Files
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_FS.h"
+#include "TinyJS_Bind.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define TINYJS_FS_LINE_BLOCK 128 ///< Bytes readLines() reads at a time, if not given
+
+/// The part of 'bytes' from 'offset' (or 0) for 'length' (or the rest) bytes, clipped to fit
+static void getRange(const string &bytes, CScriptVar *offset, CScriptVar *length, size_t &start, size_t &count) {
+    int o = offset->isUndefined() ? 0 : offset->getInt();
+    start = o>0 ? (size_t)o : 0;
+    if (start>bytes.size()) start = bytes.size();
+    count = bytes.size()-start;
+    if (!length->isUndefined()) {
+        int n = length->getInt();
+        if (n<0) n = 0;
+        if ((size_t)n<count) count = n;
+    }
+}
+
+static CScriptVar *getChild(CScriptVar *object, const char *name) {
+    CScriptVarLink *link = object->findChild(name);
+    if (!link) throw new CScriptException(string("Not a line reader - no '")+name+"'");
+    return link->var;
+}
+
+/** As getChild, for a var next() changes in place. If anything but the
+ * reader holds it - 'var first = r.line', or a literal assigned to it - it
+ * gets a copy of its own first, so what else holds it doesn't change */
+static CScriptVar *getOwnChild(CScriptVar *object, const char *name) {
+    CScriptVarLink *link = object->findChild(name);
+    if (!link) throw new CScriptException(string("Not a line reader - no '")+name+"'");
+    if (link->var->getRefs()>1 || link->var->isConstant())
+        link->replaceWith(link->var->deepCopy());
+    return link->var;
+}
+
+// ----------------------------------------------- Actual Functions
+int fsOpen(const string &path, CScriptVar *flagsVar) {
+    const string &flags = flagsVar->isUndefined() ? string("r") : flagsVar->getString();
+    int mode;
+    if (flags == "r") mode = O_RDONLY;
+    else if (flags == "r+") mode = O_RDWR;
+    else if (flags == "w") mode = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (flags == "w+") mode = O_RDWR | O_CREAT | O_TRUNC;
+    else if (flags == "a") mode = O_WRONLY | O_CREAT | O_APPEND;
+    else if (flags == "a+") mode = O_RDWR | O_CREAT | O_APPEND;
+    else throw new CScriptException("Unknown file flags '"+flags+"'");
+    int fd = open(path.c_str(), mode, 0666);
+    if (fd < 0)
+        throw new CScriptException("Unable to open '"+path+"'");
+    // not every posix_* provider knows O_APPEND
+    if ((mode & O_APPEND) && lseek(fd, 0, SEEK_END) < 0) {
+        close(fd);
+        throw new CScriptException("Unable to append to '"+path+"'");
+    }
+    return fd;
+}
+
+int fsRead(int fd, CScriptVar *buffer, CScriptVar *offset, CScriptVar *length) {
+    if (!buffer->isBuffer())
+        throw new CScriptException("fs.read needs a Buffer to read into");
+    string &bytes = buffer->getBytes();
+    size_t start, count;
+    getRange(bytes, offset, length, start, count);
+    if (!count) return 0;
+    int n = read(fd, &bytes[start], count);
+    if (n < 0)
+        throw new CScriptException("Unable to read from the file");
+    return n;
+}
+
+int fsWrite(int fd, CScriptVar *data, CScriptVar *offset, CScriptVar *length) {
+    const string &bytes = data->getString();
+    size_t start, count;
+    getRange(bytes, offset, length, start, count);
+    if (!count) return 0;
+    int n = write(fd, bytes.data()+start, count);
+    if (n < 0)
+        throw new CScriptException("Unable to write to the file");
+    return n;
+}
+
+int fsSeek(int fd, int offset, int whence) {
+    int pos = lseek(fd, offset, whence);
+    if (pos < 0)
+        throw new CScriptException("Unable to seek in the file");
+    return pos;
+}
+
+void fsClose(int fd) {
+    close(fd);
+}
+
+void scFSReadLines(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    CScriptVar *sizeVar = c->getParameter("size");
+    int size = sizeVar->isUndefined() ? TINYJS_FS_LINE_BLOCK : sizeVar->getInt();
+    if (size < 1) size = 1;
+    CScriptVar *reader = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT);
+    reader->addChild(TINYJS_PROTOTYPE_CLASS, tinyJS->getScriptVariable("fs.LineReader"));
+    reader->addChild("fd", new CScriptVar(c->getParameter("fd")->getInt()));
+    reader->addChild("line", new CScriptVar(string()));
+    // the block read, and the part of it that's still to be looked at
+    reader->addChild("block", new CScriptVar(string(size, '\0'), SCRIPTVAR_BUFFER));
+    reader->addChild("pos", new CScriptVar(0));
+    reader->addChild("end", new CScriptVar(0));
+    c->setReturnVar(reader);
+}
+
+void scFSLineReaderNext(CScriptVar *c, void *) {
+    CScriptVar *reader = c->getParameter("this");
+    CScriptVar *lineVar = getOwnChild(reader, "line");
+    CScriptVar *blockVar = getOwnChild(reader, "block");
+    CScriptVar *posVar = getOwnChild(reader, "pos");
+    CScriptVar *endVar = getOwnChild(reader, "end");
+    if (!lineVar->isString()) lineVar->setString("");
+    if (!blockVar->isBuffer() || blockVar->getString().empty())
+        throw new CScriptException("Not a line reader - no 'block'");
+    int fd = getChild(reader, "fd")->getInt();
+    string &line = lineVar->getBytes();
+    string &block = blockVar->getBytes();
+    int pos = posVar->getInt();
+    int end = endVar->getInt();
+
+    // clear() keeps the capacity, so once lines stop growing nothing is allocated
+    line.clear();
+    bool found = false;
+    while (true) {
+        if (pos >= end) {
+            pos = 0;
+            end = read(fd, &block[0], block.size());
+            if (end < 0)
+                throw new CScriptException("Unable to read from the file");
+            if (end == 0) break;
+        }
+        found = true;
+        const char *start = block.data()+pos;
+        const char *nl = (const char *)memchr(start, '\n', end-pos);
+        if (nl) {
+            line.append(start, nl-start);
+            pos += nl-start+1;
+            break;
+        }
+        line.append(start, end-pos);
+        pos = end;
+    }
+    if (!line.empty() && line[line.size()-1] == '\r')
+        line.erase(line.size()-1);
+    posVar->setInt(pos);
+    endVar->setInt(end);
+    c->getReturnVar()->setInt(found);
+}
+
+// ----------------------------------------------- Register Functions
+void registerFSFunctions(CTinyJS *tinyJS) {
+    tinyJS->addBound("function fs.open(path, flags)", TINYJS_BIND(fsOpen), 0);
+    tinyJS->addBound("function fs.read(fd, buffer, offset, length)", TINYJS_BIND(fsRead), 0);
+    tinyJS->addBound("function fs.write(fd, data, offset, length)", TINYJS_BIND(fsWrite), 0);
+    tinyJS->addBound("function fs.seek(fd, offset, whence)", TINYJS_BIND(fsSeek), 0);
+    tinyJS->addBound("function fs.close(fd)", TINYJS_BIND(fsClose), 0);
+    tinyJS->addNative("function fs.readLines(fd, size)", scFSReadLines, tinyJS);
+    tinyJS->addNative("function fs.LineReader.next()", scFSLineReaderNext, 0);
+    CScriptVar *fs = tinyJS->getScriptVariable("fs");
+    fs->addChild("SEEK_SET", new CScriptVar(SEEK_SET));
+    fs->addChild("SEEK_CUR", new CScriptVar(SEEK_CUR));
+    fs->addChild("SEEK_END", new CScriptVar(SEEK_END));
+}
@@ -34,4 +34,7 @@
 /// Register useful functions with the TinyJS interpreter
 extern void registerFunctions(CTinyJS *tinyJS);
 
+/// Find 'needle' in 'hay' at or after 'from', returns std::string::npos if it isn't there
+extern size_t findString(const char *hay, size_t hayLen, const char *needle, size_t needleLen, size_t from);
+
 #endif
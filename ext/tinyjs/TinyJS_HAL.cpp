@@ -0,0 +1,338 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - ChibiOS HAL peripherals
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_HAL.h"
+#include "TinyJS_Bind.h"
+#include "ch.h"
+#include "hal.h"
+#include <string.h>
+
+#define I2C_TIMEOUT MS2ST(100)
+
+// ----------------------------------------------- Actual Functions
+// not static - TINYJS_BIND needs external linkage before C++11
+#if HAL_USE_PAL
+static ioportid_t const gpioPorts[] = {
+    GPIOA, GPIOB, GPIOC, GPIOD, GPIOE, GPIOF, GPIOG, GPIOH, GPIOI
+};
+
+static ioportid_t gpioPort(int port, int pad) {
+    if (port<0 || port>=(int)(sizeof(gpioPorts)/sizeof(gpioPorts[0])))
+        throw new CScriptException("No such GPIO port");
+    if (pad<0 || pad>=PAL_IOPORTS_WIDTH)
+        throw new CScriptException("No such GPIO pad");
+    return gpioPorts[port];
+}
+
+void gpioSet(int port, int pad) {
+    palSetPad(gpioPort(port, pad), pad);
+}
+
+void gpioClear(int port, int pad) {
+    palClearPad(gpioPort(port, pad), pad);
+}
+
+void gpioToggle(int port, int pad) {
+    palTogglePad(gpioPort(port, pad), pad);
+}
+
+int gpioRead(int port, int pad) {
+    return palReadPad(gpioPort(port, pad), pad);
+}
+
+void gpioWrite(int port, int pad, bool bit) {
+    palWritePad(gpioPort(port, pad), pad, bit ? PAL_HIGH : PAL_LOW);
+}
+
+void gpioMode(int port, int pad, int mode) {
+    palSetPadMode(gpioPort(port, pad), pad, mode);
+}
+
+int gpioAlternate(int af) {
+    if (af<0 || af>15)
+        throw new CScriptException("No such alternate function");
+    return PAL_MODE_ALTERNATE(af);
+}
+#endif
+
+#if HAL_USE_PWM
+static PWMConfig pwmConfigs[9];
+
+static PWMDriver *pwmDriver(int timer) {
+    switch (timer) {
+#if STM32_PWM_USE_TIM1
+    case 1: return &PWMD1;
+#endif
+#if STM32_PWM_USE_TIM2
+    case 2: return &PWMD2;
+#endif
+#if STM32_PWM_USE_TIM3
+    case 3: return &PWMD3;
+#endif
+#if STM32_PWM_USE_TIM4
+    case 4: return &PWMD4;
+#endif
+#if STM32_PWM_USE_TIM5
+    case 5: return &PWMD5;
+#endif
+#if STM32_PWM_USE_TIM8
+    case 8: return &PWMD8;
+#endif
+#if STM32_PWM_USE_TIM9
+    case 9: return &PWMD9;
+#endif
+    }
+    throw new CScriptException("PWM timer not enabled");
+}
+
+static pwmchannel_t pwmChannel(int channel) {
+    if (channel<0 || channel>=PWM_CHANNELS)
+        throw new CScriptException("No such PWM channel");
+    return (pwmchannel_t)channel;
+}
+
+void pwmStartTimer(int timer, int frequency, int period) {
+    PWMDriver *pwmp = pwmDriver(timer);
+    // the config has to last until the driver is stopped
+    PWMConfig *config = &pwmConfigs[timer-1];
+    config->frequency = frequency;
+    config->period = period;
+    for (int i=0;i<PWM_CHANNELS;i++)
+        config->channels[i].mode = PWM_OUTPUT_ACTIVE_HIGH;
+    pwmStart(pwmp, config);
+}
+
+void pwmStopTimer(int timer) {
+    pwmStop(pwmDriver(timer));
+}
+
+void pwmPeriod(int timer, int period) {
+    pwmChangePeriod(pwmDriver(timer), period);
+}
+
+void pwmEnable(int timer, int channel, int width) {
+    pwmEnableChannel(pwmDriver(timer), pwmChannel(channel), width);
+}
+
+void pwmDisable(int timer, int channel) {
+    pwmDisableChannel(pwmDriver(timer), pwmChannel(channel));
+}
+#endif
+
+#if HAL_USE_ADC
+static ADCConfig adcConfig;
+static adcsample_t adcSample; // not on the stack, which may not be reachable by DMA
+
+static ADCDriver *adcDriver(int adc) {
+    switch (adc) {
+#if STM32_ADC_USE_ADC1
+    case 1: return &ADCD1;
+#endif
+#if STM32_ADC_USE_ADC2
+    case 2: return &ADCD2;
+#endif
+#if STM32_ADC_USE_ADC3
+    case 3: return &ADCD3;
+#endif
+    }
+    throw new CScriptException("ADC not enabled");
+}
+
+void adcStartDriver(int adc) {
+    adcStart(adcDriver(adc), &adcConfig);
+}
+
+void adcStopDriver(int adc) {
+    adcStop(adcDriver(adc));
+}
+
+int adcRead(int adc, int channel) {
+    if (channel<0 || channel>18)
+        throw new CScriptException("No such ADC channel");
+    ADCConversionGroup group;
+    memset(&group, 0, sizeof(group));
+    group.num_channels = 1;
+    group.cr2 = ADC_CR2_SWSTART;
+    if (channel<10)
+        group.smpr2 = ADC_SAMPLE_56 << (3*channel);
+    else
+        group.smpr1 = ADC_SAMPLE_56 << (3*(channel-10));
+    group.sqr1 = ADC_SQR1_NUM_CH(1);
+    group.sqr3 = ADC_SQR3_SQ1_N(channel);
+    if (adcConvert(adcDriver(adc), &group, &adcSample, 1) != RDY_OK)
+        return -1;
+    return adcSample;
+}
+#endif
+
+#if HAL_USE_SPI
+static SPIConfig spiConfigs[3];
+static uint8_t spiTx, spiRx; // not on the stack, which may not be reachable by DMA
+
+static SPIDriver *spiDriver(int bus) {
+    switch (bus) {
+#if STM32_SPI_USE_SPI1
+    case 1: return &SPID1;
+#endif
+#if STM32_SPI_USE_SPI2
+    case 2: return &SPID2;
+#endif
+#if STM32_SPI_USE_SPI3
+    case 3: return &SPID3;
+#endif
+    }
+    throw new CScriptException("SPI bus not enabled");
+}
+
+void spiStartBus(int bus, int cr1, int csPort, int csPad) {
+    SPIDriver *spip = spiDriver(bus);
+    SPIConfig *config = &spiConfigs[bus-1];
+    config->end_cb = NULL;
+    config->ssport = gpioPort(csPort, csPad);
+    config->sspad = csPad;
+    config->cr1 = cr1;
+    spiStart(spip, config);
+}
+
+void spiStopBus(int bus) {
+    spiStop(spiDriver(bus));
+}
+
+void spiSelectBus(int bus) {
+    spiSelect(spiDriver(bus));
+}
+
+void spiUnselectBus(int bus) {
+    spiUnselect(spiDriver(bus));
+}
+
+int spiExchangeByte(int bus, int byte) {
+    SPIDriver *spip = spiDriver(bus);
+    spiTx = byte;
+    spiExchange(spip, 1, &spiTx, &spiRx);
+    return spiRx;
+}
+#endif
+
+#if HAL_USE_I2C
+static I2CConfig i2cConfigs[3];
+static uint8_t i2cTx[2], i2cRx[2];
+
+static I2CDriver *i2cDriver(int bus) {
+    switch (bus) {
+#if STM32_I2C_USE_I2C1
+    case 1: return &I2CD1;
+#endif
+#if STM32_I2C_USE_I2C2
+    case 2: return &I2CD2;
+#endif
+#if STM32_I2C_USE_I2C3
+    case 3: return &I2CD3;
+#endif
+    }
+    throw new CScriptException("I2C bus not enabled");
+}
+
+void i2cStartBus(int bus, int speed) {
+    I2CDriver *i2cp = i2cDriver(bus);
+    I2CConfig *config = &i2cConfigs[bus-1];
+    config->op_mode = OPMODE_I2C;
+    config->clock_speed = speed;
+    config->duty_cycle = speed<=100000 ? STD_DUTY_CYCLE : FAST_DUTY_CYCLE_2;
+    i2cStart(i2cp, config);
+}
+
+void i2cStopBus(int bus) {
+    i2cStop(i2cDriver(bus));
+}
+
+int i2cWrite(int bus, int address, int byte) {
+    i2cTx[0] = byte;
+    return i2cMasterTransmitTimeout(i2cDriver(bus), address, i2cTx, 1, NULL, 0, I2C_TIMEOUT);
+}
+
+int i2cRead(int bus, int address) {
+    if (i2cMasterReceiveTimeout(i2cDriver(bus), address, i2cRx, 1, I2C_TIMEOUT) != RDY_OK)
+        return -1;
+    return i2cRx[0];
+}
+
+int i2cWriteRegister(int bus, int address, int reg, int byte) {
+    i2cTx[0] = reg;
+    i2cTx[1] = byte;
+    return i2cMasterTransmitTimeout(i2cDriver(bus), address, i2cTx, 2, NULL, 0, I2C_TIMEOUT);
+}
+
+int i2cReadRegister(int bus, int address, int reg) {
+    i2cTx[0] = reg;
+    if (i2cMasterTransmitTimeout(i2cDriver(bus), address, i2cTx, 1, i2cRx, 1, I2C_TIMEOUT) != RDY_OK)
+        return -1;
+    return i2cRx[0];
+}
+#endif
+
+// ----------------------------------------------- Register Functions
+static void addConstant(CTinyJS *tinyJS, const char *object, const char *name, int value) {
+    tinyJS->getScriptVariable(object)->addChild(name, new CScriptVar(value));
+}
+
+void registerHALFunctions(CTinyJS *tinyJS) {
+#if HAL_USE_PAL
+    tinyJS->addBound("function gpio.set(port, pad)", TINYJS_BIND(gpioSet), 0);
+    tinyJS->addBound("function gpio.clear(port, pad)", TINYJS_BIND(gpioClear), 0);
+    tinyJS->addBound("function gpio.toggle(port, pad)", TINYJS_BIND(gpioToggle), 0);
+    tinyJS->addBound("function gpio.read(port, pad)", TINYJS_BIND(gpioRead), 0);
+    tinyJS->addBound("function gpio.write(port, pad, bit)", TINYJS_BIND(gpioWrite), 0);
+    tinyJS->addBound("function gpio.mode(port, pad, mode)", TINYJS_BIND(gpioMode), 0);
+    tinyJS->addBound("function gpio.alternate(af)", TINYJS_BIND(gpioAlternate), 0); // the mode for alternate function 'af'
+    const char portNames[][2] = { "A", "B", "C", "D", "E", "F", "G", "H", "I" };
+    for (int i=0;i<(int)(sizeof(portNames)/sizeof(portNames[0]));i++)
+        addConstant(tinyJS, "gpio", portNames[i], i);
+    addConstant(tinyJS, "gpio", "INPUT", PAL_MODE_INPUT);
+    addConstant(tinyJS, "gpio", "INPUT_PULLUP", PAL_MODE_INPUT_PULLUP);
+    addConstant(tinyJS, "gpio", "INPUT_PULLDOWN", PAL_MODE_INPUT_PULLDOWN);
+    addConstant(tinyJS, "gpio", "ANALOG", PAL_MODE_INPUT_ANALOG);
+    addConstant(tinyJS, "gpio", "OUTPUT", PAL_MODE_OUTPUT_PUSHPULL);
+    addConstant(tinyJS, "gpio", "OPENDRAIN", PAL_MODE_OUTPUT_OPENDRAIN);
+#endif
+#if HAL_USE_PWM
+    tinyJS->addBound("function pwm.start(timer, frequency, period)", TINYJS_BIND(pwmStartTimer), 0);
+    tinyJS->addBound("function pwm.stop(timer)", TINYJS_BIND(pwmStopTimer), 0);
+    tinyJS->addBound("function pwm.period(timer, period)", TINYJS_BIND(pwmPeriod), 0);
+    tinyJS->addBound("function pwm.enable(timer, channel, width)", TINYJS_BIND(pwmEnable), 0);
+    tinyJS->addBound("function pwm.disable(timer, channel)", TINYJS_BIND(pwmDisable), 0);
+#endif
+#if HAL_USE_ADC
+    tinyJS->addBound("function adc.start(adc)", TINYJS_BIND(adcStartDriver), 0);
+    tinyJS->addBound("function adc.stop(adc)", TINYJS_BIND(adcStopDriver), 0);
+    tinyJS->addBound("function adc.read(adc, channel)", TINYJS_BIND(adcRead), 0); // one sample, -1 on error
+#endif
+#if HAL_USE_SPI
+    tinyJS->addBound("function spi.start(bus, cr1, csPort, csPad)", TINYJS_BIND(spiStartBus), 0);
+    tinyJS->addBound("function spi.stop(bus)", TINYJS_BIND(spiStopBus), 0);
+    tinyJS->addBound("function spi.select(bus)", TINYJS_BIND(spiSelectBus), 0);
+    tinyJS->addBound("function spi.unselect(bus)", TINYJS_BIND(spiUnselectBus), 0);
+    tinyJS->addBound("function spi.exchange(bus, byte)", TINYJS_BIND(spiExchangeByte), 0);
+    addConstant(tinyJS, "spi", "CPHA", SPI_CR1_CPHA);
+    addConstant(tinyJS, "spi", "CPOL", SPI_CR1_CPOL);
+    addConstant(tinyJS, "spi", "LSBFIRST", SPI_CR1_LSBFIRST);
+    addConstant(tinyJS, "spi", "BR_DIV8", SPI_CR1_BR_1);
+    addConstant(tinyJS, "spi", "BR_DIV32", SPI_CR1_BR_2);
+    addConstant(tinyJS, "spi", "BR_DIV256", SPI_CR1_BR);
+#endif
+#if HAL_USE_I2C
+    tinyJS->addBound("function i2c.start(bus, speed)", TINYJS_BIND(i2cStartBus), 0);
+    tinyJS->addBound("function i2c.stop(bus)", TINYJS_BIND(i2cStopBus), 0);
+    tinyJS->addBound("function i2c.write(bus, address, byte)", TINYJS_BIND(i2cWrite), 0); // 0 if acknowledged
+    tinyJS->addBound("function i2c.read(bus, address)", TINYJS_BIND(i2cRead), 0);
+    tinyJS->addBound("function i2c.writeRegister(bus, address, reg, byte)", TINYJS_BIND(i2cWriteRegister), 0);
+    tinyJS->addBound("function i2c.readRegister(bus, address, reg)", TINYJS_BIND(i2cReadRegister), 0);
+#endif
+}
@@ -0,0 +1,37 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - ChibiOS HAL peripherals
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_HAL_H
+#define TINYJS_HAL_H
+
+#include "TinyJS.h"
+
+/* Board only. The functions are bound with TINYJS_BIND, so they take numbers
+   by position: ports are gpio.A (0) to gpio.I (8), and drivers are picked by
+   their number - timer 4 is PWMD4, bus 1 is SPID1 or I2CD1. A module only
+   exists if its driver is enabled in halconf.h, and using a driver that
+   isn't enabled in mcuconf.h is an error.
+
+     gpio.set/clear/toggle(port, pad), gpio.read(port, pad), gpio.write(port, pad, bit)
+     gpio.mode(port, pad, mode) - gpio.INPUT, INPUT_PULLUP, INPUT_PULLDOWN, ANALOG,
+                                  OUTPUT, OPENDRAIN or gpio.alternate(af)
+     pwm.start(timer, frequency, period), pwm.stop(timer), pwm.period(timer, period)
+     pwm.enable(timer, channel, width), pwm.disable(timer, channel)
+     adc.start(adc), adc.stop(adc), adc.read(adc, channel)
+     spi.start(bus, cr1, csPort, csPad), spi.stop(bus), spi.select(bus), spi.unselect(bus)
+     spi.exchange(bus, byte) - returns the byte received
+     i2c.start(bus, speed), i2c.stop(bus)
+     i2c.write(bus, address, byte), i2c.read(bus, address) - -1 on error
+     i2c.writeRegister(bus, address, reg, byte), i2c.readRegister(bus, address, reg) */
+
+/// Register the gpio, pwm, adc, spi and i2c modules
+extern void registerHALFunctions(CTinyJS *tinyJS);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Heap accounting
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_Memory.h"
+#include "TinyJS_AllocTrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <new>
+
+using namespace std;
+
+// dynamic exception specifications are gone from C++17
+#if __cplusplus >= 201103L
+#define NEW_THROWS
+#define DELETE_THROWS noexcept
+#else
+#define NEW_THROWS throw (std::bad_alloc)
+#define DELETE_THROWS throw ()
+#endif
+
+// ----------------------------------------------- Allocator
+void *operator new(size_t size) NEW_THROWS {
+    // a native asking for more than the quota allows gets nothing, and stops the script
+    if (CScriptMemory::current && CScriptMemory::current->refuses(size))
+        throw std::bad_alloc();
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    if (CScriptMemory::current)
+        CScriptMemory::current->allocated(malloc_usable_size(ptr));
+#ifdef TINYJS_TRACE_ALLOC
+    jsAllocTrace.allocated(malloc_usable_size(ptr));
+#endif
+    return ptr;
+}
+
+void *operator new[](size_t size) NEW_THROWS {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) DELETE_THROWS {
+    if (!ptr) return;
+    if (CScriptMemory::current)
+        CScriptMemory::current->freed(malloc_usable_size(ptr));
+    free(ptr);
+}
+
+void operator delete[](void *ptr) DELETE_THROWS {
+    operator delete(ptr);
+}
+
+#ifdef __cpp_sized_deallocation
+// C++14 compilers call these when they know the size - it would otherwise go to the library's free
+void operator delete(void *ptr, size_t) DELETE_THROWS {
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, size_t) DELETE_THROWS {
+    operator delete(ptr);
+}
+#endif
+
+// ----------------------------------------------- Actual Functions
+void scMemoryUsage(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    CScriptVar *result = c->getReturnVar();
+    result->addChild("used", new CScriptVar((int)tinyJS->memory.used));
+    result->addChild("peak", new CScriptVar((int)tinyJS->memory.peak));
+    result->addChild("quota", new CScriptVar((int)tinyJS->memory.quota));
+    result->addChild("allocations", new CScriptVar((int)tinyJS->memory.allocations));
+    result->addChild("shapes", new CScriptVar(CScriptShape::count));
+    result->addChild("calls", new CScriptVar(tinyJS->memory.callPeak));
+    result->addChild("stack", new CScriptVar((int)tinyJS->memory.stackPeak));
+    // what the deepest call cost, per level of nesting
+    int perCall = tinyJS->memory.callPeak>1 ? (int)(tinyJS->memory.stackPeak/(tinyJS->memory.callPeak-1)) : 0;
+    result->addChild("stackPerCall", new CScriptVar(perCall));
+}
+
+void scMemorySetQuota(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    int quota = c->getParameter("bytes")->getInt();
+    tinyJS->memory.quota = quota>0 ? quota : 0;
+}
+
+void scMemorySetLimits(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    int calls = c->getParameter("calls")->getInt();
+    int stack = c->getParameter("stack")->getInt();
+    tinyJS->memory.callLimit = calls>0 ? calls : 0;
+    tinyJS->memory.stackLimit = stack>0 ? stack : 0;
+}
+
+void scMemoryCollect(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    size_t before = tinyJS->memory.used;
+    tinyJS->collect();
+    c->getReturnVar()->setInt((int)(before>tinyJS->memory.used ? before-tinyJS->memory.used : 0));
+}
+
+#ifdef TINYJS_INTERN_STRINGS
+void scMemoryStrings(CScriptVar *c, void *) {
+    CScriptVar *result = c->getReturnVar();
+    result->addChild("strings", new CScriptVar(CScriptStrings::count));
+    result->addChild("refs", new CScriptVar(CScriptStrings::refs));
+    result->addChild("bytes", new CScriptVar((int)CScriptStrings::getMemoryUsage()));
+    result->addChild("duplicates", new CScriptVar((int)CScriptStrings::getDuplicateBytes()));
+}
+#endif
+
+/// Print the script heap for the 'mem' shell command, or set the quota of new interpreters
+extern "C" int js_mem(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "quota") == 0) {
+        CScriptMemory::defaultQuota = strtoul(argv[2], 0, 0);
+        if (CScriptMemory::current) CScriptMemory::current->quota = CScriptMemory::defaultQuota;
+    } else if (argc > 1) {
+        printf("Usage: mem [quota bytes]\r\n");
+        return 0;
+    }
+    CScriptMemory *memory = CScriptMemory::current;
+    if (memory)
+        printf("js heap used     : %lu bytes\r\n", (unsigned long)memory->used);
+    printf("js heap peak     : %lu bytes\r\n", (unsigned long)(memory ? memory->peak : CScriptMemory::lastPeak));
+    printf("js heap quota    : %lu bytes\r\n", (unsigned long)(memory ? memory->quota : CScriptMemory::defaultQuota));
+    if (memory)
+        printf("js stack peak    : %lu bytes, %d calls deep\r\n", (unsigned long)memory->stackPeak, memory->callPeak);
+#ifdef TINYJS_INTERN_STRINGS
+    printf("js strings       : %d interned in %lu bytes, %d refs, %lu bytes not duplicated\r\n",
+           CScriptStrings::count, (unsigned long)CScriptStrings::getMemoryUsage(),
+           CScriptStrings::refs, (unsigned long)CScriptStrings::getDuplicateBytes());
+#endif
+    return 0;
+}
+
+// ----------------------------------------------- Register Functions
+void registerMemoryFunctions(CTinyJS *tinyJS) {
+    tinyJS->addNative("function Memory.usage()", scMemoryUsage, tinyJS); // { used, peak, quota } in bytes, allocations, shapes (of objects, in all interpreters), and calls, stack and stackPerCall at the deepest call
+    tinyJS->addNative("function Memory.setQuota(bytes)", scMemorySetQuota, tinyJS); // 0 for no limit
+    tinyJS->addNative("function Memory.setLimits(calls, stack)", scMemorySetLimits, tinyJS); // deepest JS calls, and C stack bytes they may use - 0 for no limit
+    tinyJS->addNative("function Memory.collect()", scMemoryCollect, tinyJS); // drop cached constants, returns bytes freed
+#ifdef TINYJS_INTERN_STRINGS
+    tinyJS->addNative("function Memory.strings()", scMemoryStrings, 0); // { strings, refs } interned, bytes they take, and duplicates - bytes of contents vars would otherwise hold again
+#endif
+}
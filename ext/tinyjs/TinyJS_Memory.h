@@ -0,0 +1,30 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Heap accounting
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_MEMORY_H
+#define TINYJS_MEMORY_H
+
+#include "TinyJS.h"
+
+/* operator new and delete are replaced here so that every block counts
+   towards CScriptMemory::current (see TinyJS.h). Block sizes come from
+   malloc_usable_size(), so nothing is added to each allocation. This only
+   counts blocks from one thread at a time correctly. That's fine on the
+   board, where scripts only run from the shell thread and the rest of the
+   firmware allocates with chHeapAlloc().
+
+   Built with TINYJS_INTERN_STRINGS, Memory.strings() says how many
+   strings are interned, and how many bytes of contents aren't held twice
+   as a result. */
+
+/// Register Memory.usage(), Memory.setQuota(), Memory.collect() and Memory.strings()
+extern void registerMemoryFunctions(CTinyJS *tinyJS);
+
+#endif
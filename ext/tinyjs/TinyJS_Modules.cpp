@@ -0,0 +1,171 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - CommonJS-style modules
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_Modules.h"
+#include <stdio.h>
+
+#ifdef __linux__
+#include <time.h>
+#else
+#include <ch.h>
+#endif
+
+using namespace std;
+
+#define MODULE_CACHE_DEPTH 16
+
+static unsigned long moduleMicros() {
+#ifdef __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+#else
+    return chTimeNow() * (1000000UL / CH_FREQUENCY);
+#endif
+}
+
+/// Approximate heap footprint of a variable and everything it owns
+static size_t moduleVarSize(CScriptVar *v, int depth) {
+    size_t size = sizeof(CScriptVar);
+    if (v->isString() || v->isFunction())
+        size += v->getString().size();
+    // depth limited, as recursive loops of data (a.foo = a) are allowed
+    if (depth>=MODULE_CACHE_DEPTH) return size;
+    CScriptVarLink *link = v->firstChild;
+    while (link) {
+        size += sizeof(CScriptVarLink) + link->name.size();
+        if (link->name != TINYJS_PROTOTYPE_CLASS)
+            size += moduleVarSize(link->var, depth+1);
+        link = link->nextSibling;
+    }
+    return size;
+}
+
+/// Resolve 'path' against the directory 'dir' of the module requiring it
+static string resolveModulePath(const string &dir, const string &path) {
+    string full = path;
+    if (!dir.empty() && (path.compare(0, 2, "./")==0 || path.compare(0, 3, "../")==0))
+        full = dir + "/" + path;
+    // normalise '.' and '..' components
+    vector<string> parts;
+    size_t p = 0;
+    while (p <= full.length()) {
+        size_t e = full.find('/', p);
+        if (e == string::npos) e = full.length();
+        string part = full.substr(p, e-p);
+        if (part == "..") {
+            if (!parts.empty() && parts.back() != "..") parts.pop_back();
+            else parts.push_back(part);
+        } else if (part != "." && !part.empty())
+            parts.push_back(part);
+        p = e+1;
+    }
+    string resolved = (!full.empty() && full[0]=='/') ? "/" : "";
+    for (size_t i=0;i<parts.size();i++) {
+        if (i>0) resolved += "/";
+        resolved += parts[i];
+    }
+    size_t len = resolved.length();
+    if (len<3 || resolved.compare(len-3, 3, ".js")!=0)
+        resolved += ".js";
+    return resolved;
+}
+
+static string moduleDirName(const string &path) {
+    size_t p = path.rfind('/');
+    if (p == string::npos) return "";
+    if (p == 0) return "/";
+    return path.substr(0, p);
+}
+
+static CScriptVar *getModuleCache(CTinyJS *tinyJS) {
+    return tinyJS->root->findChildOrCreateByPath("Module.cache")->var;
+}
+
+// ----------------------------------------------- Actual Functions
+void scRequire(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    CScriptVar *cache = getModuleCache(tinyJS);
+    CScriptVarLink *dir = tinyJS->root->findChildOrCreateByPath("Module.dir");
+    string path = resolveModulePath(dir->var->isString() ? dir->var->getString() : "",
+                                    c->getParameter("path")->getString());
+
+    // already loaded (or loading, for circular requires) - just hand out its exports
+    CScriptVarLink *record = cache->findChild(path);
+    if (record) {
+        c->setReturnVar(record->var->getParameter("exports"));
+        return;
+    }
+
+    unsigned long start = moduleMicros();
+    CScriptFileReader reader(path);
+
+    CScriptVar *exports = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT);
+    CScriptVar *module = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT);
+    module->addChild("id", new CScriptVar(path));
+    module->addChild("exports", exports);
+    CScriptVar *scope = (new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT))->ref();
+    scope->addChild("module", module);
+    scope->addChild("exports", exports);
+    scope->addChild("__filename", new CScriptVar(path));
+    scope->addChild("__dirname", new CScriptVar(moduleDirName(path)));
+
+    record = cache->addChild(path, new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_OBJECT));
+    record->var->addChild("exports", exports);
+
+    // replaced rather than set, as the script may have stored a shared constant there
+    CScriptVar *oldDir = dir->var->ref();
+    dir->replaceWith(new CScriptVar(moduleDirName(path)));
+    try {
+        tinyJS->execute(&reader, scope);
+    } catch (CScriptException *e) {
+        dir->replaceWith(oldDir);
+        oldDir->unref();
+        cache->removeLink(record);
+        scope->unref();
+        throw e;
+    }
+    dir->replaceWith(oldDir);
+    oldDir->unref();
+
+    // the module may have replaced module.exports altogether
+    exports = module->getParameter("exports");
+    record->var->addChildNoDup("exports", exports);
+    record->var->addChildNoDup("loadTime", new CScriptVar((int)(moduleMicros() - start)));
+    record->var->addChildNoDup("size", new CScriptVar((int)moduleVarSize(exports, 0)));
+    scope->unref();
+
+    c->setReturnVar(exports);
+}
+
+void scModuleCount(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    c->getReturnVar()->setInt(getModuleCache(tinyJS)->getChildren());
+}
+
+void scModuleList(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    CScriptVarLink *link = getModuleCache(tinyJS)->firstChild;
+    printf("  load(us)    bytes module\n");
+    while (link) {
+        printf("%10d %8d %s\n",
+               link->var->getParameter("loadTime")->getInt(),
+               link->var->getParameter("size")->getInt(),
+               link->name.c_str());
+        link = link->nextSibling;
+    }
+}
+
+// ----------------------------------------------- Register Functions
+void registerModuleFunctions(CTinyJS *tinyJS) {
+    tinyJS->addNative("function require(path)", scRequire, tinyJS); // load a module once and return its exports
+    tinyJS->addNative("function Module.count()", scModuleCount, tinyJS); // number of loaded modules
+    tinyJS->addNative("function Module.list()", scModuleList, tinyJS); // print load time and size of every loaded module
+}
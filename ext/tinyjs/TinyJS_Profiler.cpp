@@ -0,0 +1,207 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Sampling profiler
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_Profiler.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef __linux__
+#include <signal.h>
+#include <sys/time.h>
+#else
+#include <ch.h>
+#include <hal.h>
+#endif
+
+using namespace std;
+
+CScriptProfiler jsProfiler;
+
+// ----------------------------------------------- Sampling timer
+#ifdef __linux__
+
+static void profilerSignal(int) {
+    jsProfiler.pending = 1;
+}
+
+static bool profilerTimerStart(int hz) {
+    if (hz <= 0 || hz > 1000000) return false;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = profilerSignal;
+    sa.sa_flags = SA_RESTART; // don't break reads from the console
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, 0) != 0) return false;
+    long usec = 1000000L / hz; // tv_usec must stay below a second
+    struct itimerval tv;
+    tv.it_interval.tv_sec = usec / 1000000;
+    tv.it_interval.tv_usec = usec % 1000000;
+    tv.it_value = tv.it_interval;
+    return setitimer(ITIMER_PROF, &tv, 0) == 0;
+}
+
+static void profilerTimerStop() {
+    struct itimerval tv;
+    memset(&tv, 0, sizeof(tv));
+    setitimer(ITIMER_PROF, &tv, 0);
+    signal(SIGPROF, SIG_IGN);
+}
+
+#elif HAL_USE_GPT && STM32_GPT_USE_TIM7
+
+#define PROFILER_GPT_FREQUENCY 10000 // so 1Hz still fits TIM7's 16 bit period
+
+static void profilerTick(GPTDriver *gptp) {
+    (void) gptp;
+    jsProfiler.pending = 1;
+}
+
+static const GPTConfig profilerGptCfg = { PROFILER_GPT_FREQUENCY, profilerTick };
+
+static bool profilerTimerStart(int hz) {
+    if (hz <= 0 || hz > PROFILER_GPT_FREQUENCY) return false;
+    gptStart(&GPTD7, &profilerGptCfg);
+    gptStartContinuous(&GPTD7, PROFILER_GPT_FREQUENCY / hz);
+    return true;
+}
+
+static void profilerTimerStop() {
+    gptStopTimer(&GPTD7);
+    gptStop(&GPTD7);
+}
+
+#else
+
+static bool profilerTimerStart(int hz) {
+    (void) hz;
+    return false; // no timer available
+}
+
+static void profilerTimerStop() {
+}
+
+#endif
+
+// ----------------------------------------------- CScriptProfiler
+
+CScriptProfiler::CScriptProfiler() {
+    pending = 0;
+    running = false;
+    samples = 0;
+}
+
+CScriptProfiler::~CScriptProfiler() {
+    stop();
+}
+
+bool CScriptProfiler::start(int hz) {
+    if (running) stop();
+    pending = 0;
+    stack.clear();
+    running = hz > 0 && profilerTimerStart(hz);
+    return running;
+}
+
+void CScriptProfiler::stop() {
+    if (running)
+        profilerTimerStop();
+    running = false;
+    pending = 0;
+    stack.clear();
+}
+
+void CScriptProfiler::reset() {
+    samples = 0;
+    flat.clear();
+    collapsed.clear();
+}
+
+void CScriptProfiler::sample(CScriptLex *lex) {
+    pending = 0;
+    char line[16];
+    snprintf(line, sizeof(line), ":%d", lex ? lex->getLine() : 0);
+
+    string where = stack.empty() ? "<global>" : stack.back();
+    flat[where + line]++;
+
+    string path = "<global>";
+    for (size_t i=0;i<stack.size();i++)
+        path += ";" + stack[i];
+    collapsed[path + line]++;
+    samples++;
+}
+
+static bool bySamples(const pair<string, unsigned long> &a, const pair<string, unsigned long> &b) {
+    return a.second > b.second;
+}
+
+void CScriptProfiler::dumpFlat() {
+    vector<pair<string, unsigned long> > rows(flat.begin(), flat.end());
+    sort(rows.begin(), rows.end(), bySamples);
+    printf("%lu samples\r\n", samples);
+    printf(" samples      %%  function:line\r\n");
+    for (size_t i=0;i<rows.size();i++)
+        printf("%8lu %5.1f%%  %s\r\n", rows[i].second,
+               samples ? rows[i].second * 100.0 / samples : 0.0, rows[i].first.c_str());
+}
+
+void CScriptProfiler::dumpCollapsed() {
+    map<string, unsigned long>::iterator it;
+    for (it=collapsed.begin();it!=collapsed.end();it++)
+        printf("%s %lu\r\n", it->first.c_str(), it->second);
+}
+
+// ----------------------------------------------- Actual Functions
+void scProfilerStart(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    int hz = c->getParameter("hz")->getInt();
+    if (hz <= 0) hz = TINYJS_PROFILER_DEFAULT_HZ;
+    tinyJS->profiler = &jsProfiler;
+    c->getReturnVar()->setInt(jsProfiler.start(hz));
+}
+
+void scProfilerStop(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    jsProfiler.stop();
+    tinyJS->profiler = 0;
+}
+
+void scProfilerReset(CScriptVar *c, void *) {
+    jsProfiler.reset();
+}
+
+void scProfilerDump(CScriptVar *c, void *) {
+    jsProfiler.dumpCollapsed();
+}
+
+extern "C" int cmd_profile(int argc, char *argv[]) {
+    if (argc > 2) {
+        printf("Usage: profile [flat|tree|reset]\r\n");
+        return 0;
+    }
+    if (argc < 2 || strcmp(argv[1], "flat") == 0)
+        jsProfiler.dumpFlat();
+    else if (strcmp(argv[1], "tree") == 0)
+        jsProfiler.dumpCollapsed();
+    else if (strcmp(argv[1], "reset") == 0)
+        jsProfiler.reset();
+    else
+        printf("Usage: profile [flat|tree|reset]\r\n");
+    return 0;
+}
+
+// ----------------------------------------------- Register Functions
+void registerProfilerFunctions(CTinyJS *tinyJS) {
+    tinyJS->addNative("function Profiler.start(hz)", scProfilerStart, tinyJS); // start sampling this interpreter, returns false if there's no timer
+    tinyJS->addNative("function Profiler.stop()", scProfilerStop, tinyJS);
+    tinyJS->addNative("function Profiler.reset()", scProfilerReset, 0);
+    tinyJS->addNative("function Profiler.dump()", scProfilerDump, 0); // print collapsed stacks for flame graphs
+}
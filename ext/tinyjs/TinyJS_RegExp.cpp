@@ -0,0 +1,666 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Regular expressions
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_RegExp.h"
+#include "TinyJS_Functions.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+enum {
+    RE_CHAR, // match character c
+    RE_ANY, // match anything but a line break
+    RE_CLASS, // match a character in class x
+    RE_BOL, // start of input (or line, with 'm')
+    RE_EOL, // end of input (or line, with 'm')
+    RE_WORDB, // \b
+    RE_NWORDB, // \B
+    RE_SPLIT, // try pc+x, backtrack to pc+y
+    RE_JMP, // go to pc+x
+    RE_SAVE, // record the position in capture slot c
+    RE_STAR, // greedy repeat of the CHAR/ANY/CLASS at pc+1, without a stack entry per character
+    RE_MATCH
+};
+
+unsigned long CScriptRegExp::stepLimit = TINYJS_REGEXP_STEP_LIMIT;
+
+static bool isWordChar(char ch) {
+    return isalnum((unsigned char)ch) || ch=='_';
+}
+
+static void setBit(unsigned char *bits, unsigned char ch) {
+    bits[ch>>3] |= 1<<(ch&7);
+}
+
+static bool testBit(const unsigned char *bits, unsigned char ch) {
+    return (bits[ch>>3] & (1<<(ch&7))) != 0;
+}
+
+/// Add \d, \w, \s or their negations to a class bitmap
+static void addNamedClass(unsigned char *bits, char name) {
+    char lower = tolower(name);
+    for (int ch=0;ch<256;ch++) {
+        bool in = lower=='d' ? isdigit(ch) :
+                  lower=='w' ? isWordChar(ch) :
+                  (ch==' ' || (ch>='\t' && ch<='\r'));
+        if (in != (name!=lower)) setBit(bits, ch);
+    }
+}
+
+static bool isNamedClass(char ch) {
+    return strchr("dwsDWS", ch) != 0;
+}
+
+// ----------------------------------------------- Compiler
+
+CScriptRegExp::CScriptRegExp(const string &pattern, const string &flags) {
+    source = pattern;
+    this->flags = flags;
+    pins = 0;
+    global = flags.find('g') != string::npos;
+    ignoreCase = flags.find('i') != string::npos;
+    multiline = flags.find('m') != string::npos;
+    if (flags.find_first_not_of("gim") != string::npos)
+        throw new CScriptException("Invalid RegExp flags '" + flags + "'");
+    groups = 1;
+    pat = pattern.c_str();
+    patEnd = pat + pattern.size();
+
+    emit(program, RE_SAVE, 0);
+    parseAlternation(program);
+    if (pat<patEnd) parseError("unmatched ')'");
+    emit(program, RE_SAVE, 1);
+    emit(program, RE_MATCH);
+
+    // everything up to the first branch has to match, so gives us text to scan for
+    size_t pc = 1;
+    while (program[pc].op==RE_SAVE) pc++;
+    anchored = program[pc].op==RE_BOL && !multiline;
+    if (!ignoreCase)
+        for (;program[pc].op==RE_CHAR || program[pc].op==RE_SAVE;pc++)
+            if (program[pc].op==RE_CHAR) prefix += (char)program[pc].c;
+}
+
+void CScriptRegExp::parseError(const char *what) {
+    throw new CScriptException(string("Invalid RegExp: ") + what);
+}
+
+void CScriptRegExp::emit(Fragment &out, int op, int c, int x, int y) {
+    Inst inst;
+    inst.op = op;
+    inst.c = c;
+    inst.x = x;
+    inst.y = y;
+    out.push_back(inst);
+    if (out.size() > TINYJS_REGEXP_MAX_PROGRAM) parseError("pattern too large");
+}
+
+void CScriptRegExp::append(Fragment &out, const Fragment &f) {
+    if (out.size()+f.size() > TINYJS_REGEXP_MAX_PROGRAM) parseError("pattern too large");
+    out.insert(out.end(), f.begin(), f.end());
+}
+
+int CScriptRegExp::addClass(const unsigned char *bits) {
+    if (classes.size()/32 >= 32767) parseError("too many classes");
+    classes.insert(classes.end(), bits, bits+32);
+    return classes.size()/32 - 1;
+}
+
+/* Jumps are relative, so fragments can be compiled on their own and then
+   copied into place - which is also how {n,m} repeats an atom. */
+void CScriptRegExp::parseAlternation(Fragment &out) {
+    Fragment first;
+    parseSequence(first);
+    if (pat<patEnd && *pat=='|') {
+        pat++;
+        Fragment rest;
+        parseAlternation(rest);
+        emit(out, RE_SPLIT, 0, 1, first.size()+2);
+        append(out, first);
+        emit(out, RE_JMP, 0, rest.size()+1);
+        append(out, rest);
+    } else
+        append(out, first);
+}
+
+bool CScriptRegExp::parseCount(int &n) {
+    if (pat>=patEnd || !isdigit((unsigned char)*pat)) return false;
+    n = 0;
+    while (pat<patEnd && isdigit((unsigned char)*pat)) {
+        n = n*10 + (*pat++ - '0');
+        if (n > TINYJS_REGEXP_MAX_PROGRAM) parseError("repeat count too large");
+    }
+    return true;
+}
+
+void CScriptRegExp::parseSequence(Fragment &out) {
+    while (pat<patEnd && *pat!='|' && *pat!=')') {
+        Fragment atom;
+        parseAtom(atom);
+        int min = 1, max = 1; // max<0 is unbounded
+        if (pat<patEnd) {
+            const char *start = pat;
+            if (*pat=='*') { min = 0; max = -1; pat++; }
+            else if (*pat=='+') { min = 1; max = -1; pat++; }
+            else if (*pat=='?') { min = 0; max = 1; pat++; }
+            else if (*pat=='{') {
+                pat++;
+                if (parseCount(min)) {
+                    max = min;
+                    if (pat<patEnd && *pat==',') {
+                        pat++;
+                        if (!parseCount(max)) max = -1;
+                    }
+                }
+                if (pat<patEnd && *pat=='}' && pat-start>1) {
+                    pat++;
+                    if (max>=0 && max<min) parseError("numbers out of order in {}");
+                } else {
+                    // not a quantifier after all - '{' is just a character
+                    pat = start;
+                    min = max = 1;
+                }
+            }
+        }
+        if (min==1 && max==1) {
+            append(out, atom);
+            continue;
+        }
+        bool lazy = pat<patEnd && *pat=='?';
+        if (lazy) pat++;
+        int n = atom.size();
+        for (int i=0;i<min;i++) append(out, atom);
+        if (max<0 && !lazy && n==1 && (atom[0].op==RE_CHAR || atom[0].op==RE_ANY || atom[0].op==RE_CLASS)) {
+            emit(out, RE_STAR);
+            append(out, atom);
+        } else if (max<0) {
+            // L: split body, next / body / jmp L
+            emit(out, RE_SPLIT, 0, lazy ? n+2 : 1, lazy ? 1 : n+2);
+            append(out, atom);
+            emit(out, RE_JMP, 0, -(n+1));
+        } else {
+            for (int i=min;i<max;i++) {
+                emit(out, RE_SPLIT, 0, lazy ? n+1 : 1, lazy ? 1 : n+1);
+                append(out, atom);
+            }
+        }
+    }
+}
+
+void CScriptRegExp::parseAtom(Fragment &out) {
+    char ch = *pat++;
+    switch (ch) {
+    case '(': {
+        int slot = -1;
+        if (pat+1<patEnd && pat[0]=='?') {
+            if (pat[1]!=':') parseError("lookaround isn't supported");
+            pat += 2;
+        } else {
+            if (groups >= TINYJS_REGEXP_MAX_GROUPS) parseError("too many groups");
+            slot = groups++;
+        }
+        if (slot>=0) emit(out, RE_SAVE, slot*2);
+        parseAlternation(out);
+        if (pat>=patEnd || *pat!=')') parseError("missing ')'");
+        pat++;
+        if (slot>=0) emit(out, RE_SAVE, slot*2+1);
+        return;
+    }
+    case '[':
+        parseClass(out);
+        return;
+    case '.': emit(out, RE_ANY); return;
+    case '^': emit(out, RE_BOL); return;
+    case '$': emit(out, RE_EOL); return;
+    case '*': case '+': case '?':
+        parseError("nothing to repeat");
+    case '\\':
+        if (pat>=patEnd) parseError("\\ at end of pattern");
+        ch = *pat++;
+        if (ch=='b') { emit(out, RE_WORDB); return; }
+        if (ch=='B') { emit(out, RE_NWORDB); return; }
+        if (ch>='1' && ch<='9') parseError("backreferences aren't supported");
+        if (isNamedClass(ch)) {
+            unsigned char bits[32];
+            memset(bits, 0, sizeof(bits));
+            addNamedClass(bits, ch);
+            emit(out, RE_CLASS, 0, addClass(bits));
+            return;
+        }
+        switch (ch) {
+        case 'n': ch = '\n'; break;
+        case 'r': ch = '\r'; break;
+        case 't': ch = '\t'; break;
+        case 'f': ch = '\f'; break;
+        case 'v': ch = '\v'; break;
+        case '0': ch = 0; break;
+        }
+        break;
+    }
+    emit(out, RE_CHAR, ignoreCase ? tolower((unsigned char)ch) : (unsigned char)ch);
+}
+
+void CScriptRegExp::parseClass(Fragment &out) {
+    unsigned char bits[32];
+    memset(bits, 0, sizeof(bits));
+    bool negate = pat<patEnd && *pat=='^';
+    if (negate) pat++;
+    bool first = true;
+    while (pat<patEnd && (*pat!=']' || first)) {
+        first = false;
+        unsigned char lo = *pat++;
+        if (lo=='\\' && pat<patEnd) {
+            char e = *pat++;
+            if (isNamedClass(e)) {
+                addNamedClass(bits, e);
+                continue;
+            }
+            lo = e=='n' ? '\n' : e=='r' ? '\r' : e=='t' ? '\t' : e=='f' ? '\f' :
+                 e=='v' ? '\v' : e=='0' ? 0 : e;
+        }
+        unsigned char hi = lo;
+        if (pat+1<patEnd && *pat=='-' && pat[1]!=']') {
+            pat++;
+            hi = *pat++;
+            if (hi=='\\' && pat<patEnd) hi = *pat++;
+            if (hi<lo) parseError("range out of order in []");
+        }
+        for (int c=lo;c<=hi;c++) setBit(bits, c);
+    }
+    if (pat>=patEnd) parseError("missing ']'");
+    pat++;
+    if (ignoreCase)
+        for (int c=0;c<256;c++)
+            if (testBit(bits, c)) {
+                setBit(bits, tolower(c));
+                setBit(bits, toupper(c));
+            }
+    if (negate)
+        for (int i=0;i<32;i++) bits[i] = ~bits[i];
+    emit(out, RE_CLASS, 0, addClass(bits));
+}
+
+// ----------------------------------------------- Matcher
+
+enum {
+    BT_BRANCH, // resume at pc, sp
+    BT_CAPTURE, // put the old value back in capture slot 'count'
+    BT_STAR // resume at pc, sp+count, then one character shorter
+};
+
+struct CScriptRegExpBacktrack {
+    int kind;
+    int pc;
+    int sp; ///< input position, or the old capture value
+    int count;
+};
+
+bool CScriptRegExp::matchChar(const Inst &in, unsigned char ch) {
+    if (in.op==RE_CHAR) return (ignoreCase ? tolower(ch) : ch)==in.c;
+    if (in.op==RE_ANY) return ch!='\n' && ch!='\r';
+    return testBit(&classes[in.x*32], ch);
+}
+
+bool CScriptRegExp::matchHere(const char *str, size_t len, size_t start, int *caps, unsigned long &steps) {
+    vector<CScriptRegExpBacktrack> stack;
+    CScriptRegExpBacktrack entry;
+    size_t pc = 0, sp = start;
+    for (;;) {
+        if (++steps > stepLimit)
+            throw new CScriptException("RegExp step limit exceeded");
+        const Inst &in = program[pc];
+        bool ok = true;
+        entry.kind = -1;
+        switch (in.op) {
+        case RE_CHAR:
+        case RE_ANY:
+        case RE_CLASS:
+            ok = sp<len && matchChar(in, str[sp]);
+            sp++; pc++;
+            break;
+        case RE_STAR: {
+            // greedy repeat of the single character test that follows
+            size_t n = 0;
+            while (sp+n<len && matchChar(program[pc+1], str[sp+n])) n++;
+            steps += n;
+            pc += 2;
+            if (n>0) {
+                entry.kind = BT_STAR;
+                entry.pc = pc;
+                entry.sp = sp;
+                entry.count = n-1;
+                sp += n;
+            }
+            break;
+        }
+        case RE_BOL:
+            ok = sp==0 || (multiline && str[sp-1]=='\n');
+            pc++;
+            break;
+        case RE_EOL:
+            ok = sp==len || (multiline && str[sp]=='\n');
+            pc++;
+            break;
+        case RE_WORDB:
+        case RE_NWORDB:
+            ok = ((sp>0 && isWordChar(str[sp-1])) != (sp<len && isWordChar(str[sp]))) == (in.op==RE_WORDB);
+            pc++;
+            break;
+        case RE_SPLIT:
+            entry.kind = BT_BRANCH;
+            entry.pc = pc+in.y;
+            entry.sp = sp;
+            pc += in.x;
+            break;
+        case RE_SAVE:
+            entry.kind = BT_CAPTURE;
+            entry.count = in.c;
+            entry.sp = caps[in.c];
+            caps[in.c] = sp;
+            pc++;
+            break;
+        case RE_JMP:
+            pc += in.x;
+            break;
+        case RE_MATCH:
+            return true;
+        }
+        if (entry.kind>=0) {
+            if (stack.size() >= TINYJS_REGEXP_MAX_STACK)
+                throw new CScriptException("RegExp too complex (backtrack stack full)");
+            stack.push_back(entry);
+        }
+        if (ok) continue;
+        // backtrack, undoing captures on the way
+        for (;;) {
+            if (stack.empty()) return false;
+            CScriptRegExpBacktrack &top = stack.back();
+            if (top.kind==BT_CAPTURE) {
+                caps[top.count] = top.sp;
+                stack.pop_back();
+                continue;
+            }
+            pc = top.pc;
+            if (top.kind==BT_STAR) {
+                sp = top.sp + top.count;
+                if (top.count-- == 0) stack.pop_back();
+            } else {
+                sp = top.sp;
+                stack.pop_back();
+            }
+            break;
+        }
+    }
+}
+
+bool CScriptRegExp::search(const char *str, size_t len, size_t from, int *caps) {
+    unsigned long steps = 0;
+    for (size_t start=from;start<=len;start++) {
+        if (!prefix.empty()) {
+            start = findString(str, len, prefix.data(), prefix.size(), start);
+            if (start==string::npos) return false;
+        }
+        for (int i=0;i<groups*2;i++) caps[i] = -1;
+        if (matchHere(str, len, start, caps, steps)) return true;
+        if (anchored) break;
+    }
+    return false;
+}
+
+// ----------------------------------------------- Compiled pattern cache
+
+/* RegExp objects are plain script objects with no way to free anything
+   when they go, so compiled programs are kept here instead, looked up by
+   flags and source. The oldest is dropped when it's full - unless it is
+   pinned, as String.replace does while a replacement function runs, which
+   may compile patterns of its own. */
+static vector<CScriptRegExp*> regexpCache;
+
+static CScriptRegExp *getCompiled(const string &source, const string &flags) {
+    for (size_t i=0;i<regexpCache.size();i++) {
+        CScriptRegExp *re = regexpCache[i];
+        if (re->source == source && re->flags == flags) return re;
+    }
+    CScriptRegExp *re = new CScriptRegExp(source, flags);
+    // if they're all pinned, the cache grows until they aren't
+    for (size_t i=0;i<regexpCache.size() && regexpCache.size()>=TINYJS_REGEXP_CACHE;) {
+        if (regexpCache[i]->pins) {
+            i++;
+            continue;
+        }
+        delete regexpCache[i];
+        regexpCache.erase(regexpCache.begin()+i);
+    }
+    regexpCache.push_back(re);
+    return re;
+}
+
+static CScriptVar *getRegExpClass(CTinyJS *tinyJS) {
+    CScriptVarLink *link = tinyJS->root->findChild("RegExp");
+    return link ? link->var : 0;
+}
+
+static bool isRegExp(CTinyJS *tinyJS, CScriptVar *v) {
+    if (!v->isObject()) return false;
+    CScriptVarLink *proto = v->findChild(TINYJS_PROTOTYPE_CLASS);
+    return proto && proto->var==getRegExpClass(tinyJS);
+}
+
+static const string &getStringChild(CScriptVar *v, const char *name) {
+    return v->findChildOrCreate(name)->var->getString();
+}
+
+/// The compiled pattern for a RegExp object, or a string compiled as a pattern
+static CScriptRegExp *getCompiled(CTinyJS *tinyJS, CScriptVar *v) {
+    if (isRegExp(tinyJS, v))
+        return getCompiled(getStringChild(v, "source"), getStringChild(v, "flags"));
+    return getCompiled(v->getString(), "");
+}
+
+/// Make the array exec() and match() return: the match, then the groups
+static CScriptVar *newMatchArray(CScriptRegExp *re, const string &str, int *caps) {
+    CScriptVar *result = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_ARRAY);
+    for (int i=0;i<re->groups;i++) {
+        if (caps[i*2]<0)
+            result->setArrayIndex(i, new CScriptVar());
+        else
+            result->setArrayIndex(i, new CScriptVar(str.substr(caps[i*2], caps[i*2+1]-caps[i*2])));
+    }
+    result->addChild("index", new CScriptVar(caps[0]));
+    return result;
+}
+
+/// Expand $&, $1..$9, $`, $' and $$ in a replacement string
+static void appendReplacement(string &result, const string &replacement, const string &str, int *caps, int groups) {
+    for (size_t i=0;i<replacement.size();i++) {
+        char ch = replacement[i];
+        if (ch!='$' || i+1>=replacement.size()) {
+            result += ch;
+            continue;
+        }
+        char n = replacement[i+1];
+        if (n=='$') result += '$';
+        else if (n=='&') result.append(str, caps[0], caps[1]-caps[0]);
+        else if (n=='`') result.append(str, 0, caps[0]);
+        else if (n=='\'') result.append(str, caps[1], string::npos);
+        else if (n>='1' && n<='9' && n-'0'<groups) {
+            int g = n-'0';
+            if (caps[g*2]>=0) result.append(str, caps[g*2], caps[g*2+1]-caps[g*2]);
+        } else {
+            result += ch;
+            continue;
+        }
+        i++;
+    }
+}
+
+/// Call a replacement function with the match, the groups, the index and the string
+static bool callReplacement(CTinyJS *tinyJS, string &result, CScriptVar *fn, const string &str, int *caps, int groups) {
+    CScriptVar *args[TINYJS_REGEXP_MAX_GROUPS+2];
+    int argCount = 0;
+    for (int i=0;i<groups;i++) {
+        if (caps[i*2]<0) args[argCount++] = new CScriptVar();
+        else args[argCount++] = new CScriptVar(str.substr(caps[i*2], caps[i*2+1]-caps[i*2]));
+    }
+    args[argCount++] = new CScriptVar(caps[0]);
+    args[argCount++] = new CScriptVar(str);
+    for (int i=0;i<argCount;i++) args[i]->ref();
+    CScriptVarLink *r = tinyJS->callFunction(fn, 0, args, argCount);
+    for (int i=0;i<argCount;i++) args[i]->unref();
+    if (!r) return false;
+    result += r->var->getString();
+    delete r;
+    return true;
+}
+
+// ----------------------------------------------- Actual Functions
+
+void scRegExpConstructor(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    CScriptVar *obj = c->getParameter("this");
+    CScriptVar *pattern = c->getParameter("pattern");
+    CScriptVar *flagsVar = c->getParameter("flags");
+    string source, flags;
+    if (isRegExp(tinyJS, pattern)) {
+        source = getStringChild(pattern, "source");
+        flags = getStringChild(pattern, "flags");
+    } else if (!pattern->isUndefined())
+        source = pattern->getString();
+    if (!flagsVar->isUndefined()) flags = flagsVar->getString();
+    CScriptRegExp *re = getCompiled(source, flags); // report syntax errors now
+    obj->addChildNoDup("source", new CScriptVar(source));
+    obj->addChildNoDup("flags", new CScriptVar(flags));
+    obj->addChildNoDup("global", new CScriptVar((int)re->global));
+    obj->addChildNoDup("ignoreCase", new CScriptVar((int)re->ignoreCase));
+    obj->addChildNoDup("multiline", new CScriptVar((int)re->multiline));
+    obj->addChildNoDup("lastIndex", new CScriptVar(0));
+}
+
+/// Search from lastIndex for global patterns and update it, as exec()/test() do
+static bool regExpExec(CTinyJS *tinyJS, CScriptVar *c, CScriptRegExp *&re, int *caps) {
+    CScriptVar *obj = c->getParameter("this");
+    const string &str = c->getParameter("str")->getString();
+    re = getCompiled(tinyJS, obj);
+    size_t from = re->global ? obj->findChildOrCreate("lastIndex")->var->getInt() : 0;
+    bool found = from<=str.size() && re->search(str.data(), str.size(), from, caps);
+    // a new value, as a script may have set lastIndex to a shared constant
+    if (re->global) obj->addChildNoDup("lastIndex", new CScriptVar(found ? caps[1] : 0));
+    return found;
+}
+
+void scRegExpTest(CScriptVar *c, void *data) {
+    CScriptRegExp *re;
+    int caps[TINYJS_REGEXP_MAX_GROUPS*2];
+    c->getReturnVar()->setInt(regExpExec((CTinyJS *)data, c, re, caps));
+}
+
+void scRegExpExec(CScriptVar *c, void *data) {
+    CScriptRegExp *re;
+    int caps[TINYJS_REGEXP_MAX_GROUPS*2];
+    if (regExpExec((CTinyJS *)data, c, re, caps))
+        c->setReturnVar(newMatchArray(re, c->getParameter("str")->getString(), caps));
+    else
+        c->setReturnVar(new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_NULL));
+}
+
+void scRegExpSetStepLimit(CScriptVar *c, void *) {
+    int limit = c->getParameter("steps")->getInt();
+    c->getReturnVar()->setInt(CScriptRegExp::stepLimit);
+    CScriptRegExp::stepLimit = limit>0 ? limit : TINYJS_REGEXP_STEP_LIMIT;
+}
+
+void scStringMatch(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    const string &str = c->getParameter("this")->getString();
+    CScriptRegExp *re = getCompiled(tinyJS, c->getParameter("pattern"));
+    int caps[TINYJS_REGEXP_MAX_GROUPS*2];
+    if (!re->global) {
+        if (re->search(str.data(), str.size(), 0, caps))
+            c->setReturnVar(newMatchArray(re, str, caps));
+        else
+            c->setReturnVar(new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_NULL));
+        return;
+    }
+    // global - every match, but no groups
+    CScriptVar *result = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_ARRAY);
+    int count = 0;
+    size_t from = 0;
+    while (from<=str.size() && re->search(str.data(), str.size(), from, caps)) {
+        result->setArrayIndex(count++, new CScriptVar(str.substr(caps[0], caps[1]-caps[0])));
+        from = caps[1]>caps[0] ? caps[1] : caps[1]+1;
+    }
+    if (count==0) {
+        delete result;
+        result = new CScriptVar(TINYJS_BLANK_DATA, SCRIPTVAR_NULL);
+    }
+    c->setReturnVar(result);
+}
+
+void scStringSearch(CScriptVar *c, void *data) {
+    const string &str = c->getParameter("this")->getString();
+    CScriptRegExp *re = getCompiled((CTinyJS *)data, c->getParameter("pattern"));
+    int caps[TINYJS_REGEXP_MAX_GROUPS*2];
+    c->getReturnVar()->setInt(re->search(str.data(), str.size(), 0, caps) ? caps[0] : -1);
+}
+
+/* Replaces String.replace from TinyJS_Functions.cpp: a string pattern still
+   replaces its first occurrence, but both kinds of pattern now understand
+   $ patterns and replacement functions. */
+void scStringReplaceRegExp(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    const string &str = c->getParameter("this")->getString();
+    CScriptVar *search = c->getParameter("search");
+    CScriptVar *replacement = c->getParameter("replacement");
+    CScriptRegExp *re = 0;
+    int caps[TINYJS_REGEXP_MAX_GROUPS*2];
+    int groups = 1;
+    if (isRegExp(tinyJS, search)) {
+        re = getCompiled(tinyJS, search);
+        groups = re->groups;
+    }
+    CScriptRegExpPin pin(re);
+
+    string result;
+    size_t from = 0, copied = 0;
+    for (;;) {
+        if (re) {
+            if (from>str.size() || !re->search(str.data(), str.size(), from, caps)) break;
+        } else {
+            const string &s = search->getString();
+            size_t p = findString(str.data(), str.size(), s.data(), s.size(), 0);
+            if (p==string::npos) break;
+            caps[0] = p;
+            caps[1] = p+s.size();
+        }
+        result.append(str, copied, caps[0]-copied);
+        if (replacement->isFunction()) {
+            if (!callReplacement(tinyJS, result, replacement, str, caps, groups)) return;
+        } else
+            appendReplacement(result, replacement->getString(), str, caps, groups);
+        copied = caps[1];
+        if (!re || !re->global) break;
+        from = caps[1]>caps[0] ? caps[1] : caps[1]+1;
+    }
+    result.append(str, copied, string::npos);
+    c->getReturnVar()->setString(result);
+}
+
+// ----------------------------------------------- Register Functions
+void registerRegExpFunctions(CTinyJS *tinyJS) {
+    tinyJS->addNative("function RegExp.constructor(pattern, flags)", scRegExpConstructor, tinyJS); // new RegExp("a+b", "gi")
+    tinyJS->addNative("function RegExp.test(str)", scRegExpTest, tinyJS);
+    tinyJS->addNative("function RegExp.exec(str)", scRegExpExec, tinyJS); // [match, groups...] with .index, or null
+    tinyJS->addNative("function RegExp.setStepLimit(steps)", scRegExpSetStepLimit, 0); // returns the old limit
+    tinyJS->addNative("function String.match(pattern)", scStringMatch, tinyJS);
+    tinyJS->addNative("function String.search(pattern)", scStringSearch, tinyJS);
+    tinyJS->addNative("function String.replace(search, replacement)", scStringReplaceRegExp, tinyJS);
+}
@@ -0,0 +1,36 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Clocks
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_TIME_H
+#define TINYJS_TIME_H
+
+#include "TinyJS.h"
+
+/* A monotonic clock: CLOCK_MONOTONIC on the host, and on the board the
+   DWT cycle counter that the TM driver uses (halGetCounterValue()), kept
+   from wrapping by the system tick - or just the tick where the HAL has
+   no counter. The functions are bound natives, so reading the clock
+   allocates nothing but the number returned.
+
+     micros(), millis() - ints that wrap like a 32 bit counter, so the
+                          difference of two is right for ~35 minutes or ~24 days
+     performance.now() - milliseconds since startup, as a double with the
+                         counter's resolution
+     console.time(label), console.timeEnd(label) - print "label: 1.234ms" for
+                         the time between them (timeEnd also returns it).
+                         label defaults to "default" */
+
+/// Nanoseconds since the clock was first read
+extern unsigned long long jsTimeNanos();
+
+/// Register micros(), millis(), performance.now() and console.time/timeEnd
+extern void registerTimeFunctions(CTinyJS *tinyJS);
+
+#endif
@@ -6,7 +6,9 @@
 #include <stdlib.h>
 #endif
 
-void *operator new(size_t size) throw () {
+/* Weak, so the accounting versions in TinyJS_Memory.cpp take over when
+   TinyJS is linked in */
+__attribute__((weak)) void *operator new(size_t size) throw () {
 #ifdef USE_MALLOC_NEW
 	void *ptr = malloc(size);
 	if (!ptr)
@@ -17,7 +19,7 @@ void *operator new(size_t size) throw () {
 #endif
 }
 
-void *operator new[](size_t size) throw () {
+__attribute__((weak)) void *operator new[](size_t size) throw () {
 #ifdef USE_MALLOC_NEW
 	void *ptr = malloc(size);
 	if (!ptr)
@@ -28,13 +30,13 @@ void *operator new[](size_t size) throw () {
 #endif
 }
 
-void operator delete(void *p) throw () {
+__attribute__((weak)) void operator delete(void *p) throw () {
 #ifdef USE_MALLOC_NEW
 	free(p);
 #endif
 }
 
-void operator delete[](void *p) throw () {
+__attribute__((weak)) void operator delete[](void *p) throw () {
 #ifdef USE_MALLOC_NEW
 	free(p);
 #endif
@@ -32,18 +32,28 @@
 
 #include "TinyJS.h"
 #include "TinyJS_Functions.h"
+#include "TinyJS_Modules.h"
+#include "TinyJS_Profiler.h"
+#include "TinyJS_RegExp.h"
+#include "TinyJS_Memory.h"
+#include "TinyJS_FS.h"
+#include "TinyJS_Collections.h"
+#include "TinyJS_Time.h"
+#include "TinyJS_Binary.h"
+#include "TinyJS_Checksum.h"
+#include "TinyJS_AllocTrace.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <ctype.h>
 #ifdef __linux__
 #include <termios.h>
 #endif
 
 #include <iostream>     // std::cout
-#include <fstream>      // std::ifstream
 #include <string>       // std::string
 
 #include "rdline.h"
@@ -75,16 +85,22 @@ static int rdline_stdout_get(void) {
 static const rdline_cfg_t rdline_stdout =
 		{ rdline_stdout_put, rdline_stdout_get };
 
-static std::string readall(const char *filename) {
-	std::ifstream is(filename, std::ifstream::in);
-	if (is) {
-		std::string text;
-		text.resize(8192);
-		is.read(&text[0], text.size());
-		is.close();
-		return text;
+/* Statements are run as they are read, so a script doesn't need to fit in
+   memory as a whole */
+static void runfile(CTinyJS *js, const char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("ERROR: Unable to open '%s'\n", filename);
+		return;
 	}
-	return std::string();
+	CScriptFdReader reader(fd);
+	try {
+		js->execute(&reader);
+	} catch (CScriptException *e) {
+		printf("ERROR: %s\n", e->text.c_str());
+		delete e;
+	}
+	close(fd);
 }
 
 #ifdef __linux__
@@ -101,6 +117,15 @@ extern "C" int js_main(int argc, char **argv)
 	CTinyJS *js = new CTinyJS();
 	/* add the functions from TinyJS_Functions.cpp */
 	registerFunctions(js);
+	registerModuleFunctions(js);
+	registerProfilerFunctions(js);
+	registerRegExpFunctions(js);
+	registerMemoryFunctions(js);
+	registerFSFunctions(js);
+	registerCollectionFunctions(js);
+	registerTimeFunctions(js);
+	registerBinaryFunctions(js);
+	registerChecksumFunctions(js);
 	/* Add a native function */
 	js->addNative("function print(text)", &js_print, 0);
 	js->addNative("function dump()", &js_dump, js);
@@ -108,7 +133,7 @@ extern "C" int js_main(int argc, char **argv)
 	 we wanted something returned */
 	if (argc > 1) {
 		for (int i = 1; i < argc; i++)
-			js->execute(readall(argv[1]));
+			runfile(js, argv[i]);
 	} else {
 		try {
 			js->execute("var lets_quit = 0;"
@@ -139,6 +164,11 @@ extern "C" int js_main(int argc, char **argv)
 			}
 		}
 	}
+#ifdef TINYJS_TRACE_ALLOC
+	jsAllocTrace.dumpSites();
+	jsAllocTrace.dumpLifetimes();
+	jsAllocTrace.dumpHeap(js->root);
+#endif
 	delete js;
 	return 0;
 }
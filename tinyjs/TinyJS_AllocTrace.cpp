@@ -0,0 +1,232 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Allocation tracing
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_AllocTrace.h"
+
+#ifdef TINYJS_TRACE_ALLOC
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+
+using namespace std;
+
+CScriptAllocTrace jsAllocTrace;
+
+static const char *typeNames[TINYJS_TRACE_TYPES] = { "number", "string", "object", "array", "function", "other" };
+
+static int typeOf(CScriptVar *v) {
+    if (v->isNumeric()) return 0;
+    if (v->isString()) return 1;
+    if (v->isArray()) return 3;
+    if (v->isFunction()) return 4;
+    if (v->isObject()) return 2;
+    return 5;
+}
+
+CScriptAllocTrace::CScriptAllocTrace() {
+    busy = false;
+    clock = 0;
+    reset();
+    running = true;
+}
+
+CScriptAllocTrace::~CScriptAllocTrace() {
+    running = false;
+}
+
+void CScriptAllocTrace::reset() {
+    bool wasRunning = running;
+    running = false;
+    sites.clear();
+    siteIndex.clear();
+    lexSites.clear();
+    stack.clear();
+    Frame global = { "<global>", false, 0, 0 };
+    stack.push_back(global);
+    site = -1;
+    memset(lifetimes, 0, sizeof(lifetimes));
+    running = wasRunning;
+}
+
+void CScriptAllocTrace::enter(const string &function, bool native) {
+    busy = true;
+    Frame frame = { function, native, 0, 0 };
+    stack.push_back(frame);
+    site = -1;
+    busy = false;
+}
+
+void CScriptAllocTrace::leave() {
+    if (stack.size()>1) stack.pop_back();
+    site = -1;
+}
+
+void CScriptAllocTrace::statement(CScriptLex *lex) {
+    stack.back().lex = lex;
+    stack.back().pos = lex->tokenStart;
+    site = -1;
+}
+
+void CScriptAllocTrace::forget(CScriptLex *lex) {
+    busy = true;
+    lexSites.erase(lexSites.lower_bound(make_pair(lex, -1)),
+                   lexSites.upper_bound(make_pair(lex, 0x7FFFFFFF)));
+    for (size_t i=0;i<stack.size();i++)
+        if (stack[i].lex == lex) stack[i].lex = 0;
+    site = -1;
+    busy = false;
+}
+
+/// Find (or add) the site for the statement or native running now
+int CScriptAllocTrace::findSite() {
+    Frame &frame = stack.back();
+    pair<CScriptLex*, int> at(frame.lex, frame.pos);
+    if (frame.lex) {
+        map<pair<CScriptLex*, int>, int>::iterator it = lexSites.find(at);
+        if (it!=lexSites.end()) return it->second;
+    }
+    string name = frame.function;
+    if (frame.native) {
+        name += " (native)";
+    } else if (frame.lex) {
+        char line[16];
+        snprintf(line, sizeof(line), ":%d", frame.lex->getLine(frame.pos));
+        name += line;
+    }
+    int index;
+    map<string, int>::iterator it = siteIndex.find(name);
+    if (it!=siteIndex.end()) {
+        index = it->second;
+    } else {
+        index = (int)sites.size();
+        Site s = { name, 0, 0 };
+        sites.push_back(s);
+        siteIndex[name] = index;
+    }
+    if (frame.lex) lexSites[at] = index;
+    return index;
+}
+
+void CScriptAllocTrace::allocated(size_t size) {
+    if (!running || busy) return;
+    busy = true;
+    clock++;
+    if (site<0) site = findSite();
+    sites[site].blocks++;
+    sites[site].bytes += size;
+    busy = false;
+}
+
+void CScriptAllocTrace::died(CScriptVar *var) {
+    if (!running) return;
+    unsigned long age = clock - var->birth;
+    int bucket = 0;
+    while (age>1 && bucket<TINYJS_TRACE_LIFETIME_BUCKETS-1) {
+        age >>= 1;
+        bucket++;
+    }
+    lifetimes[typeOf(var)][bucket]++;
+}
+
+// ----------------------------------------------- Reports
+static bool byBytes(const pair<unsigned long, string> &a, const pair<unsigned long, string> &b) {
+    return a.first > b.first;
+}
+
+void CScriptAllocTrace::dumpSites() {
+    busy = true;
+    vector<pair<unsigned long, string> > rows;
+    unsigned long total = 0;
+    for (size_t i=0;i<sites.size();i++) {
+        char counts[48];
+        snprintf(counts, sizeof(counts), "%8lu  ", sites[i].blocks);
+        rows.push_back(make_pair(sites[i].bytes, counts + sites[i].name));
+        total += sites[i].bytes;
+    }
+    sort(rows.begin(), rows.end(), byBytes);
+    printf("%lu bytes allocated\n", total);
+    printf("     bytes    blocks  site\n");
+    for (size_t i=0;i<rows.size();i++)
+        printf("%10lu  %s\n", rows[i].first, rows[i].second.c_str());
+    busy = false;
+}
+
+void CScriptAllocTrace::dumpLifetimes() {
+    printf("lifetime (allocations)");
+    for (int t=0;t<TINYJS_TRACE_TYPES;t++) printf(" %9s", typeNames[t]);
+    printf("\n");
+    int last = 0;
+    for (int b=0;b<TINYJS_TRACE_LIFETIME_BUCKETS;b++)
+        for (int t=0;t<TINYJS_TRACE_TYPES;t++)
+            if (lifetimes[t][b]) last = b;
+    for (int b=0;b<=last;b++) {
+        char upTo[24];
+        snprintf(upTo, sizeof(upTo), "<%lu", 2UL<<b);
+        printf("%22s", upTo);
+        for (int t=0;t<TINYJS_TRACE_TYPES;t++) printf(" %9lu", lifetimes[t][b]);
+        printf("\n");
+    }
+}
+
+/// Size of a var itself and its links - not of the vars it links to
+static size_t varSize(CScriptVar *v) {
+    size_t size = sizeof(CScriptVar);
+    if (v->isString() || v->isFunction())
+        size += v->getString().size();
+    for (CScriptVarLink *link = v->firstChild; link; link = link->nextSibling)
+        size += sizeof(CScriptVarLink) + link->name.size();
+    return size;
+}
+
+void CScriptAllocTrace::dumpHeap(CScriptVar *root) {
+    busy = true;
+    // which global each var is reachable from, or -1 if from more than one
+    map<CScriptVar*, int> owner;
+    vector<string> names;
+    for (CScriptVarLink *global = root->firstChild; global; global = global->nextSibling) {
+        int index = (int)names.size();
+        names.push_back(global->name);
+        set<CScriptVar*> seen;
+        vector<CScriptVar*> todo(1, global->var);
+        while (!todo.empty()) {
+            CScriptVar *v = todo.back();
+            todo.pop_back();
+            if (v==root || !seen.insert(v).second) continue;
+            map<CScriptVar*, int>::iterator it = owner.find(v);
+            if (it==owner.end()) owner[v] = index;
+            else if (it->second!=index) it->second = -1;
+            for (CScriptVarLink *link = v->firstChild; link; link = link->nextSibling)
+                todo.push_back(link->var);
+        }
+    }
+    vector<unsigned long> retained(names.size()+1, 0), count(names.size()+1, 0);
+    map<CScriptVar*, int>::iterator it;
+    for (it=owner.begin();it!=owner.end();it++) {
+        size_t i = it->second<0 ? names.size() : it->second;
+        retained[i] += varSize(it->first);
+        count[i]++;
+    }
+    names.push_back("<shared>");
+    vector<pair<unsigned long, string> > rows;
+    for (size_t i=0;i<names.size();i++) {
+        char counts[48];
+        snprintf(counts, sizeof(counts), "%8lu  ", count[i]);
+        rows.push_back(make_pair(retained[i], counts + names[i]));
+    }
+    sort(rows.begin(), rows.end(), byBytes);
+    printf("  retained      vars  root\n");
+    for (size_t i=0;i<rows.size();i++)
+        printf("%10lu  %s\n", rows[i].first, rows[i].second.c_str());
+    busy = false;
+}
+
+#endif
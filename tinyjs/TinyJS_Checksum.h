@@ -0,0 +1,41 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Checksums
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_CHECKSUM_H
+#define TINYJS_CHECKSUM_H
+
+#include "TinyJS.h"
+
+/* Checksums of a string or Buffer (see TinyJS.h) in one native call, so
+   a packet payload isn't walked a byte per script iteration. Each takes
+   the part of 'data' from 'offset' (or 0) for 'length' (or the rest)
+   bytes, and a value from a previous call to carry on from - so
+   crc32(b, 0, undefined, crc32(a)) == crc32(a + b).
+
+     checksum.crc32(data, offset, length, crc) - as zlib, Ethernet and PNG
+     checksum.crc16(data, offset, length, crc) - CCITT (0x1021), starting
+                                                 from 0xFFFF unless 'crc' is given
+     checksum.adler32(data, offset, length, adler) - as zlib
+     checksum.fletcher16(data, offset, length)
+     checksum.fletcher32(data, offset, length) - over little endian 16 bit
+                                                 words, an odd byte padded with 0
+
+   On an STM32 with a CRC unit, a CRC32 not carrying on from a previous
+   one is worked out by the unit a word at a time. Otherwise - and on the
+   host - it's table driven, TINYJS_CRC32_SLICES bytes at a time: 1 on the
+   board, where the table is in flash, and 8 on the host. */
+
+/// CRC32 of 'len' bytes, carrying on from 'crc' (0 to start)
+extern unsigned int jsCRC32(const unsigned char *p, size_t len, unsigned int crc);
+
+/// Register the checksum functions
+extern void registerChecksumFunctions(CTinyJS *tinyJS);
+
+#endif
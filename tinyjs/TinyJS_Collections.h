@@ -0,0 +1,39 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Map and Set
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_COLLECTIONS_H
+#define TINYJS_COLLECTIONS_H
+
+#include "TinyJS.h"
+
+/* new Map() and new Set() are objects whose entries are kept in a
+   CScriptHash (see TinyJS.h) rather than as children, so finding a key
+   doesn't compare it with every other one - and keys needn't be strings.
+   Numbers are keys by value, strings by contents and anything else -
+   empty objects and arrays too - by identity. Both iterate in the order entries were added.
+
+     new Map(pairs) - pairs is an optional array of [key, value] arrays
+     map.set(key, value) (returns the map), map.get(key), map.has(key),
+     map.delete(key), map.clear(), map.size, map.forEach(callback(value, key, map)),
+     map.keys(), map.values(), map.entries() - arrays of what's there now
+     new Set(values) - values is an optional array
+     set.add(value) (returns the set), set.has(value), set.delete(value), set.clear(),
+     set.size, set.forEach(callback(value, value, set)), set.values(),
+     set.keys() (the values too), set.entries() - [[value, value], ...]
+     map/set.memoryUsage() - bytes the entry table takes, not counting the keys and values
+
+   JSON.stringify writes a Map as its entries, [[key, value], ...], so keys
+   1 and "1" stay apart and new Map(eval(json)) gives it back, and a
+   Set as an array of its values. */
+
+/// Register Map and Set
+extern void registerCollectionFunctions(CTinyJS *tinyJS);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Files
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_FS_H
+#define TINYJS_FS_H
+
+#include "TinyJS.h"
+
+/* Files through open(), read(), write(), lseek() and close() - which on the
+   board are the posix_* layer, so the SD card once it's mounted. Reads and
+   writes go straight between the file and the storage of a Buffer, so a
+   capture loop that refills one Buffer and writes it out allocates nothing.
+
+     fs.open(path, flags) - "r" (the default), "r+", "w", "w+", "a" or "a+", returns the fd
+     fs.read(fd, buffer, offset, length) - into 'buffer' from 'offset' (0), at most
+                                           'length' bytes (the rest of it). Returns
+                                           the bytes read, 0 at the end of the file
+     fs.write(fd, data, offset, length) - 'data' is a Buffer or a string, returns the
+                                          bytes written
+     fs.seek(fd, offset, whence) - fs.SEEK_SET (the default), SEEK_CUR or SEEK_END,
+                                   returns the new position
+     fs.close(fd)
+     fs.readLines(fd, size) - a reader whose next() puts the next line in .line,
+                              without its line end, and returns false at the end
+                              of the file. The file is read 'size' bytes (128) at a
+                              time into one Buffer, and .line is one string that's
+                              refilled in place - so copy it if it's to be kept.
+
+   Errors are thrown. */
+
+/// Register the fs module
+extern void registerFSFunctions(CTinyJS *tinyJS);
+
+#endif
@@ -32,6 +32,9 @@
 #include <math.h>
 #include <cstdlib>
 #include <sstream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
 
 using namespace std;
 // ----------------------------------------------- Actual Functions
@@ -68,14 +71,101 @@ void scCharToInt(CScriptVar *c, void *) {
     c->getReturnVar()->setInt(val);
 }
 
+/* Substring search: memchr() for single characters and short needles (it's
+   usually hand optimised), Horspool's skip table for longer ones. The skip
+   table is bytes rather than ints to keep it small on the stack - capping a
+   skip is still correct, just slower for needles over 255 characters. */
+#define STRING_SEARCH_HORSPOOL_MIN 4
+
+size_t findString(const char *hay, size_t hayLen, const char *needle, size_t needleLen, size_t from) {
+    if (from>hayLen) from = hayLen; // as JS does, so "" is found at the end
+    if (needleLen>hayLen-from) return string::npos;
+    if (needleLen==0) return from;
+    const char *end = hay+hayLen;
+    if (needleLen<STRING_SEARCH_HORSPOOL_MIN) {
+        const char *p = hay+from;
+        while ((p = (const char*)memchr(p, needle[0], (end-p)-(needleLen-1))) != 0) {
+            if (memcmp(p+1, needle+1, needleLen-1)==0) return p-hay;
+            p++;
+        }
+        return string::npos;
+    }
+    unsigned char skip[256];
+    size_t last = needleLen-1;
+    memset(skip, last>255 ? 255 : last, sizeof(skip));
+    for (size_t i=0;i<last;i++)
+        skip[(unsigned char)needle[i]] = (last-i)>255 ? 255 : (last-i);
+    const char *p = hay+from;
+    while (p+needleLen<=end) {
+        if (p[last]==needle[last] && memcmp(p, needle, last)==0) return p-hay;
+        p += skip[(unsigned char)p[last]];
+    }
+    return string::npos;
+}
+
+static size_t findLastString(const char *hay, size_t hayLen, const char *needle, size_t needleLen) {
+    if (needleLen>hayLen) return string::npos;
+    if (needleLen==0) return hayLen;
+    for (const char *p = hay+hayLen-needleLen; p>=hay; p--)
+        if (*p==needle[0] && memcmp(p, needle, needleLen)==0) return p-hay;
+    return string::npos;
+}
+
+static bool isTrimSpace(char ch) {
+    return ch==' ' || ch=='\t' || ch=='\n' || ch=='\r' || ch=='\f' || ch=='\v';
+}
+
 void scStringIndexOf(CScriptVar *c, void *) {
-    string str = c->getParameter("this")->getString();
-    string search = c->getParameter("search")->getString();
-    size_t p = str.find(search);
+    const string &str = c->getParameter("this")->getString();
+    const string &search = c->getParameter("search")->getString();
+    int from = c->getParameter("from")->getInt();
+    if (from<0) from = 0;
+    size_t p = findString(str.data(), str.size(), search.data(), search.size(), from);
     int val = (p==string::npos) ? -1 : p;
     c->getReturnVar()->setInt(val);
 }
 
+void scStringLastIndexOf(CScriptVar *c, void *) {
+    const string &str = c->getParameter("this")->getString();
+    const string &search = c->getParameter("search")->getString();
+    size_t p = findLastString(str.data(), str.size(), search.data(), search.size());
+    int val = (p==string::npos) ? -1 : p;
+    c->getReturnVar()->setInt(val);
+}
+
+void scStringStartsWith(CScriptVar *c, void *) {
+    const string &str = c->getParameter("this")->getString();
+    const string &search = c->getParameter("search")->getString();
+    c->getReturnVar()->setInt(str.size()>=search.size() &&
+                              memcmp(str.data(), search.data(), search.size())==0);
+}
+
+void scStringTrim(CScriptVar *c, void *) {
+    const string &str = c->getParameter("this")->getString();
+    size_t lo = 0, hi = str.size();
+    while (lo<hi && isTrimSpace(str[lo])) lo++;
+    while (hi>lo && isTrimSpace(str[hi-1])) hi--;
+    c->getReturnVar()->setString(str.substr(lo, hi-lo));
+}
+
+void scStringReplace(CScriptVar *c, void *) {
+    const string &str = c->getParameter("this")->getString();
+    const string &search = c->getParameter("search")->getString();
+    const string &replacement = c->getParameter("replacement")->getString();
+    // like JS, a string pattern only replaces the first match
+    size_t p = findString(str.data(), str.size(), search.data(), search.size(), 0);
+    if (p==string::npos) {
+      c->getReturnVar()->setString(str);
+      return;
+    }
+    string result;
+    result.reserve(str.size()-search.size()+replacement.size());
+    result.append(str, 0, p);
+    result.append(replacement);
+    result.append(str, p+search.size(), string::npos);
+    c->getReturnVar()->setString(result);
+}
+
 void scStringSubstring(CScriptVar *c, void *) {
     string str = c->getParameter("this")->getString();
     int lo = c->getParameter("lo")->getInt();
@@ -107,21 +197,33 @@ void scStringCharCodeAt(CScriptVar *c, void *) {
 }
 
 void scStringSplit(CScriptVar *c, void *) {
-    string str = c->getParameter("this")->getString();
-    string sep = c->getParameter("separator")->getString();
+    const string &str = c->getParameter("this")->getString();
+    CScriptVar *sepVar = c->getParameter("separator");
     CScriptVar *result = c->getReturnVar();
     result->setArray();
+    if (sepVar->isUndefined()) {
+      result->setArrayIndex(0, new CScriptVar(str));
+      return;
+    }
+    const string &sep = sepVar->getString();
+    const char *data = str.data();
+    size_t len = str.size();
     int length = 0;
 
-    size_t pos = str.find(sep);
-    while (pos != string::npos) {
-      result->setArrayIndex(length++, new CScriptVar(str.substr(0,pos)));
-      str = str.substr(pos+1);
-      pos = str.find(sep);
+    /* a single pass - the array is dense and only ever appended to, so
+       setArrayIndex() doesn't have to search for each element */
+    if (sep.empty()) {
+      for (size_t i=0;i<len;i++)
+        result->setArrayIndex(length++, new CScriptVar(string(data+i, 1)));
+      return;
     }
-
-    if (str.size()>0)
-      result->setArrayIndex(length++, new CScriptVar(str));
+    size_t start = 0;
+    size_t pos;
+    while ((pos = findString(data, len, sep.data(), sep.size(), start)) != string::npos) {
+      result->setArrayIndex(length++, new CScriptVar(string(data+start, pos-start)));
+      start = pos+sep.size();
+    }
+    result->setArrayIndex(length++, new CScriptVar(string(data+start, len-start)));
 }
 
 void scStringFromCharCode(CScriptVar *c, void *) {
@@ -158,6 +260,13 @@ void scExec(CScriptVar *c, void *data) {
     tinyJS->execute(str);
 }
 
+void scFExec(CScriptVar *c, void *data) {
+    CTinyJS *tinyJS = (CTinyJS *)data;
+    std::string str = c->getParameter("jsFile")->getString();
+    CScriptFileReader reader(str);
+    tinyJS->execute(&reader);
+}
+
 void scEval(CScriptVar *c, void *data) {
     CTinyJS *tinyJS = (CTinyJS *)data;
     std::string str = c->getParameter("jsCode")->getString();
@@ -180,49 +289,399 @@ void scArrayContains(CScriptVar *c, void *data) {
   c->getReturnVar()->setInt(contains);
 }
 
-void scArrayRemove(CScriptVar *c, void *data) {
-  CScriptVar *obj = c->getParameter("obj");
-  vector<int> removedIndices;
-  CScriptVarLink *v;
-  // remove
-  v = c->getParameter("this")->firstChild;
-  while (v) {
-      if (v->var->equals(obj)) {
-        removedIndices.push_back(v->getIntName());
-      }
-      v = v->nextSibling;
+static bool isArrayIndex(const string &name) {
+  if (name.empty()) return false;
+  for (size_t i=0;i<name.size();i++)
+    if (name[i]<'0' || name[i]>'9') return false;
+  return true;
+}
+
+/// Get the elements of an array in index order (holes are undefined). Each one is ref'd, as callbacks may change the array
+static void getArrayItems(CScriptVar *arr, vector<CScriptVar*> &items) {
+  int len = arr->getArrayLength();
+  items.assign(len, (CScriptVar*)0);
+  for (CScriptVarLink *v = arr->firstChild; v; v = v->nextSibling) {
+    if (!isArrayIndex(v->name)) continue;
+    int idx = v->getIntName();
+    if (idx<len && !items[idx]) items[idx] = v->var->ref();
   }
-  // renumber
-  v = c->getParameter("this")->firstChild;
+  for (int i=0;i<len;i++)
+    if (!items[i]) items[i] = (new CScriptVar())->ref();
+}
+
+static void releaseArrayItems(vector<CScriptVar*> &items) {
+  for (size_t i=0;i<items.size();i++)
+    items[i]->unref();
+  items.clear();
+}
+
+/// Replace the elements of an array with items[from...]
+static void setArrayItems(CScriptVar *arr, vector<CScriptVar*> &items, size_t from) {
+  CScriptVarLink *v = arr->firstChild;
   while (v) {
-      int n = v->getIntName();
-      int newn = n;
-      for (size_t i=0;i<removedIndices.size();i++)
-        if (n>=removedIndices[i])
-          newn--;
-      if (newn!=n)
-        v->setIntName(newn);
-      v = v->nextSibling;
+    CScriptVarLink *next = v->nextSibling;
+    if (isArrayIndex(v->name)) arr->removeLink(v);
+    v = next;
   }
+  // appending is O(1), and leaves the links in index order
+  for (size_t i=from;i<items.size();i++)
+    arr->setArrayIndex(i-from, items[i]);
+}
+
+/// Resolve a slice() style index, where negative values count from the end
+static int getSliceIndex(CScriptVar *v, int len, int def) {
+  if (v->isUndefined()) return def;
+  int idx = v->getInt();
+  if (idx<0) idx += len;
+  if (idx<0) idx = 0;
+  if (idx>len) idx = len;
+  return idx;
+}
+
+void scArrayRemove(CScriptVar *c, void *data) {
+  CScriptVar *obj = c->getParameter("obj");
+  CScriptVar *arr = c->getParameter("this");
+  vector<CScriptVar*> items, kept;
+  getArrayItems(arr, items);
+  for (size_t i=0;i<items.size();i++)
+    if (!items[i]->equals(obj))
+      kept.push_back(items[i]);
+  setArrayItems(arr, kept, 0);
+  releaseArrayItems(items);
 }
 
 void scArrayJoin(CScriptVar *c, void *data) {
   string sep = c->getParameter("separator")->getString();
   CScriptVar *arr = c->getParameter("this");
+  vector<CScriptVar*> items;
+  getArrayItems(arr, items);
 
   ostringstream sstr;
-  int l = arr->getArrayLength();
-  for (int i=0;i<l;i++) {
+  for (size_t i=0;i<items.size();i++) {
     if (i>0) sstr << sep;
-    sstr << arr->getArrayIndex(i)->getString();
+    if (!items[i]->isUndefined() && !items[i]->isNull())
+      sstr << items[i]->getString();
   }
+  releaseArrayItems(items);
 
   c->getReturnVar()->setString(sstr.str());
 }
 
+void scArrayPush(CScriptVar *c, void *data) {
+  CScriptVar *arr = c->getParameter("this");
+  // the length is cached and setArrayIndex() appends without searching, so this is O(1)
+  arr->setArrayIndex(arr->getArrayLength(), c->getParameter("obj"));
+  c->getReturnVar()->setInt(arr->getArrayLength());
+}
+
+void scArrayPop(CScriptVar *c, void *data) {
+  CScriptVar *arr = c->getParameter("this");
+  int len = arr->getArrayLength();
+  if (len==0) return;
+  char idx[16];
+  snprintf(idx, sizeof(idx), "%d", len-1);
+  // the last element is almost always the last link
+  CScriptVarLink *link = arr->lastChild;
+  if (!link || link->name != idx) link = arr->findChild(idx);
+  if (link) {
+    c->setReturnVar(link->var);
+    arr->removeLink(link);
+  }
+}
+
+void scArrayShift(CScriptVar *c, void *data) {
+  CScriptVar *arr = c->getParameter("this");
+  vector<CScriptVar*> items;
+  getArrayItems(arr, items);
+  if (items.empty()) return;
+  c->setReturnVar(items[0]);
+  setArrayItems(arr, items, 1);
+  releaseArrayItems(items);
+}
+
+void scArraySlice(CScriptVar *c, void *data) {
+  CScriptVar *arr = c->getParameter("this");
+  vector<CScriptVar*> items;
+  getArrayItems(arr, items);
+  int len = items.size();
+  int start = getSliceIndex(c->getParameter("start"), len, 0);
+  int end = getSliceIndex(c->getParameter("end"), len, len);
+  CScriptVar *result = c->getReturnVar();
+  result->setArray();
+  for (int i=start;i<end;i++)
+    result->setArrayIndex(i-start, items[i]->isBasic() ? items[i]->deepCopy() : items[i]);
+  releaseArrayItems(items);
+}
+
+/// Call 'callback' for each element as callback(value, index, array). Returns false if the callback failed
+static bool callForEach(CTinyJS *tinyJS, CScriptVar *c, vector<CScriptVar*> &items, CScriptVar *result, bool filter) {
+  CScriptVar *arr = c->getParameter("this");
+  CScriptVar *callback = c->getParameter("callback");
+  CScriptVar *index = (new CScriptVar(0))->ref();
+  CScriptVar *args[3] = { 0, index, arr };
+  bool ok = true;
+  int length = 0;
+  for (size_t i=0;i<items.size() && ok;i++) {
+    args[0] = items[i];
+    index->setInt(i);
+    CScriptVarLink *r = tinyJS->callFunction(callback, 0, args, 3);
+    if (!r) {
+      ok = false;
+    } else {
+      if (result && filter) {
+        if (r->var->getBool()) result->setArrayIndex(length++, items[i]);
+      } else if (result)
+        result->setArrayIndex(i, r->var);
+      delete r;
+    }
+  }
+  index->unref();
+  return ok;
+}
+
+void scArrayForEach(CScriptVar *c, void *data) {
+  vector<CScriptVar*> items;
+  getArrayItems(c->getParameter("this"), items);
+  callForEach((CTinyJS *)data, c, items, 0, false);
+  releaseArrayItems(items);
+}
+
+void scArrayMap(CScriptVar *c, void *data) {
+  vector<CScriptVar*> items;
+  getArrayItems(c->getParameter("this"), items);
+  CScriptVar *result = c->getReturnVar();
+  result->setArray();
+  callForEach((CTinyJS *)data, c, items, result, false);
+  releaseArrayItems(items);
+}
+
+void scArrayFilter(CScriptVar *c, void *data) {
+  vector<CScriptVar*> items;
+  getArrayItems(c->getParameter("this"), items);
+  CScriptVar *result = c->getReturnVar();
+  result->setArray();
+  callForEach((CTinyJS *)data, c, items, result, true);
+  releaseArrayItems(items);
+}
+
+void scArrayReduce(CScriptVar *c, void *data) {
+  CTinyJS *tinyJS = (CTinyJS *)data;
+  CScriptVar *arr = c->getParameter("this");
+  CScriptVar *callback = c->getParameter("callback");
+  CScriptVar *initial = c->getParameter("initial");
+  vector<CScriptVar*> items;
+  getArrayItems(arr, items);
+  size_t i = 0;
+  CScriptVar *acc;
+  if (!initial->isUndefined()) {
+    acc = initial->ref();
+  } else if (!items.empty()) {
+    acc = items[i++]->ref();
+  } else {
+    throw new CScriptException("Reduce of empty array with no initial value");
+  }
+  CScriptVar *index = (new CScriptVar(0))->ref();
+  CScriptVar *args[4] = { 0, 0, index, arr };
+  for (;i<items.size();i++) {
+    args[0] = acc;
+    args[1] = items[i];
+    index->setInt(i);
+    CScriptVarLink *r = tinyJS->callFunction(callback, 0, args, 4);
+    if (!r) break;
+    CScriptVar *next = r->var->ref();
+    delete r;
+    acc->unref();
+    acc = next;
+  }
+  c->setReturnVar(acc);
+  acc->unref();
+  index->unref();
+  releaseArrayItems(items);
+}
+
+/* In-place introsort: quicksort (median of three), falling back to heapsort
+   when it recurses too deep and finishing small ranges with insertion sort.
+   The comparator is a script function, so it may well be inconsistent - every
+   index is bounds checked rather than relying on sentinels. */
+struct ArraySortItem {
+  CScriptVar *var;
+  string key; ///< string value, for the default comparison
+};
+
+class ArraySorter {
+public:
+  ArraySorter(CTinyJS *tinyJS, CScriptVar *compare) {
+    this->tinyJS = tinyJS;
+    this->compare = compare;
+    failed = false;
+  }
+
+  bool failed; ///< the comparator failed, and the error is waiting for the script
+
+  void sort(vector<ArraySortItem> &v) {
+    int depth = 0;
+    for (size_t n=v.size();n>1;n>>=1) depth += 2;
+    introsort(v, 0, v.size(), depth);
+  }
+
+protected:
+  CTinyJS *tinyJS;
+  CScriptVar *compare;
+
+  bool less(ArraySortItem &a, ArraySortItem &b) {
+    if (failed) return false;
+    if (!compare) return a.key < b.key;
+    CScriptVar *args[2] = { a.var, b.var };
+    CScriptVarLink *r = tinyJS->callFunction(compare, 0, args, 2);
+    if (!r) {
+      failed = true;
+      return false;
+    }
+    bool result = r->var->getDouble() < 0;
+    delete r;
+    return result;
+  }
+
+  void insertionSort(vector<ArraySortItem> &v, size_t lo, size_t hi) {
+    for (size_t i=lo+1;i<hi;i++)
+      for (size_t j=i;j>lo && less(v[j], v[j-1]);j--)
+        swap(v[j], v[j-1]);
+  }
+
+  void siftDown(vector<ArraySortItem> &v, size_t lo, size_t root, size_t n) {
+    while (true) {
+      size_t child = root*2+1;
+      if (child>=n) return;
+      if (child+1<n && less(v[lo+child], v[lo+child+1])) child++;
+      if (!less(v[lo+root], v[lo+child])) return;
+      swap(v[lo+root], v[lo+child]);
+      root = child;
+    }
+  }
+
+  void heapSort(vector<ArraySortItem> &v, size_t lo, size_t hi) {
+    size_t n = hi-lo;
+    for (size_t i=n/2;i>0;i--)
+      siftDown(v, lo, i-1, n);
+    for (size_t end=n-1;end>0;end--) {
+      swap(v[lo], v[lo+end]);
+      siftDown(v, lo, 0, end);
+    }
+  }
+
+  void introsort(vector<ArraySortItem> &v, size_t lo, size_t hi, int depth) {
+    while (hi-lo > 16) {
+      if (depth-- <= 0) {
+        heapSort(v, lo, hi);
+        return;
+      }
+      // median of three, then move the pivot out of the way to the end
+      size_t mid = lo+(hi-lo)/2;
+      if (less(v[mid], v[lo])) swap(v[mid], v[lo]);
+      if (less(v[hi-1], v[mid])) swap(v[hi-1], v[mid]);
+      if (less(v[mid], v[lo])) swap(v[mid], v[lo]);
+      swap(v[mid], v[hi-1]);
+      size_t store = lo;
+      for (size_t i=lo;i<hi-1;i++)
+        if (less(v[i], v[hi-1]))
+          swap(v[i], v[store++]);
+      swap(v[store], v[hi-1]);
+      // recurse into the smaller side, loop on the bigger one
+      if (store-lo < hi-store-1) {
+        introsort(v, lo, store, depth);
+        lo = store+1;
+      } else {
+        introsort(v, store+1, hi, depth);
+        hi = store;
+      }
+    }
+    insertionSort(v, lo, hi);
+  }
+};
+
+void scArraySort(CScriptVar *c, void *data) {
+  CScriptVar *arr = c->getParameter("this");
+  CScriptVar *compare = c->getParameter("compare");
+  ArraySorter sorter((CTinyJS *)data, compare->isUndefined() ? 0 : compare);
+  vector<CScriptVar*> items;
+  getArrayItems(arr, items);
+
+  // undefined always goes to the end, without asking the comparator
+  vector<ArraySortItem> sorted;
+  size_t undefinedCount = 0;
+  for (size_t i=0;i<items.size();i++) {
+    if (items[i]->isUndefined()) {
+      undefinedCount++;
+      continue;
+    }
+    ArraySortItem item;
+    item.var = items[i];
+    if (compare->isUndefined()) item.key = items[i]->getString();
+    sorted.push_back(item);
+  }
+  sorter.sort(sorted);
+
+  if (!sorter.failed) {
+    vector<CScriptVar*> result;
+    for (size_t i=0;i<sorted.size();i++)
+      result.push_back(sorted[i].var);
+    setArrayItems(arr, result, 0);
+  }
+  releaseArrayItems(items);
+  c->setReturnVar(arr);
+}
+
+/* Buffers are bytes held in a single var, passed by reference. Reading
+   past the end gives undefined and writing past it does nothing, as for a
+   Uint8Array. */
+void scBufferAlloc(CScriptVar *c, void *) {
+    int size = c->getParameter("size")->getInt();
+    c->setReturnVar(new CScriptVar(string(size>0 ? size : 0, '\0'), SCRIPTVAR_BUFFER));
+}
+
+void scBufferFrom(CScriptVar *c, void *) {
+    c->setReturnVar(new CScriptVar(c->getParameter("data")->getString(), SCRIPTVAR_BUFFER));
+}
+
+void scBufferGet(CScriptVar *c, void *) {
+    const string &bytes = c->getParameter("this")->getString();
+    int i = c->getParameter("index")->getInt();
+    if (i>=0 && i<(int)bytes.size())
+      c->getReturnVar()->setInt((unsigned char)bytes[i]);
+}
+
+void scBufferSet(CScriptVar *c, void *) {
+    CScriptVar *buf = c->getParameter("this");
+    if (!buf->isBuffer()) return;
+    string &bytes = buf->getBytes();
+    int i = c->getParameter("index")->getInt();
+    if (i>=0 && i<(int)bytes.size())
+      bytes[i] = (char)c->getParameter("value")->getInt();
+}
+
+void scBufferFill(CScriptVar *c, void *) {
+    CScriptVar *buf = c->getParameter("this");
+    if (!buf->isBuffer()) return;
+    string &bytes = buf->getBytes();
+    if (!bytes.empty()) memset(&bytes[0], c->getParameter("value")->getInt(), bytes.size());
+    c->setReturnVar(buf);
+}
+
+void scBufferToString(CScriptVar *c, void *) {
+    const string &bytes = c->getParameter("this")->getString();
+    CScriptVar *startVar = c->getParameter("start");
+    CScriptVar *endVar = c->getParameter("end");
+    int start = startVar->isUndefined() ? 0 : startVar->getInt();
+    int end = endVar->isUndefined() ? (int)bytes.size() : endVar->getInt();
+    if (end>(int)bytes.size()) end = bytes.size();
+    if (start<0) start = 0;
+    c->getReturnVar()->setString(start<end ? bytes.substr(start, end-start) : "");
+}
+
 // ----------------------------------------------- Register Functions
 void registerFunctions(CTinyJS *tinyJS) {
     tinyJS->addNative("function exec(jsCode)", scExec, tinyJS); // execute the given code
+    tinyJS->addNative("function fexec(jsFile)", scFExec, tinyJS); // execute the given file, a statement at a time as it is read
     tinyJS->addNative("function eval(jsCode)", scEval, tinyJS); // execute the given string (an expression) and return the result
     tinyJS->addNative("function trace()", scTrace, tinyJS);
     tinyJS->addNative("function Object.dump()", scObjectDump, 0);
@@ -230,7 +689,11 @@ void registerFunctions(CTinyJS *tinyJS) {
     tinyJS->addNative("function Math.rand()", scMathRand, 0);
     tinyJS->addNative("function Math.randInt(min, max)", scMathRandInt, 0);
     tinyJS->addNative("function charToInt(ch)", scCharToInt, 0); //  convert a character to an int - get its value
-    tinyJS->addNative("function String.indexOf(search)", scStringIndexOf, 0); // find the position of a string in a string, -1 if not
+    tinyJS->addNative("function String.indexOf(search, from)", scStringIndexOf, 0); // find the position of a string in a string, -1 if not
+    tinyJS->addNative("function String.lastIndexOf(search)", scStringLastIndexOf, 0);
+    tinyJS->addNative("function String.startsWith(search)", scStringStartsWith, 0);
+    tinyJS->addNative("function String.trim()", scStringTrim, 0);
+    tinyJS->addNative("function String.replace(search, replacement)", scStringReplace, 0); // replace the first occurrence
     tinyJS->addNative("function String.substring(lo,hi)", scStringSubstring, 0);
     tinyJS->addNative("function String.charAt(pos)", scStringCharAt, 0);
     tinyJS->addNative("function String.charCodeAt(pos)", scStringCharCodeAt, 0);
@@ -243,5 +706,20 @@ void registerFunctions(CTinyJS *tinyJS) {
     tinyJS->addNative("function Array.contains(obj)", scArrayContains, 0);
     tinyJS->addNative("function Array.remove(obj)", scArrayRemove, 0);
     tinyJS->addNative("function Array.join(separator)", scArrayJoin, 0);
+    tinyJS->addNative("function Array.push(obj)", scArrayPush, 0); // append, returns the new length
+    tinyJS->addNative("function Array.pop()", scArrayPop, 0);
+    tinyJS->addNative("function Array.shift()", scArrayShift, 0);
+    tinyJS->addNative("function Array.slice(start, end)", scArraySlice, 0);
+    tinyJS->addNative("function Array.forEach(callback)", scArrayForEach, tinyJS); // callback(value, index, array)
+    tinyJS->addNative("function Array.map(callback)", scArrayMap, tinyJS);
+    tinyJS->addNative("function Array.filter(callback)", scArrayFilter, tinyJS);
+    tinyJS->addNative("function Array.reduce(callback, initial)", scArrayReduce, tinyJS); // callback(accumulator, value, index, array)
+    tinyJS->addNative("function Array.sort(compare)", scArraySort, tinyJS); // in place, compare(a,b) is optional
+    tinyJS->addNative("function Buffer.alloc(size)", scBufferAlloc, 0); // 'size' zero bytes
+    tinyJS->addNative("function Buffer.from(data)", scBufferFrom, 0); // a copy of the bytes of a string or buffer
+    tinyJS->addNative("function Buffer.get(index)", scBufferGet, 0); // the byte, 0-255
+    tinyJS->addNative("function Buffer.set(index, value)", scBufferSet, 0);
+    tinyJS->addNative("function Buffer.fill(value)", scBufferFill, 0); // returns the buffer
+    tinyJS->addNative("function Buffer.toString(start, end)", scBufferToString, 0); // the bytes as a string
 }
 
@@ -0,0 +1,29 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - CommonJS-style modules
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_MODULES_H
+#define TINYJS_MODULES_H
+
+#include "TinyJS.h"
+
+/* require(path) executes a file once in its own scope object (holding
+   'module', 'exports', '__filename' and '__dirname') and caches the resulting
+   module.exports by resolved path in Module.cache, so later calls only do a
+   lookup. Paths starting with './' or '../' are relative to the module that
+   is loading, and '.js' is appended when missing.
+
+   Functions defined by a module keep its scope in their scope chain (see
+   CTinyJS::moduleScope), so exported functions can still call the module's
+   private functions and use its 'var's once loading has finished. */
+
+/// Register require() and the Module.* helpers with the TinyJS interpreter
+extern void registerModuleFunctions(CTinyJS *tinyJS);
+
+#endif
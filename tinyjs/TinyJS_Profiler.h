@@ -0,0 +1,62 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Sampling profiler
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_PROFILER_H
+#define TINYJS_PROFILER_H
+
+#include "TinyJS.h"
+#include <map>
+
+/* A timer (SIGPROF on the host, a GPT timer on the board) only raises
+   'pending'. The interpreter checks it at every statement and, if set,
+   records the current call stack and the line of the current lexer. Lines
+   of functions are relative to the start of the function body.
+
+   The interpreter only calls enter/leave while the profiler is attached, so
+   start() and stop() can happen with JS functions on the stack: both forget
+   the call stack, frames that were never entered leave an empty stack alone,
+   and those entered after a start() all leave before the frame it ran in. */
+
+#define TINYJS_PROFILER_DEFAULT_HZ 1000
+
+class CScriptProfiler {
+public:
+    CScriptProfiler();
+    ~CScriptProfiler();
+
+    volatile int pending; ///< Set from the timer interrupt/signal when a sample is due
+
+    bool start(int hz=TINYJS_PROFILER_DEFAULT_HZ); ///< Start the sampling timer, with an empty call stack
+    void stop(); ///< Stop the sampling timer and forget the call stack
+    void reset(); ///< Forget all samples taken so far
+    bool isRunning() { return running; }
+
+    void enter(const std::string &function) { stack.push_back(function); } ///< A JS function has been called
+    void leave() { if (!stack.empty()) stack.pop_back(); } ///< The last JS function called has returned
+    void sample(CScriptLex *lex); ///< Take a sample at the lexer's current position
+
+    void dumpFlat(); ///< Print samples per function and line
+    void dumpCollapsed(); ///< Print samples as collapsed stacks ('a;b;c:line count'), for flame graphs
+
+protected:
+    bool running;
+    unsigned long samples;
+    std::vector<std::string> stack; ///< Names of the JS functions currently executing
+    std::map<std::string, unsigned long> flat; ///< 'function:line' -> samples
+    std::map<std::string, unsigned long> collapsed; ///< 'outer;inner:line' -> samples
+};
+
+/// The profiler used by the Profiler.* functions and the 'profile' shell command
+extern CScriptProfiler jsProfiler;
+
+/// Register the Profiler.* functions with the TinyJS interpreter
+extern void registerProfilerFunctions(CTinyJS *tinyJS);
+
+#endif
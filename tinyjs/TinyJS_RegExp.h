@@ -0,0 +1,88 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Regular expressions
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#ifndef TINYJS_REGEXP_H
+#define TINYJS_REGEXP_H
+
+#include "TinyJS.h"
+
+/* A pattern is compiled once into a small program for a backtracking
+   matcher, which runs straight on the string's buffer. Backtracking is
+   bounded twice: by the size of the backtrack stack and by the number of
+   instructions a single search may execute, so a pathological pattern
+   fails with an error instead of locking up the shell.
+
+   Supported: literals, '.', [classes], \d \w \s \D \W \S \b \B, ^ $,
+   (groups), (?:groups), |, * + ? {n} {n,} {n,m} and their lazy forms, and
+   the flags g, i and m. Not supported: backreferences and lookaround. */
+
+#define TINYJS_REGEXP_MAX_GROUPS 10 ///< Capture groups, including the whole match
+#define TINYJS_REGEXP_MAX_PROGRAM 2048 ///< Instructions in one compiled pattern
+#define TINYJS_REGEXP_MAX_STACK 1024 ///< Backtrack entries for one search
+#define TINYJS_REGEXP_STEP_LIMIT 100000 ///< Default for CScriptRegExp::stepLimit
+#define TINYJS_REGEXP_CACHE 8 ///< Compiled patterns kept around
+
+class CScriptRegExp {
+public:
+    /// Compile the pattern - throws a CScriptException if it isn't valid
+    CScriptRegExp(const std::string &pattern, const std::string &flags);
+
+    std::string source, flags; ///< What was compiled, which the cache looks it up by
+    int pins; ///< Users that need it to stay in the cache, see CScriptRegExpPin
+    bool global, ignoreCase, multiline;
+    int groups; ///< Number of groups, including the whole match
+
+    /** Find the first match starting at or after 'from'. 'caps' receives
+      * 2*groups start/end offsets, -1 for groups that didn't take part.
+      * Throws a CScriptException if the step or stack limit is hit. */
+    bool search(const char *str, size_t len, size_t from, int *caps);
+
+    static unsigned long stepLimit; ///< Instructions one search may execute
+
+protected:
+    struct Inst {
+        unsigned char op;
+        unsigned char c; ///< character, or capture slot for SAVE
+        short x, y; ///< jump offsets relative to this instruction, or class index
+    };
+    typedef std::vector<Inst> Fragment;
+
+    std::vector<Inst> program;
+    std::vector<unsigned char> classes; ///< 32 byte bitmaps, one per [class]
+    std::string prefix; ///< Literal text every match starts with (for a fast scan)
+    bool anchored; ///< Only matches at the start of the string
+
+    // compiler
+    const char *pat, *patEnd;
+    void parseAlternation(Fragment &out);
+    void parseSequence(Fragment &out);
+    void parseAtom(Fragment &out);
+    void parseClass(Fragment &out);
+    bool parseCount(int &n);
+    void parseError(const char *what);
+    int addClass(const unsigned char *bits);
+    void emit(Fragment &out, int op, int c=0, int x=0, int y=0);
+    void append(Fragment &out, const Fragment &f);
+
+    bool matchChar(const Inst &in, unsigned char ch);
+    bool matchHere(const char *str, size_t len, size_t start, int *caps, unsigned long &steps);
+};
+
+/// Keeps a cached pattern from being dropped while it is in use, across calls back into script
+struct CScriptRegExpPin {
+    CScriptRegExp *re;
+    CScriptRegExpPin(CScriptRegExp *re) { this->re = re; if (re) re->pins++; }
+    ~CScriptRegExpPin() { if (re) re->pins--; }
+};
+
+/// Register the RegExp object, String.match/search and the RegExp-aware String.replace
+extern void registerRegExpFunctions(CTinyJS *tinyJS);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Clocks
+ *
+ * Released under the same MIT license as TinyJS.cpp
+ */
+
+#include "TinyJS_Time.h"
+#include "TinyJS_Bind.h"
+#include <stdio.h>
+
+#ifdef __linux__
+#include <time.h>
+#else
+#include <ch.h>
+#include <hal.h>
+#endif
+
+using namespace std;
+
+// ----------------------------------------------- Clock
+#ifdef __linux__
+unsigned long long jsTimeNanos() {
+    static unsigned long long start = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned long long now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (!start) start = now;
+    return now-start;
+}
+#elif HAL_IMPLEMENTS_COUNTERS
+unsigned long long jsTimeNanos() {
+    static unsigned long long cycles = 0;
+    static halrtcnt_t lastCount;
+    static systime_t lastTick;
+    static bool started = false;
+    halrtcnt_t count = halGetCounterValue();
+    systime_t tick = chTimeNow();
+    if (started) {
+        unsigned long long delta = (halrtcnt_t)(count-lastCount);
+        /* The counter wraps every 2^32 cycles (25s at 168MHz), the tick
+           doesn't - so the tick says how many wraps were missed since the
+           last read, to the nearest. */
+        unsigned long long coarse = (unsigned long long)(systime_t)(tick-lastTick) * halGetCounterFrequency() / CH_FREQUENCY;
+        if (coarse > delta)
+            delta += ((coarse-delta + (1ULL<<31)) >> 32) << 32;
+        cycles += delta;
+    }
+    started = true;
+    lastCount = count;
+    lastTick = tick;
+    unsigned long long freq = halGetCounterFrequency();
+    return cycles/freq*1000000000ULL + cycles%freq*1000000000ULL/freq;
+}
+#else
+unsigned long long jsTimeNanos() {
+    static unsigned long long ticks = 0;
+    static systime_t lastTick;
+    static bool started = false;
+    systime_t tick = chTimeNow();
+    if (started) ticks += (systime_t)(tick-lastTick);
+    started = true;
+    lastTick = tick;
+    return ticks * (1000000000ULL / CH_FREQUENCY);
+}
+#endif
+
+/// console.time() labels, and when they were started
+static map<string, unsigned long long> timers;
+
+static string getLabel(CScriptVar *label) {
+    return label->isUndefined() ? string("default") : label->getString();
+}
+
+// ----------------------------------------------- Actual Functions
+int timeMicros() {
+    return (int)(unsigned int)(jsTimeNanos()/1000);
+}
+
+int timeMillis() {
+    return (int)(unsigned int)(jsTimeNanos()/1000000);
+}
+
+double timePerformanceNow() {
+    return jsTimeNanos() / 1000000.0;
+}
+
+void timeConsoleTime(CScriptVar *label) {
+    timers[getLabel(label)] = jsTimeNanos();
+}
+
+double timeConsoleTimeEnd(CScriptVar *label) {
+    unsigned long long now = jsTimeNanos();
+    string name = getLabel(label);
+    map<string, unsigned long long>::iterator it = timers.find(name);
+    if (it == timers.end())
+        throw new CScriptException("No timer '"+name+"' running");
+    double ms = (now - it->second) / 1000000.0;
+    timers.erase(it);
+    printf("%s: %.3fms\n", name.c_str(), ms);
+    return ms;
+}
+
+// ----------------------------------------------- Register Functions
+void registerTimeFunctions(CTinyJS *tinyJS) {
+    jsTimeNanos(); // start the clock
+    tinyJS->addBound("function micros()", TINYJS_BIND(timeMicros), 0);
+    tinyJS->addBound("function millis()", TINYJS_BIND(timeMillis), 0);
+    tinyJS->addBound("function performance.now()", TINYJS_BIND(timePerformanceNow), 0); // milliseconds, with a fraction
+    tinyJS->addBound("function console.time(label)", TINYJS_BIND(timeConsoleTime), 0);
+    tinyJS->addBound("function console.timeEnd(label)", TINYJS_BIND(timeConsoleTimeEnd), 0); // prints and returns the milliseconds
+}
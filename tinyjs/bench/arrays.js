@@ -0,0 +1,33 @@
+// Array fill and sort: push, indexed writes and reads, the native sort
+// with and without a compare function, map and filter. ops counts
+// elements touched.
+var ops = 0;
+
+var a = [];
+for (var i=0;i<5000;i++) {
+  a.push((i * 7919) % 5003);
+  ops++;
+}
+
+var b = [];
+for (var i=0;i<5000;i++) {
+  b[i] = a[4999-i];
+  ops++;
+}
+
+a.sort();
+ops += 5000;
+b.sort(function(x, y) { return y - x; });
+ops += 5000;
+
+var doubled = a.map(function(x) { return x*2; });
+var even = b.filter(function(x) { return (x % 2) == 0; });
+ops += 10000;
+
+var sum = 0;
+for (var i=0;i<5000;i++) {
+  sum += a[i] + b[i];
+  ops++;
+}
+
+print("first " + a[0] + " last " + b[4999] + " even " + even.length + " sum " + sum + " " + doubled[4999]);
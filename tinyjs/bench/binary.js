@@ -0,0 +1,26 @@
+// DataView and struct: CAN frames (an id, a big endian 16 bit reading
+// and a little endian float) encoded into a Buffer and decoded again,
+// and Modbus register blocks packed and unpacked. ops counts fields.
+var ops = 0;
+
+var frame = Buffer.alloc(8);
+var view = new DataView(frame);
+var sum = 0;
+for (var i=0;i<3000;i++) {
+  view.setUint16(0, 0x180 + (i % 16));
+  view.setInt16(2, i - 1500);
+  view.setFloat32(4, i * 0.25, true);
+  sum += view.getUint16(0) + view.getInt16(2) + view.getFloat32(4, true);
+  ops += 6;
+}
+
+var regs = Buffer.alloc(64);
+var checksum = 0;
+for (var i=0;i<1000;i++) {
+  struct.packInto(">BBHH", regs, 0, [17, 3, i, 8]);
+  var fields = struct.unpack(">BBHH", regs, 0);
+  checksum += fields[0] + fields[2] + fields[3];
+  ops += 8;
+}
+
+print("sum " + sum + " checksum " + checksum);
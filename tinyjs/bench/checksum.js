@@ -0,0 +1,19 @@
+// Checksums: CRC32, CRC16, Adler-32 and Fletcher over 1KB packet
+// payloads held in a Buffer and in a string, each in one native call.
+// ops counts kilobytes checksummed.
+var ops = 0;
+
+var payload = Buffer.alloc(1024);
+for (var i=0;i<1024;i++) payload.set(i, (i*131) & 255);
+var text = payload.toString();
+
+var crc = 0;
+var sum = 0;
+for (var i=0;i<2000;i++) {
+  crc = checksum.crc32(payload, 0, undefined, crc);
+  sum = (sum + checksum.crc16(text) + checksum.fletcher16(text)) & 0xFFFF;
+  sum = sum ^ (checksum.adler32(payload) & 0xFFFF) ^ (checksum.fletcher32(payload) & 0xFFFF);
+  ops += 5;
+}
+
+print("crc " + crc + " sum " + sum);
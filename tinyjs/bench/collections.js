@@ -0,0 +1,36 @@
+// Map and Set: device IDs deduplicated and readings counted into
+// histogram buckets, with numeric and string keys. ops counts lookups
+// and updates.
+var ops = 0;
+
+var seen = new Set();
+var ids = [];
+for (var i=0;i<4000;i++) {
+  var id = (i*7919) % 1500;
+  if (!seen.has(id)) {
+    seen.add(id);
+    ids.push(id);
+  }
+  ops += 2;
+}
+
+var histogram = new Map();
+for (var i=0;i<4000;i++) {
+  var bucket = (i*31) % 250;
+  if (histogram.has(bucket)) histogram.set(bucket, histogram.get(bucket)+1);
+  else histogram.set(bucket, 1);
+  ops += 3;
+}
+
+var units = new Map();
+for (var i=0;i<1000;i++) {
+  units.set("ch" + (i % 64), i);
+  ops++;
+}
+var total = 0;
+for (var i=0;i<1000;i++) {
+  total += units.get("ch" + (i % 64));
+  ops++;
+}
+
+print("ids " + ids.length + " buckets " + histogram.size + " total " + total);
@@ -0,0 +1,95 @@
+// Dispatch: a shell-like command interpreter picking one of 30 commands
+// by name, a protocol decoder switching on opcodes, and for-in walks over
+// the settings object. ops counts commands and frames handled and keys
+// visited.
+var ops = 0;
+
+var state = { led:0, count:0, total:0, errors:0 };
+function command(name, arg) {
+  switch (name) {
+    case "ledon": state.led = 1; break;
+    case "ledoff": state.led = 0; break;
+    case "toggle": state.led = 1 - state.led; break;
+    case "inc": state.count++; break;
+    case "dec": state.count--; break;
+    case "add": state.total += arg; break;
+    case "sub": state.total -= arg; break;
+    case "reset": state.count = 0; state.total = 0; break;
+    case "status": return state.led;
+    case "count": return state.count;
+    case "total": return state.total;
+    case "ping": return "pong";
+    case "echo": return arg;
+    case "double": return arg*2;
+    case "half": return arg/2;
+    case "neg": return -arg;
+    case "sq": return arg*arg;
+    case "mod7": return arg%7;
+    case "even": return (arg%2)==0;
+    case "odd": return (arg%2)==1;
+    case "min0": return arg<0 ? 0 : arg;
+    case "max9": return arg>9 ? 9 : arg;
+    case "sign": return arg<0 ? -1 : (arg>0 ? 1 : 0);
+    case "abs": return arg<0 ? -arg : arg;
+    case "zero": return arg==0;
+    case "one": return 1;
+    case "two": return 2;
+    case "version": return "1.0";
+    case "help": return "commands";
+    case "quit": return 0;
+    default: state.errors++;
+  }
+  return 0;
+}
+
+var names = ["ledon", "ledoff", "toggle", "inc", "dec", "add", "sub", "reset",
+             "status", "count", "total", "ping", "echo", "double", "half",
+             "neg", "sq", "mod7", "even", "odd", "min0", "max9", "sign",
+             "abs", "zero", "one", "two", "version", "help", "quit", "bogus"];
+var check = 0;
+for (var i=0;i<3000;i++) {
+  var r = command(names[i % 31], i % 13);
+  if (r) check++;
+  ops++;
+}
+
+// opcodes 0..15, as a decoder would see them
+function decode(op, a, b) {
+  switch (op) {
+    case 0: return a;
+    case 1: return a + b;
+    case 2: return a - b;
+    case 3: return a * b;
+    case 4: return a & b;
+    case 5: return a | b;
+    case 6: return a ^ b;
+    case 7: return a << 1;
+    case 8: return a >> 1;
+    case 9: return b;
+    case 10: return 0;
+    case 11: return -a;
+    case 12: return a == b;
+    case 13: return a < b;
+    case 14: return a > b;
+    case 15: return a % 5;
+  }
+  return 0;
+}
+var acc = 0;
+for (var i=0;i<3000;i++) {
+  acc = (acc + decode(i & 15, i, 3)) & 0xFFFF;
+  ops++;
+}
+
+var settings = { baud:115200, bits:8, parity:"none", stop:1, flow:"none",
+                 timeout:100, retries:3, echo:1, prompt:"> ", lines:24 };
+var keys = 0;
+for (var i=0;i<300;i++) {
+  for (var k in settings) {
+    if (k == "flow") continue;
+    keys++;
+    ops++;
+  }
+}
+
+print("check " + check + " errors " + state.errors + " acc " + acc + " keys " + keys + " heap " + Memory.usage().used);
@@ -0,0 +1,4 @@
+// Run after each workload by run.sh: the workload leaves the number of
+// operations it did in 'ops'.
+var benchUsage = Memory.usage();
+print("ops " + ops + " allocations " + benchUsage.allocations + " peak " + benchUsage.peak);
@@ -0,0 +1,17 @@
+// JSON round trip: JSON.stringify of nested objects and arrays, parsed
+// back with eval(). ops counts round trips.
+var ops = 0;
+
+var doc = { name : "sensor", id : 42, readings : [], meta : { unit : "mV", scale : 1.5 } };
+for (var i=0;i<50;i++) doc.readings.push({ t : i, v : i*3 });
+
+var size = 0;
+for (var i=0;i<1000;i++) {
+  var text = JSON.stringify(doc);
+  var copy = eval(text);
+  size += text.length;
+  if (copy.readings[49].v != 147) print("bad copy");
+  ops++;
+}
+
+print("bytes " + size);
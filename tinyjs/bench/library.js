@@ -0,0 +1,17 @@
+// Loading a library: many function definitions, of which only a few are
+// ever called, so the cost is in getting past the bodies. ops counts
+// function definitions.
+var body = "{ var total = 0; var text = \"a string with { braces }\";" +
+           " for (var i=0;i<n;i++) { if (i % 3 == 0) { total += i * 2; } else { total -= 1; } }" +
+           " /* a comment */ return total + text.length; }";
+var code = "";
+for (var i=0;i<100;i++)
+  code += "function lib" + i + "(n) " + body + "\n";
+
+var ops = 0;
+for (var i=0;i<500;i++) {
+  exec(code);
+  ops += 100;
+}
+
+print("lib7 " + lib7(10));
@@ -0,0 +1,44 @@
+// Loop counter throughput: ++, --, += and -= on locals, a global and a
+// property. for() stops after 8192 iterations, hence the nesting.
+function counters() {
+  var n = 0;
+  var d = 0.5;
+  for (var i=0;i<50;i++) {
+    for (var j=0;j<4000;j++) {
+      n++;
+      n += 2;
+      d += 1;
+      d -= 0.5;
+    }
+  }
+  return n + d;
+}
+
+function prefix() {
+  var n = 0;
+  for (var i=0;i<50;++i) {
+    for (var j=4000;j>0;--j) {
+      ++n;
+    }
+  }
+  return n;
+}
+
+var total = 0;
+var obj = { count : 0 };
+for (var i=0;i<25;i++) {
+  for (var j=0;j<4000;j++) {
+    total++;
+    obj.count += 3;
+  }
+}
+
+var text = "";
+for (var i=0;i<8000;i++) text += "x";
+
+print("counters " + counters());
+print("prefix " + prefix());
+print("global " + total + " " + obj.count);
+print("string " + text.length);
+
+var ops = 50*4000*4 + 50*4000 + 25*4000*2 + 8000;
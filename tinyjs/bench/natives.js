@@ -0,0 +1,17 @@
+// Native call overhead: short calls into C++ functions, where argument
+// passing dominates. ops counts native calls.
+var ops = 0;
+
+var s = "native";
+var sum = 0;
+for (var i=0;i<500;i++) {
+  for (var j=0;j<20;j++) {
+    sum += s.charCodeAt(j % 6);
+    sum += s.indexOf("t");
+    sum += Integer.parseInt("12");
+    sum += String.fromCharCode(65 + (j % 26)).length;
+    ops += 4;
+  }
+}
+
+print("sum " + sum);
@@ -0,0 +1,41 @@
+// Object property churn: objects built by a constructor and as literals,
+// properties added, rewritten and read back. ops counts property writes
+// and reads.
+var ops = 0;
+
+function Point(x, y) {
+  this.x = x;
+  this.y = y;
+}
+
+var points = [];
+for (var i=0;i<2000;i++) {
+  var p = new Point(i, i*2);
+  p.z = i*3;
+  points.push(p);
+  ops += 3;
+}
+
+var total = 0;
+for (var i=0;i<2000;i++) {
+  var p = points[i];
+  p.x = p.x + p.y;
+  total += p.x + p.z;
+  ops += 5;
+}
+
+var records = [];
+for (var i=0;i<2000;i++) {
+  var r = { id : i, name : "n" + i, active : (i%2) == 0 };
+  r.extra = r.id + 1;
+  records.push(r);
+  ops += 5;
+}
+
+var active = 0;
+for (var i=0;i<2000;i++) {
+  if (records[i].active) active += records[i].extra;
+  ops += 2;
+}
+
+print("total " + total + " active " + active);
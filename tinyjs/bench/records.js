@@ -0,0 +1,31 @@
+// Records: a log of readings whose string fields hold the same few
+// values - statuses, units, channel and sensor names - some literals and
+// some built by concatenation, as parsing a frame would. ops counts
+// records made and compared.
+var ops = 0;
+
+var statuses = ["OK", "OK", "OK", "ERR", "TIMEOUT"];
+var units = ["mV", "degC", "mA", "percent-relative-humidity"];
+var log = [];
+for (var i=0;i<600;i++) {
+  var r = {};
+  r.status = statuses[i % 5];
+  r.unit = units[i % 4];
+  r.channel = "adc-channel-" + (i % 8);
+  r.sensor = "temperature-sensor-" + (i % 6) + "-board";
+  r.value = i;
+  log.push(r);
+  ops++;
+}
+
+var errors = 0;
+var matches = 0;
+for (var i=0;i<600;i++) {
+  var r = log[i];
+  if (r.status == "ERR") errors++;
+  if (r.channel == "adc-channel-3") matches++;
+  if (r.sensor == "temperature-sensor-2-board") matches++;
+  ops++;
+}
+
+print("errors " + errors + " matches " + matches + " heap " + Memory.usage().used);
@@ -0,0 +1,21 @@
+// Function call overhead: naive recursive fibonacci and a deep linear
+// recursion. ops counts calls.
+var calls = 0;
+
+function fib(n) {
+  calls++;
+  if (n < 2) return n;
+  return fib(n-1) + fib(n-2);
+}
+
+function depth(n) {
+  calls++;
+  if (n == 0) return 0;
+  return 1 + depth(n-1);
+}
+
+print("fib " + fib(20));
+for (var i=0;i<100;i++) depth(200);
+print("depth " + depth(200));
+
+var ops = calls;
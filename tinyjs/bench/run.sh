@@ -0,0 +1,103 @@
+#!/bin/bash
+#
+# Run the bench/*.js workloads and print one JSON object per workload:
+#
+#   {"name":"loop","ops":1208000,"seconds":2.05,"ops_per_s":589268,"allocations":2234908,"peak":121288}
+#
+# Each workload leaves the number of operations it did in 'ops'.
+# harness/report.js then prints that with the allocations and peak heap
+# from Memory.usage(). The time is the best of BENCH_RUNS runs (default 3).
+#
+# Given a baseline (a previous output of this script), each workload is
+# compared against it. The script fails if a workload allocates more
+# blocks or peaks higher than the tolerance allows. The tolerance is in
+# percent, default 10. These counts don't depend on the machine.
+#
+# Times do, so they are only compared against a reference build run on
+# the same machine in the same run: BENCH_REF=<tjs> times that build too,
+# alternating runs with the one being measured, and fails if a workload's
+# best time is slower than the reference's by more than the tolerance.
+# The reference's time is reported as "ref_seconds". Without BENCH_REF,
+# times are only reported.
+#
+# usage: [BENCH_REF=<tjs>] run.sh <tjs> [baseline.json [tolerance]]
+
+TJS=$1
+BASELINE=$2
+TOLERANCE=${3:-10}
+RUNS=${BENCH_RUNS:-3}
+REF=$BENCH_REF
+DIR=$(dirname "$0")
+
+if [ -z "$TJS" ]; then
+    echo "usage: [BENCH_REF=<tjs>] run.sh <tjs> [baseline.json [tolerance]]" >&2
+    exit 2
+fi
+
+# field <json line> <name>
+field() {
+    echo "$1" | sed -n "s/.*\"$2\":\"\{0,1\}\([^,\"}]*\).*/\1/p"
+}
+
+# timed <tjs> <bench> - run it, leaving the report in 'report' and the time in 'ns'
+timed() {
+    local start end
+    start=$(date +%s%N)
+    report=$("$1" "$2" "$DIR/harness/report.js" | grep "^> ops ")
+    end=$(date +%s%N)
+    ns=$((end - start))
+}
+
+failed=0
+for bench in "$DIR"/*.js; do
+    name=$(basename "$bench" .js)
+    best=
+    refBest=
+    for run in $(seq "$RUNS"); do
+        if [ -n "$REF" ]; then
+            timed "$REF" "$bench"
+            if [ -z "$refBest" ] || [ "$ns" -lt "$refBest" ]; then refBest=$ns; fi
+        fi
+        timed "$TJS" "$bench"
+        if [ -z "$best" ] || [ "$ns" -lt "$best" ]; then best=$ns; fi
+    done
+    if [ -z "$report" ]; then
+        echo "$name: no report, the workload failed" >&2
+        failed=1
+        continue
+    fi
+    set -- $report
+    line=$(awk -v name="$name" -v ops="$3" -v allocs="$5" -v peak="$7" -v ns="$best" -v refns="$refBest" 'BEGIN {
+        s = ns / 1e9;
+        printf "{\"name\":\"%s\",\"ops\":%d,\"seconds\":%.3f,\"ops_per_s\":%d,\"allocations\":%d,\"peak\":%d",
+               name, ops, s, ops / s, allocs, peak;
+        if (refns != "") printf ",\"ref_seconds\":%.3f", refns / 1e9;
+        printf "}" }')
+    echo "$line"
+
+    if [ -n "$REF" ]; then
+        awk -v name="$name" -v tol="$TOLERANCE" -v now="$best" -v was="$refBest" 'BEGIN {
+            if (now > was * (1 + tol/100)) {
+                printf "%s: %.3fs, reference %.3fs (%+.1f%%)\n", name, now / 1e9, was / 1e9, (now - was) * 100 / was > "/dev/stderr";
+                exit 1
+            }
+        }' || failed=1
+    fi
+
+    [ -n "$BASELINE" ] || continue
+    base=$(grep "\"name\":\"$name\"" "$BASELINE")
+    if [ -z "$base" ]; then
+        echo "$name: not in $BASELINE" >&2
+        continue
+    fi
+    for key in allocations peak; do
+        awk -v name="$name" -v key="$key" -v tol="$TOLERANCE" \
+            -v now="$(field "$line" "$key")" -v was="$(field "$base" "$key")" 'BEGIN {
+            if (now > was * (1 + tol/100)) {
+                printf "%s: %s %d, baseline %d (%+.1f%%)\n", name, key, now, was, (now - was) * 100 / was > "/dev/stderr";
+                exit 1
+            }
+        }' || failed=1
+    done
+done
+exit $failed
@@ -0,0 +1,28 @@
+// String building and searching: appending, concatenation of parts,
+// split/join, indexOf and substring. ops counts string operations.
+var ops = 0;
+
+var text = "";
+for (var i=0;i<4000;i++) {
+  text += "item" + i + ",";
+  ops += 3;
+}
+
+var parts = text.split(",");
+ops++;
+var joined = parts.join(";");
+ops++;
+
+var found = 0;
+for (var i=0;i<2000;i++) {
+  if (joined.indexOf("item" + i + ";") >= 0) found++;
+  ops += 2;
+}
+
+var pieces = "";
+for (var i=0;i<2000;i++) {
+  pieces = pieces + text.substring(i, i+4);
+  ops += 2;
+}
+
+print("length " + text.length + " parts " + parts.length + " found " + found + " pieces " + pieces.length);
@@ -0,0 +1,21 @@
+// Map and Set keep objects and arrays by identity - empty ones too, which
+// a native would otherwise have been passed copies of
+var obj = {};
+var arr = [];
+var m = new Map();
+m.set(obj, "object");
+m.set(arr, arr);
+m.set(1, "one");
+var s = new Set([obj]);
+s.add(arr);
+s.add("x");
+
+var keys = s.keys();
+var entries = s.entries();
+var fromSet = s.values();
+
+result = m.get(obj)=="object" && m.has(arr) && m.get(arr)==arr && m.get(1)=="one" &&
+         !m.has({}) && s.has(obj) && s.has(arr) && !s.has([]) &&
+         keys.length==3 && keys[0]==obj && keys[1]==arr && keys[2]=="x" &&
+         entries.length==3 && entries[0][0]==obj && entries[0][1]==obj && entries[2][1]=="x" &&
+         fromSet[1]==arr && m.keys()[0]==obj;
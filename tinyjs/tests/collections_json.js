@@ -0,0 +1,11 @@
+// A Map's keys needn't be strings, so JSON.stringify writes its entries:
+// keys 1 and "1" stay apart, and the Map can be made again from them.
+var m = new Map();
+m.set(1, "number");
+m.set("1", "string");
+m.set("o", {a:[1, 2]});
+var back = new Map(eval(JSON.stringify(m)));
+var set = eval(JSON.stringify(new Set([1, "1"])));
+
+result = back.size==3 && back.get(1)=="number" && back.get("1")=="string" &&
+         back.get("o").a[1]==2 && set.length==2 && set[0]===1 && set[1]==="1";
@@ -0,0 +1,9 @@
+// Brackets nested in the script are bounded by the stack limit, as calls
+// are, so nesting too deep stops the script with an error rather than
+// overflowing the stack. This test stops with that error on purpose.
+var open = "([", close = "])";
+for (var i = 0; i < 15; i++) { open += open; close += close; }
+var code = open + "1" + close;
+function verify() { return Memory.usage().stack > 0; }
+
+eval(code);
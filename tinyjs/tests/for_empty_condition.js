@@ -0,0 +1,7 @@
+// A for loop without a condition isn't supported, and must stop the script
+// with an error rather than crash. tjs streams the tests, so the parts of
+// the loop are copies of the lexer's window, checked against its bounds.
+var started = 1;
+function verify() { return started; }
+
+for (var i = 0; ; i++) { }
@@ -0,0 +1,5 @@
+// Run after each test by run.sh: the test leaves 1 in 'result' if it passed.
+// A test that stops with an error on purpose defines verify() instead, to
+// work the result out from what it left behind.
+if (verify!==undefined) result = verify();
+print("result " + result);
@@ -0,0 +1,6 @@
+// A module whose exported functions use its private functions and vars
+var calls = 0;
+function twice(x) { return x * 2; }
+function count() { calls++; return calls; }
+exports.twicePlusOne = function(x) { count(); return twice(x) + 1; };
+exports.calls = function() { return calls; };
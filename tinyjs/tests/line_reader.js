@@ -0,0 +1,20 @@
+// next() reads into the reader's line in place, but what else holds the
+// old line - a variable, or the literal it was set to - mustn't change
+var fd = fs.open("/tmp/tjs_line_reader.txt", "w");
+fs.write(fd, "one\ntwo\nthree\nfour\n");
+fs.close(fd);
+
+fd = fs.open("/tmp/tjs_line_reader.txt", "r");
+var r = fs.readLines(fd, 4);
+r.next();
+var first = r.line;
+r.next();
+var second = r.line;
+r.line = "abc";
+var pos = r.pos;
+r.next();
+var literal = "abc";
+r.next();
+fs.close(fd);
+
+result = first == "one" && second == "two" && r.line == "four" && literal == "abc" && pos == 4 && r.pos == 3;
@@ -0,0 +1,13 @@
+// A native can't go over the heap quota in one call - the block it asks
+// for is refused, and the script stops with the error. This test stops
+// with it on purpose, and verify() checks the heap never got near it.
+var used = Memory.usage().used;
+Memory.setQuota(used + 100000);
+var small = Buffer.alloc(1000);
+var big;
+function verify() {
+  Memory.setQuota(0);
+  return small.length==1000 && big===undefined && Memory.usage().peak < used + 100000;
+}
+
+big = Buffer.alloc(50000000);
@@ -0,0 +1,8 @@
+// Functions exported by a module can use what the module keeps private,
+// after it has finished loading
+var m = require("./lib/private");
+// the caller's own function of the same name isn't the one used
+function twice(x) { return 0; }
+
+result = m.twicePlusOne(20)==41 && m.twicePlusOne(1)==3 && m.calls()==2 &&
+         require("./lib/private.js")==m;
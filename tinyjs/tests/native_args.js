@@ -0,0 +1,6 @@
+// A native isn't called when evaluating one of its arguments fails. This
+// test stops with that error on purpose, and verify() checks what was left.
+var buf = Buffer.alloc(2).fill(7);
+function verify() { return buf.get(0)==7 && buf.get(1)==7; }
+
+buf.fill(nosuch());
@@ -0,0 +1,8 @@
+// A native isn't called when its argument list doesn't parse, either. This
+// test stops with that syntax error on purpose, and verify() checks what
+// was left.
+var buf = Buffer.alloc(2).fill(7);
+var view = new DataView(buf);
+function verify() { return buf.get(0)==7 && buf.get(1)==7; }
+
+view.setUint8(0 9);
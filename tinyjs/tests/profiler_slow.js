@@ -0,0 +1,7 @@
+// A sampling interval of a second or more must not be passed as
+// microseconds alone. The timer is left running on purpose, for the
+// interpreter to stop when it goes.
+var slow = Profiler.start(1);
+var fast = Profiler.start(1000000);
+var tooFast = Profiler.start(2000000);
+result = slow && fast && !tooFast && Profiler.start(1);
@@ -0,0 +1,11 @@
+// A pattern stays compiled while String.replace calls back into script,
+// even if the replacement function compiles enough patterns to fill the
+// cache
+var made = 0;
+var str = "a1b2c3";
+var out = str.replace(new RegExp("\\d", "g"), function(m) {
+  for (var i = 0; i < 20; i++) { var r = new RegExp("x" + made + "_" + i); made++; }
+  return "<" + m + ">";
+});
+
+result = out=="a<1>b<2>c<3>" && made==60;
@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Run the tests/*.js scripts. Each one sets 'result' to 1 if everything
+# it checked was right, and harness/check.js then prints it:
+#
+#   > result 1
+#
+# The tests run from this directory, so they can require("./lib/...").
+# A test that stops with an error prints no result, and fails too - unless
+# it defines verify(), which harness/check.js then uses for the result.
+#
+# usage: run.sh <tjs>
+
+TJS=$1
+DIR=$(dirname "$0")
+
+if [ -z "$TJS" ]; then
+    echo "usage: run.sh <tjs>" >&2
+    exit 2
+fi
+case "$TJS" in
+    /*) ;;
+    *) TJS="$PWD/$TJS" ;;
+esac
+
+cd "$DIR" || exit 2
+failed=0
+for test in *.js; do
+    name=$(basename "$test" .js)
+    if "$TJS" "$test" harness/check.js 2>&1 | grep -q "^> result 1$"; then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+done
+exit $failed
@@ -0,0 +1,23 @@
+// Shapes go with the last object that has them, so objects used as
+// dictionaries - with keys no other object has - don't use up the shapes
+// that may exist. An object that goes to dictionary mode keeps its shape,
+// as the links it already has are named by it.
+var before = Memory.usage().shapes;
+var d;
+for (var i=0;i<2000;i++) {
+  d = {};
+  d["key" + i] = i;
+  d["other" + i] = i;
+}
+d = 0;
+
+// past the most slots an object goes to dictionary mode
+var wide = {};
+for (var i=0;i<40;i++) wide["p" + i] = i;
+var sum = 0, count = 0;
+for (var k in wide) { sum += wide[k]; count++; }
+var kept = Memory.usage().shapes >= before + 32;
+var ok = wide.p0==0 && wide.p31==31 && wide.p39==39 && count==40 && sum==780;
+wide = 0;
+
+result = kept && ok && Memory.usage().shapes < before + 20;
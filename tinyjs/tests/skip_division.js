@@ -0,0 +1,12 @@
+// Function bodies are skipped without being tokenised until they are
+// called, which has to tell a '/' dividing from one that could start a
+// regular expression - taking a division for one skips past the '}'
+function postfix(i) { var y = i++ / 2; return y; }
+function postfixDec(i) { var y = i-- / 2; return y; }
+function prefix(i) { var y = 4 / ++i; return y; }
+function names(a, b) { var x = a / b / 1; return x; }
+function brackets(a) { return (a[0]) / 2 / a[1]; }
+function keyword(a) { if (a) { return 8 / a; } return 0; }
+
+result = postfix(4)==2 && postfixDec(4)==2 && prefix(1)==2 && names(8, 2)==4 &&
+         brackets([8, 2])==2 && keyword(4)==2;
@@ -0,0 +1,5 @@
+// A start past the end is taken as the end, where "" is still found
+var s = "hello", e = "";
+result = s.indexOf("", 10)==5 && s.indexOf("", 5)==5 && s.indexOf("", 2)==2 &&
+         s.indexOf("o", 10)==-1 && s.indexOf("lo", 3)==3 && s.indexOf("", -3)==0 &&
+         e.indexOf("", 1)==0 && s.split("l").length==3;
@@ -0,0 +1,16 @@
+// Compiled switches are found again by where their body is in the text
+// being run. The code given to exec() is freed afterwards, so the next
+// code may well be lexed from the same place - and mustn't get the cases
+// of the switch that was there before
+var got = "";
+for (var k = 0; k < 4; k++)
+  exec("switch (1) { case " + k + ": got += \"" + k + "\"; break; default: got += \"-\"; }");
+
+// and a function's switch is found again at each call
+function name(n) {
+  switch (n) { case 1: return "one"; case 2: return "two"; default: return "many"; }
+}
+var names = "";
+for (var i = 0; i < 4; i++) names += name(i) + " ";
+
+result = got == "-1--" && names == "many one two many ";